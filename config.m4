@@ -3,5 +3,5 @@ PHP_ARG_ENABLE(stackdriver_debugger, whether to enable my extension,
 
 if test "$PHP_STACKDRIVER_DEBUGGER" = "yes"; then
   AC_DEFINE(HAVE_STACKDRIVER_DEBUGGER, 1, [Whether you have Stackdriver Debugger])
-  PHP_NEW_EXTENSION(stackdriver_debugger, stackdriver_debugger.c stackdriver_debugger_ast.c stackdriver_debugger_logpoint.c stackdriver_debugger_snapshot.c, $ext_shared)
+  PHP_NEW_EXTENSION(stackdriver_debugger, stackdriver_debugger.c stackdriver_debugger_ast.c stackdriver_debugger_batch.c stackdriver_debugger_eval.c stackdriver_debugger_json.c stackdriver_debugger_logpoint.c stackdriver_debugger_path_filter.c stackdriver_debugger_probe.c stackdriver_debugger_registry.c stackdriver_debugger_shared.c stackdriver_debugger_snapshot.c, $ext_shared)
 fi
@@ -30,6 +30,10 @@
 #define PHP_STACKDRIVER_DEBUGGER_INI_MAX_TIME "stackdriver_debugger.max_time"
 #define PHP_STACKDRIVER_DEBUGGER_INI_MAX_TIME_PERCENTAGE "stackdriver_debugger.max_time_percentage"
 #define PHP_STACKDRIVER_DEBUGGER_INI_MAX_MEMORY "stackdriver_debugger.max_memory"
+#define PHP_STACKDRIVER_DEBUGGER_INI_REGISTRY_PATH "stackdriver_debugger.registry_path"
+#define PHP_STACKDRIVER_DEBUGGER_INI_SNAPSHOT_CLAIM_SLOTS "stackdriver_debugger.snapshot_claim_slots"
+#define PHP_STACKDRIVER_DEBUGGER_INI_SNAPSHOT_CLAIM_TTL "stackdriver_debugger.snapshot_claim_ttl"
+#define PHP_STACKDRIVER_DEBUGGER_INI_MAX_HOST_TIME_PERCENTAGE "stackdriver_debugger.max_host_time_percentage"
 
 PHP_FUNCTION(stackdriver_debugger_version);
 
@@ -63,9 +67,41 @@ ZEND_BEGIN_MODULE_GLOBALS(stackdriver_debugger)
     /* array of stackdriver_debugger_message_t */
     HashTable *collected_messages;
 
+    /* breakpoints registered this request by probe slot, kept between requests */
+    struct stackdriver_debugger_probe_slot_t *probe_slots;
+
+    /* request generation of current probe slots */
+    uint32_t probe_generation;
+
+    /* whether a breakpoint was bound to a probe slot this request */
+    zend_bool probes_bound;
+
+    /* whether the breakpoint registry has breakpoints this request */
+    zend_bool registry_breakpoints;
+
+    /* callable receiving collected snapshots and messages at request end */
+    zval batch_callback;
+    zend_fcall_info batch_fci;
+    zend_fcall_info_cache batch_fcc;
+
     /* array of pointers to ast node types */
     HashTable *ast_to_clean;
 
+    /* map of statement -> stackdriver_debugger_compiled_statement_t */
+    HashTable *compiled_statements;
+
+    /* map of function whitelist -> (map of statement -> verdict), kept between requests */
+    HashTable *statement_verdicts;
+
+    /* map of statement -> verdict for the whitelist of the current request */
+    HashTable *whitelist_verdicts;
+
+    /* map of filename -> (map of breakpoint id -> failure) compiled by this thread, kept between requests */
+    HashTable *failed_breakpoints;
+
+    /* breakpoint registry mapped and parsed by this thread, kept between requests */
+    struct stackdriver_debugger_registry_t *registry;
+
     double time_spent;
     double request_start;
     size_t memory_used;
@@ -21,7 +21,12 @@
 #include "php_stackdriver_debugger.h"
 #include "stackdriver_debugger.h"
 #include "stackdriver_debugger_ast.h"
+#include "stackdriver_debugger_batch.h"
+#include "stackdriver_debugger_eval.h"
 #include "stackdriver_debugger_logpoint.h"
+#include "stackdriver_debugger_probe.h"
+#include "stackdriver_debugger_registry.h"
+#include "stackdriver_debugger_shared.h"
 #include "stackdriver_debugger_snapshot.h"
 #include "zend_exceptions.h"
 #include "stackdriver_debugger_time_functions.h"
@@ -51,10 +56,28 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_stackdriver_debugger_add_logpoint, 0, 0, 4)
     ZEND_ARG_ARRAY_INFO(0, options, 0)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO_EX(arginfo_stackdriver_debugger_add_breakpoints, 0, 0, 1)
+    ZEND_ARG_ARRAY_INFO(0, breakpoints, 0)
+    ZEND_ARG_ARRAY_INFO(0, options, 0)
+ZEND_END_ARG_INFO()
+
 ZEND_BEGIN_ARG_INFO_EX(arginfo_stackdriver_debugger_valid_statement, 0, 0, 1)
     ZEND_ARG_TYPE_INFO(0, statement, IS_STRING, 0)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO_EX(arginfo_stackdriver_debugger_set_batch_callback, 0, 0, 1)
+    ZEND_ARG_INFO(0, callback)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_stackdriver_debugger_write_registry, 0, 0, 1)
+    ZEND_ARG_ARRAY_INFO(0, breakpoints, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_stackdriver_debugger_update_registry, 0, 0, 1)
+    ZEND_ARG_ARRAY_INFO(0, add, 0)
+    ZEND_ARG_ARRAY_INFO(0, removeIds, 0)
+ZEND_END_ARG_INFO()
+
 
 /* List of functions provided by this extension */
 static zend_function_entry stackdriver_debugger_functions[] = {
@@ -65,7 +88,13 @@ static zend_function_entry stackdriver_debugger_functions[] = {
     PHP_FE(stackdriver_debugger_logpoint, arginfo_stackdriver_debugger_logpoint)
     PHP_FE(stackdriver_debugger_add_logpoint, arginfo_stackdriver_debugger_add_logpoint)
     PHP_FE(stackdriver_debugger_list_logpoints, NULL)
+    PHP_FE(stackdriver_debugger_add_breakpoints, arginfo_stackdriver_debugger_add_breakpoints)
     PHP_FE(stackdriver_debugger_valid_statement, arginfo_stackdriver_debugger_valid_statement)
+    PHP_FE(stackdriver_debugger_list_failed_breakpoints, NULL)
+    PHP_FE(stackdriver_debugger_set_batch_callback, arginfo_stackdriver_debugger_set_batch_callback)
+    PHP_FE(stackdriver_debugger_deliver_batch, NULL)
+    PHP_FE(stackdriver_debugger_write_registry, arginfo_stackdriver_debugger_write_registry)
+    PHP_FE(stackdriver_debugger_update_registry, arginfo_stackdriver_debugger_update_registry)
     PHP_FE_END
 };
 
@@ -104,6 +133,10 @@ PHP_INI_BEGIN()
     PHP_INI_ENTRY(PHP_STACKDRIVER_DEBUGGER_INI_MAX_TIME, "10", PHP_INI_ALL, NULL)
     PHP_INI_ENTRY(PHP_STACKDRIVER_DEBUGGER_INI_MAX_TIME_PERCENTAGE, "1", PHP_INI_ALL, NULL)
     PHP_INI_ENTRY(PHP_STACKDRIVER_DEBUGGER_INI_MAX_MEMORY, "10", PHP_INI_ALL, OnUpdate_stackdriver_debugger_max_memory)
+    PHP_INI_ENTRY(PHP_STACKDRIVER_DEBUGGER_INI_REGISTRY_PATH, "", PHP_INI_SYSTEM | PHP_INI_PERDIR, NULL)
+    PHP_INI_ENTRY(PHP_STACKDRIVER_DEBUGGER_INI_SNAPSHOT_CLAIM_SLOTS, "4096", PHP_INI_SYSTEM, NULL)
+    PHP_INI_ENTRY(PHP_STACKDRIVER_DEBUGGER_INI_SNAPSHOT_CLAIM_TTL, "3600", PHP_INI_SYSTEM, NULL)
+    PHP_INI_ENTRY(PHP_STACKDRIVER_DEBUGGER_INI_MAX_HOST_TIME_PERCENTAGE, "0", PHP_INI_SYSTEM, NULL)
 PHP_INI_END()
 
 /**
@@ -120,7 +153,21 @@ PHP_FUNCTION(stackdriver_debugger_version)
 static void php_stackdriver_debugger_globals_ctor(void *pDest TSRMLS_DC)
 {
     zend_stackdriver_debugger_globals *stackdriver_debugger_global = (zend_stackdriver_debugger_globals *) pDest;
+    stackdriver_debugger_ast_globals_ctor(stackdriver_debugger_global);
+    stackdriver_debugger_probe_globals_ctor(stackdriver_debugger_global);
+    stackdriver_debugger_registry_globals_ctor(stackdriver_debugger_global);
+}
+
+#ifdef ZTS
+/* Destructor used for freeing the stackdriver_debugger globals of a thread */
+static void php_stackdriver_debugger_globals_dtor(void *pDest TSRMLS_DC)
+{
+    zend_stackdriver_debugger_globals *stackdriver_debugger_global = (zend_stackdriver_debugger_globals *) pDest;
+    stackdriver_debugger_ast_globals_dtor(stackdriver_debugger_global);
+    stackdriver_debugger_probe_globals_dtor(stackdriver_debugger_global);
+    stackdriver_debugger_registry_globals_dtor(stackdriver_debugger_global);
 }
+#endif
 
 static double stackdriver_debugger_total_time_spent;
 static int stackdriver_debugger_total_requests_handled;
@@ -168,13 +215,72 @@ static zend_bool stackdriver_debugger_opcache_enabled()
 static int stackdriver_debugger_opcache_invalidate(zend_string *filename)
 {
     zval params[2], function_name, ret;
-    if (STACKDRIVER_DEBUGGER_G(opcache_enabled)) {
-        ZVAL_STRING(&function_name, "opcache_invalidate");
-        ZVAL_STR(&params[0], filename);
-        ZVAL_BOOL(&params[1], 1);
-        return call_user_function(EG(function_table), NULL, &function_name, &ret, 2, params);
+    int result;
+
+    if (!STACKDRIVER_DEBUGGER_G(opcache_enabled)) {
+        return FAILURE;
     }
-    return FAILURE;
+
+    ZVAL_STRINGL(&function_name, "opcache_invalidate", sizeof("opcache_invalidate") - 1);
+    ZVAL_STR(&params[0], filename);
+    ZVAL_BOOL(&params[1], 1);
+    result = call_user_function(EG(function_table), NULL, &function_name, &ret, 2, params);
+    zval_ptr_dtor(&function_name);
+    if (result == SUCCESS) {
+        zval_ptr_dtor(&ret);
+    }
+    return result;
+}
+
+/**
+ * Returns whether the file of a newly registered breakpoint must be
+ * invalidated for the breakpoint to be injected: unless the file was already
+ * compiled with it, or it failed to inject into the unchanged file.
+ */
+static zend_bool stackdriver_debugger_needs_invalidation(zend_string *filename, zend_string *breakpoint_id)
+{
+    return (breakpoint_id == NULL || stackdriver_debugger_breakpoint_injected(filename, breakpoint_id) != SUCCESS) &&
+        stackdriver_debugger_breakpoint_failed(filename, breakpoint_id) != SUCCESS;
+}
+
+/**
+ * Make sure a newly registered breakpoint will be injected, invalidating its
+ * file if needed so it is compiled again.
+ */
+void stackdriver_debugger_ensure_injected(zend_string *filename, zend_string *breakpoint_id)
+{
+    if (stackdriver_debugger_needs_invalidation(filename, breakpoint_id)) {
+        stackdriver_debugger_opcache_invalidate(filename);
+    }
+}
+
+/**
+ * Copy the provided callable into `resolved` and resolve it once so it can be
+ * called directly with zend_call_function(). On failure, a warning naming the
+ * kind of callback is raised and `resolved` is set to null.
+ */
+int stackdriver_debugger_resolve_callback(zval *callback, const char *kind, zval *resolved, zend_fcall_info *fci, zend_fcall_info_cache *fcc)
+{
+    char *error = NULL;
+
+    ZVAL_COPY(resolved, callback);
+    if (zend_fcall_info_init(resolved, 0, fci, fcc, NULL, &error) != SUCCESS) {
+        php_error_docref(NULL, E_WARNING, "Invalid %s callback: %s.", kind, error ? error : "not callable");
+        if (error) {
+            efree(error);
+        }
+        zval_ptr_dtor(resolved);
+        ZVAL_NULL(resolved);
+        return FAILURE;
+    }
+    if (error) {
+        efree(error);
+    }
+
+    /* match call_user_function_ex(), which separates by-reference arguments */
+    fci->no_separation = 0;
+
+    return SUCCESS;
 }
 
 /**
@@ -201,6 +307,108 @@ PHP_FUNCTION(stackdriver_debugger_list_logpoints)
     list_logpoints(return_value);
 }
 
+/**
+ * Return the list of breakpoints which could not be injected when their file
+ * was last compiled by this process, or by this thread in ZTS builds. Each
+ * entry contains the `filename`, the breakpoint `id`, the `reason` and the
+ * file's `mtime` at compilation.
+ *
+ * @return array
+ */
+PHP_FUNCTION(stackdriver_debugger_list_failed_breakpoints)
+{
+    array_init(return_value);
+    stackdriver_debugger_list_failed_breakpoints(return_value);
+}
+
+/**
+ * Set a callback which receives all snapshots and logpoint messages collected
+ * without their own callback, once the response has been sent. It is called
+ * after fastcgi_finish_request() in non-thread-safe builds and from a
+ * shutdown function with the values stackdriver_debugger_list_snapshots() and
+ * stackdriver_debugger_list_logpoints() would return, and those items are
+ * then no longer listed.
+ *
+ * @param callable $callback function (array $snapshots, array $messages)
+ * @return boolean
+ */
+PHP_FUNCTION(stackdriver_debugger_set_batch_callback)
+{
+    zval *callback;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "z", &callback) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    if (stackdriver_debugger_set_batch_callback(callback) != SUCCESS) {
+        RETURN_FALSE;
+    }
+
+    RETURN_TRUE;
+}
+
+/**
+ * Call the batch callback with everything collected since the last delivery.
+ * Registered as a shutdown function when a batch callback is set.
+ */
+PHP_FUNCTION(stackdriver_debugger_deliver_batch)
+{
+    stackdriver_debugger_deliver_batch();
+}
+
+/**
+ * Replace the shared breakpoint registry at the stackdriver_debugger.registry_path
+ * ini setting with the provided breakpoints. Every request then registers
+ * these breakpoints when it starts, without any PHP code.
+ *
+ * @param array $breakpoints A list of breakpoint arrays, each with a `type`
+ *        ("snapshot" or "logpoint", defaults to "snapshot"), `id`, absolute
+ *        `filename`, `line`, and optional `condition` and `expressions`.
+ *        Logpoints also require a `logLevel` and `format`.
+ * @return int|false The generation of the new registry
+ */
+PHP_FUNCTION(stackdriver_debugger_write_registry)
+{
+    HashTable *breakpoints;
+    zend_long generation;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "h", &breakpoints) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    if (stackdriver_debugger_write_registry(breakpoints, &generation) != SUCCESS) {
+        RETURN_FALSE;
+    }
+
+    RETURN_LONG(generation);
+}
+
+/**
+ * Apply a diff to the shared breakpoint registry and bump its generation.
+ * Workers keep reusing their parsed breakpoints until the generation changes.
+ *
+ * @param array $add Breakpoint arrays to add, in the format of
+ *        stackdriver_debugger_write_registry(). A breakpoint with the id of
+ *        an existing breakpoint replaces it.
+ * @param array $removeIds [optional] Ids of the breakpoints to remove
+ * @return int|false The generation of the new registry
+ */
+PHP_FUNCTION(stackdriver_debugger_update_registry)
+{
+    HashTable *add, *remove_ids = NULL;
+    zend_long generation;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "h|h", &add, &remove_ids) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    if (stackdriver_debugger_update_registry(add, remove_ids, &generation) != SUCCESS) {
+        RETURN_FALSE;
+    }
+
+    RETURN_LONG(generation);
+}
+
 /**
  * Returns whether or not the provided PHP statement can be used for a
  * breakpoint condition or as an evaluated expression.
@@ -233,7 +441,7 @@ static int test_conditional(zend_string *statement)
 
     zval retval;
 
-    if (zend_eval_string(ZSTR_VAL(statement), &retval, "conditional") == SUCCESS) {
+    if (evaluate_debugger_statement(statement, &retval, "conditional") == SUCCESS) {
         /*
          * If there is an exception thrown in the conditional, we will ignore
          * it. An exception is unexpected as we validate the type of AST
@@ -265,94 +473,177 @@ static int test_conditional(zend_string *statement)
 }
 
 /**
- * Capture the execution state for the provided snapshotId.
- *
- * @param string $snapshotId
- * @return boolean
+ * Returns whether we have already spent the time or memory allowed for the
+ * debugger in this request, in which case further breakpoints are skipped.
  */
-PHP_FUNCTION(stackdriver_debugger_snapshot)
+static zend_bool stackdriver_debugger_over_limits()
 {
-    zend_string *snapshot_id = NULL;
-    stackdriver_debugger_snapshot_t *snapshot;
-    double start = 0;
-    size_t start_memory = 0, end_memory;
-
     // if we've already spent more than the time allowed, skip further breakpoints
     if (STACKDRIVER_DEBUGGER_G(time_spent) > stackdriver_debugger_max_time()) {
-        RETURN_FALSE;
+        return 1;
     }
 
-    // if we've already spent more than the time allowed, skip further breakpoints
+    // if we've already spent more than the memory allowed, skip further breakpoints
     if (STACKDRIVER_DEBUGGER_G(memory_used) > STACKDRIVER_DEBUGGER_G(max_memory)) {
-        RETURN_FALSE;
+        return 1;
     }
 
-    if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "S", &snapshot_id) == FAILURE) {
-        RETURN_FALSE;
+    // if all workers together have used up the time allowed, skip further breakpoints
+    if (!stackdriver_debugger_budget_available()) {
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Add the time since the provided start to the debugger time spent in this
+ * request and charge it to the budget shared by all workers.
+ */
+static void stackdriver_debugger_record_time(double start)
+{
+    double time_spent = stackdriver_debugger_now() - start;
+
+    STACKDRIVER_DEBUGGER_G(time_spent) = STACKDRIVER_DEBUGGER_G(time_spent) + time_spent;
+    stackdriver_debugger_charge_budget(time_spent);
+}
+
+/**
+ * Capture the execution state for the provided snapshot. The provided
+ * execute_data is the innermost frame to capture. Returns SUCCESS if the
+ * snapshot was captured.
+ */
+int stackdriver_debugger_snapshot_hit(zend_execute_data *execute_data, stackdriver_debugger_snapshot_t *snapshot)
+{
+    double start = 0;
+    size_t start_memory = 0, end_memory;
+
+    if (snapshot == NULL || snapshot->fulfilled) {
+        return FAILURE;
+    }
+
+    /* another worker already captured this snapshot */
+    if (snapshot->claimable && stackdriver_debugger_snapshot_claimed(snapshot->id)) {
+        snapshot->fulfilled = 1;
+        return FAILURE;
+    }
+
+    if (stackdriver_debugger_over_limits()) {
+        return FAILURE;
     }
 
     start = stackdriver_debugger_now();
     start_memory = zend_memory_usage(0);
-    snapshot = zend_hash_find_ptr(STACKDRIVER_DEBUGGER_G(snapshots_by_id), snapshot_id);
 
-    if (snapshot == NULL || snapshot->fulfilled || test_conditional(snapshot->condition) != SUCCESS) {
-        STACKDRIVER_DEBUGGER_G(time_spent) = STACKDRIVER_DEBUGGER_G(time_spent) + stackdriver_debugger_now() - start;
-        RETURN_FALSE;
+    if (test_conditional(snapshot->condition) != SUCCESS) {
+        stackdriver_debugger_record_time(start);
+        return FAILURE;
+    }
+
+    /* only the first hit to pass the condition captures the snapshot */
+    if (snapshot->claimable) {
+        if (stackdriver_debugger_claim_snapshot(snapshot->id) != SUCCESS) {
+            snapshot->fulfilled = 1;
+            stackdriver_debugger_record_time(start);
+            return FAILURE;
+        }
+        snapshot->claimed = 1;
     }
 
     evaluate_snapshot(execute_data, snapshot);
-    STACKDRIVER_DEBUGGER_G(time_spent) = STACKDRIVER_DEBUGGER_G(time_spent) + stackdriver_debugger_now() - start;
+    stackdriver_debugger_record_time(start);
     end_memory = zend_memory_usage(0);
     if (end_memory > start_memory) {
         STACKDRIVER_DEBUGGER_G(memory_used) = STACKDRIVER_DEBUGGER_G(memory_used) + end_memory - start_memory;
     }
 
-    RETURN_TRUE;
+    return SUCCESS;
 }
 
 /**
- * Evaluate the logpoint for the provided logpointId.
- *
- * @param string $logpointId
- * @return boolean
+ * Evaluate the provided logpoint in the provided execution scope. Returns
+ * SUCCESS if the logpoint was evaluated.
  */
-PHP_FUNCTION(stackdriver_debugger_logpoint)
+int stackdriver_debugger_logpoint_hit(zend_execute_data *execute_data, stackdriver_debugger_logpoint_t *logpoint)
 {
-    zend_string *logpoint_id = NULL;
-    stackdriver_debugger_logpoint_t *logpoint;
     double start = 0;
     size_t start_memory = 0, end_memory;
 
-    // if we've already spent more than the time allowed, skip further breakpoints
-    if (STACKDRIVER_DEBUGGER_G(time_spent) > stackdriver_debugger_max_time()) {
-        RETURN_FALSE;
-    }
-
-    // if we've already spent more than the time allowed, skip further breakpoints
-    if (STACKDRIVER_DEBUGGER_G(memory_used) > STACKDRIVER_DEBUGGER_G(max_memory)) {
-        RETURN_FALSE;
+    if (logpoint == NULL) {
+        return FAILURE;
     }
 
-    if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "S", &logpoint_id) == FAILURE) {
-        RETURN_FALSE;
+    if (stackdriver_debugger_over_limits()) {
+        return FAILURE;
     }
 
     start = stackdriver_debugger_now();
     start_memory = zend_memory_usage(0);
-    logpoint = zend_hash_find_ptr(STACKDRIVER_DEBUGGER_G(logpoints_by_id), logpoint_id);
 
-    if (logpoint == NULL || test_conditional(logpoint->condition) != SUCCESS) {
-        STACKDRIVER_DEBUGGER_G(time_spent) = STACKDRIVER_DEBUGGER_G(time_spent) + stackdriver_debugger_now() - start;
-        RETURN_FALSE;
+    if (test_conditional(logpoint->condition) != SUCCESS) {
+        stackdriver_debugger_record_time(start);
+        return FAILURE;
     }
 
     evaluate_logpoint(execute_data, logpoint);
-    STACKDRIVER_DEBUGGER_G(time_spent) = STACKDRIVER_DEBUGGER_G(time_spent) + stackdriver_debugger_now() - start;
+    stackdriver_debugger_record_time(start);
     end_memory = zend_memory_usage(0);
     if (end_memory > start_memory) {
         STACKDRIVER_DEBUGGER_G(memory_used) = STACKDRIVER_DEBUGGER_G(memory_used) + end_memory - start_memory;
     }
 
+    return SUCCESS;
+}
+
+/**
+ * Capture the execution state for the provided snapshotId.
+ *
+ * Breakpoints are normally triggered by injected probe opcodes. This function
+ * remains for code which calls it directly.
+ *
+ * @param string $snapshotId
+ * @return boolean
+ */
+PHP_FUNCTION(stackdriver_debugger_snapshot)
+{
+    zend_string *snapshot_id = NULL;
+    stackdriver_debugger_snapshot_t *snapshot;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "S", &snapshot_id) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    snapshot = zend_hash_find_ptr(STACKDRIVER_DEBUGGER_G(snapshots_by_id), snapshot_id);
+    if (stackdriver_debugger_snapshot_hit(execute_data, snapshot) != SUCCESS) {
+        RETURN_FALSE;
+    }
+
+    RETURN_TRUE;
+}
+
+/**
+ * Evaluate the logpoint for the provided logpointId.
+ *
+ * Breakpoints are normally triggered by injected probe opcodes. This function
+ * remains for code which calls it directly.
+ *
+ * @param string $logpointId
+ * @return boolean
+ */
+PHP_FUNCTION(stackdriver_debugger_logpoint)
+{
+    zend_string *logpoint_id = NULL;
+    stackdriver_debugger_logpoint_t *logpoint;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "S", &logpoint_id) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    logpoint = zend_hash_find_ptr(STACKDRIVER_DEBUGGER_G(logpoints_by_id), logpoint_id);
+    if (stackdriver_debugger_logpoint_hit(execute_data, logpoint) != SUCCESS) {
+        RETURN_FALSE;
+    }
+
     RETURN_TRUE;
 }
 
@@ -366,6 +657,251 @@ static zend_string *stackdriver_debugger_full_filename(zend_string *relative_or_
     return strpprintf(source_root_length + 2 + ZSTR_LEN(relative_or_full_path), "%s%c%s", source_root, DEFAULT_SLASH, ZSTR_VAL(relative_or_full_path));
 }
 
+/**
+ * Add a path filter rule for each path prefix in `paths`. Relative prefixes
+ * are resolved against `root`.
+ */
+static void add_path_filter_rules(stackdriver_debugger_path_filter_t *filter, HashTable *paths, unsigned char rule, const char *root, size_t root_len)
+{
+    zval *path;
+
+    if (paths == NULL) {
+        return;
+    }
+
+    ZEND_HASH_FOREACH_VAL(paths, path) {
+        if (Z_TYPE_P(path) != IS_STRING) {
+            continue;
+        }
+        if (IS_ABSOLUTE_PATH(Z_STRVAL_P(path), Z_STRLEN_P(path))) {
+            stackdriver_debugger_path_filter_add(filter, Z_STRVAL_P(path), Z_STRLEN_P(path), rule);
+        } else {
+            zend_string *full_path = stackdriver_debugger_full_filename(Z_STR_P(path), root, root_len);
+            stackdriver_debugger_path_filter_add(filter, ZSTR_VAL(full_path), ZSTR_LEN(full_path), rule);
+            zend_string_release(full_path);
+        }
+    } ZEND_HASH_FOREACH_END();
+}
+
+/**
+ * Find an option, falling back to `defaults` if it is missing or null in
+ * `options`. Either table may be NULL.
+ */
+static zval *find_option(HashTable *options, HashTable *defaults, const char *key)
+{
+    zval *zv = NULL;
+
+    if (options != NULL) {
+        zv = zend_hash_str_find(options, key, strlen(key));
+    }
+    if ((zv == NULL || Z_ISNULL_P(zv)) && defaults != NULL) {
+        zv = zend_hash_str_find(defaults, key, strlen(key));
+    }
+    if (zv != NULL && Z_ISNULL_P(zv)) {
+        return NULL;
+    }
+    return zv;
+}
+
+/* Find a string option, NULL if it is missing or not a string */
+static zend_string *find_string_option(HashTable *options, HashTable *defaults, const char *key)
+{
+    zval *zv = find_option(options, defaults, key);
+    if (zv == NULL || Z_TYPE_P(zv) != IS_STRING) {
+        return NULL;
+    }
+    return Z_STR_P(zv);
+}
+
+/**
+ * Find the `snapshotId`, `condition` and `expressions` options shared by
+ * snapshots and logpoints. Returns FAILURE with a warning if any of them has
+ * the wrong type.
+ */
+static int find_statement_options(HashTable *options, HashTable *defaults,
+    zend_string **snapshot_id, zend_string **condition, HashTable **expressions)
+{
+    zval *zv, *expression;
+
+    *snapshot_id = NULL;
+    zv = find_option(options, defaults, "snapshotId");
+    if (zv != NULL) {
+        if (Z_TYPE_P(zv) != IS_STRING) {
+            php_error_docref(NULL, E_WARNING, "Breakpoint snapshotId must be a string.");
+            return FAILURE;
+        }
+        *snapshot_id = Z_STR_P(zv);
+    }
+
+    zv = find_option(options, defaults, "condition");
+    if (zv != NULL) {
+        if (Z_TYPE_P(zv) != IS_STRING) {
+            php_error_docref(NULL, E_WARNING, "Breakpoint condition must be a string.");
+            return FAILURE;
+        }
+        *condition = Z_STR_P(zv);
+    }
+
+    zv = find_option(options, defaults, "expressions");
+    if (zv != NULL) {
+        if (Z_TYPE_P(zv) != IS_ARRAY) {
+            php_error_docref(NULL, E_WARNING, "Breakpoint expressions must be an array.");
+            return FAILURE;
+        }
+        ZEND_HASH_FOREACH_VAL(Z_ARRVAL_P(zv), expression) {
+            if (Z_TYPE_P(expression) != IS_STRING) {
+                php_error_docref(NULL, E_WARNING, "Breakpoint expressions must be strings.");
+                return FAILURE;
+            }
+        } ZEND_HASH_FOREACH_END();
+        *expressions = Z_ARRVAL_P(zv);
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * Returns an emalloc'ed copy of the directory relative breakpoint paths are
+ * resolved against: the provided source root, or else the directory of the
+ * calling file.
+ */
+static char *breakpoint_root(zend_execute_data *caller, zval *source_root, size_t *root_len)
+{
+    zend_string *path;
+    char *root;
+
+    if (source_root != NULL && Z_TYPE_P(source_root) == IS_STRING) {
+        path = Z_STR_P(source_root);
+        *root_len = ZSTR_LEN(path);
+        return estrndup(ZSTR_VAL(path), ZSTR_LEN(path));
+    }
+
+    path = caller->func->op_array.filename;
+    root = estrndup(ZSTR_VAL(path), ZSTR_LEN(path));
+    *root_len = php_dirname(root, ZSTR_LEN(path));
+    return root;
+}
+
+/**
+ * Register a snapshot from the provided options, falling back to `defaults`
+ * for options it does not set. On success, `full_filename` is set to the
+ * resolved filename (to be released by the caller) and `snapshot_id` to the
+ * requested id, if any. The snapshot still needs to be injected.
+ */
+static int add_snapshot(zend_string *filename, zend_long lineno,
+    HashTable *options, HashTable *defaults, const char *root, size_t root_len,
+    zend_string **full_filename, zend_string **snapshot_id)
+{
+    zend_string *condition = NULL;
+    HashTable *expressions = NULL, *include_paths = NULL, *exclude_paths = NULL;
+    zval *zv = NULL, *callback = NULL, *capture_variables = NULL;
+    stackdriver_debugger_path_filter_t *path_filter = NULL;
+    zend_long max_stack_eval_depth = 0;
+    stackdriver_debugger_capture_options_t capture_options = {0};
+
+    if (find_statement_options(options, defaults, snapshot_id, &condition, &expressions) != SUCCESS) {
+        return FAILURE;
+    }
+
+    callback = find_option(options, defaults, "callback");
+
+    zv = find_option(options, defaults, "maxDepth");
+    if (zv != NULL && Z_TYPE_P(zv) == IS_LONG) {
+        max_stack_eval_depth = Z_LVAL_P(zv);
+    }
+
+    zv = find_option(options, defaults, "maxMemberDepth");
+    if (zv != NULL && Z_TYPE_P(zv) == IS_LONG) {
+        capture_options.max_member_depth = Z_LVAL_P(zv);
+    }
+
+    zv = find_option(options, defaults, "maxMembers");
+    if (zv != NULL && Z_TYPE_P(zv) == IS_LONG) {
+        capture_options.max_members = Z_LVAL_P(zv);
+    }
+
+    zv = find_option(options, defaults, "maxStringLength");
+    if (zv != NULL && Z_TYPE_P(zv) == IS_LONG) {
+        capture_options.max_string_length = Z_LVAL_P(zv);
+    }
+
+    zv = find_option(options, defaults, "maxTotalBytes");
+    if (zv != NULL && Z_TYPE_P(zv) == IS_LONG) {
+        capture_options.max_total_bytes = Z_LVAL_P(zv);
+    }
+
+    zv = find_option(options, defaults, "freezeObjects");
+    if (zv != NULL) {
+        capture_options.freeze_objects = zend_is_true(zv);
+    }
+
+    zv = find_option(options, defaults, "format");
+    if (zv != NULL && Z_TYPE_P(zv) == IS_STRING) {
+        if (zend_string_equals_literal(Z_STR_P(zv), "json")) {
+            capture_options.json = 1;
+        } else if (!zend_string_equals_literal(Z_STR_P(zv), "array")) {
+            php_error_docref(NULL, E_WARNING, "Unknown snapshot format '%s'.", Z_STRVAL_P(zv));
+            return FAILURE;
+        }
+    }
+
+    capture_variables = find_option(options, defaults, "captureVariables");
+
+    zv = find_option(options, defaults, "includePaths");
+    if (zv != NULL && Z_TYPE_P(zv) == IS_ARRAY) {
+        include_paths = Z_ARRVAL_P(zv);
+    }
+
+    zv = find_option(options, defaults, "excludePaths");
+    if (zv != NULL && Z_TYPE_P(zv) == IS_ARRAY) {
+        exclude_paths = Z_ARRVAL_P(zv);
+    }
+
+    *full_filename = stackdriver_debugger_full_filename(filename, root, root_len);
+    if (include_paths != NULL || exclude_paths != NULL) {
+        path_filter = stackdriver_debugger_path_filter_create();
+        add_path_filter_rules(path_filter, include_paths, STACKDRIVER_DEBUGGER_PATH_INCLUDE, root, root_len);
+        add_path_filter_rules(path_filter, exclude_paths, STACKDRIVER_DEBUGGER_PATH_EXCLUDE, root, root_len);
+    }
+
+    if (register_snapshot(*snapshot_id, *full_filename, lineno, condition, expressions, callback, max_stack_eval_depth, &capture_options, capture_variables, path_filter) != SUCCESS) {
+        zend_string_release(*full_filename);
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * Register a logpoint from the provided options, falling back to `defaults`
+ * for options it does not set. On success, `full_filename` is set to the
+ * resolved filename (to be released by the caller) and `snapshot_id` to the
+ * requested id, if any. The logpoint still needs to be injected.
+ */
+static int add_logpoint(zend_string *filename, zend_long lineno,
+    zend_string *log_level, zend_string *format,
+    HashTable *options, HashTable *defaults, const char *root, size_t root_len,
+    zend_string **full_filename, zend_string **snapshot_id)
+{
+    zend_string *condition = NULL;
+    HashTable *expressions = NULL;
+    zval *callback = NULL;
+
+    if (find_statement_options(options, defaults, snapshot_id, &condition, &expressions) != SUCCESS) {
+        return FAILURE;
+    }
+
+    callback = find_option(options, defaults, "callback");
+
+    *full_filename = stackdriver_debugger_full_filename(filename, root, root_len);
+    if (register_logpoint(*snapshot_id, *full_filename, lineno, log_level, condition, format, expressions, callback) != SUCCESS) {
+        zend_string_release(*full_filename);
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
 /**
  * Register a snapshot for recording.
  *
@@ -388,70 +924,58 @@ static zend_string *stackdriver_debugger_full_filename(zend_string *relative_or_
  *            hit.
  *      @type int $maxDepth The maximum number of stackframes whose variables
  *            are captured. If 0, then no limit. **Defaults to** 0.
+ *      @type int $maxMemberDepth The maximum levels of array members captured
+ *            below each variable. If 0, then no limit. **Defaults to** 0.
+ *      @type int $maxMembers The maximum number of members captured per
+ *            array. If 0, then no limit. **Defaults to** 0.
+ *      @type int $maxStringLength The maximum number of bytes captured per
+ *            string. If 0, then no limit. **Defaults to** 0.
+ *      @type int $maxTotalBytes The approximate maximum number of bytes
+ *            captured for the whole snapshot. If 0, then no limit.
+ *            **Defaults to** 0.
+ *      @type bool $freezeObjects If true, objects are copied at the time of
+ *            the snapshot into detached __PHP_Incomplete_Class instances
+ *            instead of being referenced. Objects are always copied when a
+ *            capture limit is set. **Defaults to** false.
+ *      @type string $format The format the collected snapshot is reported in
+ *            to the callback and by stackdriver_debugger_list_snapshots(),
+ *            either "array" or "json" for a Stackdriver Breakpoint JSON
+ *            string. **Defaults to** "array".
+ *      @type array|string $captureVariables The names of the variables to
+ *            capture in each stackframe, "*" for all variables or "auto" for
+ *            the variables referenced by the condition and expressions, or
+ *            all variables if there are neither or they read the scope
+ *            implicitly (e.g. `compact()`). **Defaults to** "*".
+ *      @type array $includePaths Path prefixes of the stackframes whose
+ *            variables are captured. Relative prefixes are resolved like the
+ *            filename. **Defaults to** all paths.
+ *      @type array $excludePaths Path prefixes of the stackframes whose
+ *            variables are not captured. If a path matches both an include
+ *            and an exclude prefix, the longer prefix wins.
  * }
  */
 PHP_FUNCTION(stackdriver_debugger_add_snapshot)
 {
-    zend_string *filename, *full_filename, *snapshot_id = NULL, *condition = NULL, *source_root = NULL;
+    zend_string *filename, *full_filename, *snapshot_id = NULL;
     zend_long lineno;
-    HashTable *options = NULL, *expressions = NULL;
-    zval *zv = NULL, *callback = NULL;
-    zend_long max_stack_eval_depth = 0;
+    HashTable *options = NULL;
+    char *root;
+    size_t root_len;
+    int result;
 
     if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "Sl|h", &filename, &lineno, &options) == FAILURE) {
         RETURN_FALSE;
     }
 
-    if (options != NULL) {
-        zv = zend_hash_str_find(options, "snapshotId", strlen("snapshotId"));
-        if (zv != NULL && !Z_ISNULL_P(zv)) {
-            snapshot_id = Z_STR_P(zv);
-        }
-
-        zv = zend_hash_str_find(options, "condition", strlen("condition"));
-        if (zv != NULL && !Z_ISNULL_P(zv)) {
-            condition = Z_STR_P(zv);
-        }
-
-        zv = zend_hash_str_find(options, "expressions", strlen("expressions"));
-        if (zv != NULL && !Z_ISNULL_P(zv)) {
-            expressions = Z_ARRVAL_P(zv);
-        }
-
-        zv = zend_hash_str_find(options, "sourceRoot", strlen("sourceRoot"));
-        if (zv != NULL && !Z_ISNULL_P(zv)) {
-            source_root = Z_STR_P(zv);
-        }
-
-        zv = zend_hash_str_find(options, "callback", strlen("callback"));
-        if (zv != NULL && !Z_ISNULL_P(zv)) {
-            callback = zv;
-        }
-
-        zv = zend_hash_str_find(options, "maxDepth", strlen("maxDepth"));
-        if (zv != NULL && Z_TYPE_P(zv) == IS_LONG) {
-            max_stack_eval_depth = Z_LVAL_P(zv);
-        }
-    }
-
-    if (source_root == NULL) {
-        source_root = EX(prev_execute_data)->func->op_array.filename;
-        char *current_file = estrndup(ZSTR_VAL(source_root), ZSTR_LEN(source_root));
-        size_t dirlen = php_dirname(current_file, ZSTR_LEN(source_root));
-        full_filename = stackdriver_debugger_full_filename(filename, current_file, dirlen);
-        efree(current_file);
-    } else {
-        full_filename = stackdriver_debugger_full_filename(filename, ZSTR_VAL(source_root), ZSTR_LEN(source_root));
-    }
+    root = breakpoint_root(EX(prev_execute_data), find_option(options, NULL, "sourceRoot"), &root_len);
+    result = add_snapshot(filename, lineno, options, NULL, root, root_len, &full_filename, &snapshot_id);
+    efree(root);
 
-    if (register_snapshot(snapshot_id, full_filename, lineno, condition, expressions, callback, max_stack_eval_depth) != SUCCESS) {
-        zend_string_release(full_filename);
+    if (result != SUCCESS) {
         RETURN_FALSE;
     }
 
-    if (stackdriver_debugger_breakpoint_injected(full_filename, snapshot_id) != SUCCESS) {
-        stackdriver_debugger_opcache_invalidate(full_filename);
-    }
+    stackdriver_debugger_ensure_injected(full_filename, snapshot_id);
     zend_string_release(full_filename);
 
     RETURN_TRUE;
@@ -475,63 +999,120 @@ PHP_FUNCTION(stackdriver_debugger_add_snapshot)
  */
 PHP_FUNCTION(stackdriver_debugger_add_logpoint)
 {
-    zend_string *filename, *full_filename, *format = NULL, *snapshot_id = NULL, *condition = NULL, *source_root = NULL, *log_level = NULL;
+    zend_string *filename, *full_filename, *format, *log_level, *snapshot_id = NULL;
     zend_long lineno;
-    HashTable *options = NULL, *expressions = NULL;
-    zval *zv = NULL, *callback = NULL;
+    HashTable *options = NULL;
+    char *root;
+    size_t root_len;
+    int result;
 
     if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "SlSS|h", &filename, &lineno, &log_level, &format, &options) == FAILURE) {
         RETURN_FALSE;
     }
 
-    if (options != NULL) {
-        zv = zend_hash_str_find(options, "snapshotId", strlen("snapshotId"));
-        if (zv != NULL && !Z_ISNULL_P(zv)) {
-            snapshot_id = Z_STR_P(zv);
-        }
+    root = breakpoint_root(EX(prev_execute_data), find_option(options, NULL, "sourceRoot"), &root_len);
+    result = add_logpoint(filename, lineno, log_level, format, options, NULL, root, root_len, &full_filename, &snapshot_id);
+    efree(root);
 
-        zv = zend_hash_str_find(options, "condition", strlen("condition"));
-        if (zv != NULL && !Z_ISNULL_P(zv)) {
-            condition = Z_STR_P(zv);
-        }
+    if (result != SUCCESS) {
+        RETURN_FALSE;
+    }
 
-        zv = zend_hash_str_find(options, "expressions", strlen("expressions"));
-        if (zv != NULL && !Z_ISNULL_P(zv)) {
-            expressions = Z_ARRVAL_P(zv);
-        }
+    stackdriver_debugger_ensure_injected(full_filename, snapshot_id);
+    zend_string_release(full_filename);
 
-        zv = zend_hash_str_find(options, "sourceRoot", strlen("sourceRoot"));
-        if (zv != NULL && !Z_ISNULL_P(zv)) {
-            source_root = Z_STR_P(zv);
-        }
+    RETURN_TRUE;
+}
 
-        zv = zend_hash_str_find(options, "callback", strlen("callback"));
-        if (zv != NULL && !Z_ISNULL_P(zv)) {
-            callback = zv;
-        }
+/**
+ * Register many snapshots and logpoints at once. Paths are resolved against a
+ * single source root and each affected file is invalidated at most once.
+ *
+ * @param array $breakpoints A list of breakpoint arrays. Each contains the
+ *        `filename` and `line`, an optional `type` ("snapshot" or
+ *        "logpoint", defaults to "snapshot") and the options accepted by
+ *        stackdriver_debugger_add_snapshot() or
+ *        stackdriver_debugger_add_logpoint(). Logpoints also require a
+ *        `logLevel` and `format`.
+ * @param array $options [optional] Options used for every breakpoint which
+ *        does not set them itself, including the `sourceRoot`.
+ * @return array Whether each breakpoint was registered, by the breakpoint's key
+ */
+PHP_FUNCTION(stackdriver_debugger_add_breakpoints)
+{
+    HashTable *breakpoints, *options = NULL, *bp, to_invalidate;
+    zend_string *key, *filename, *full_filename, *snapshot_id, *type, *log_level, *format;
+    zend_ulong index;
+    zval *breakpoint, *zv;
+    char *root;
+    size_t root_len;
+    int result;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "h|h", &breakpoints, &options) == FAILURE) {
+        RETURN_FALSE;
     }
 
-    if (source_root == NULL) {
-        source_root = EX(prev_execute_data)->func->op_array.filename;
-        char *current_file = estrndup(ZSTR_VAL(source_root), ZSTR_LEN(source_root));
-        size_t dirlen = php_dirname(current_file, ZSTR_LEN(source_root));
-        full_filename = stackdriver_debugger_full_filename(filename, current_file, dirlen);
-        efree(current_file);
-    } else {
-        full_filename = stackdriver_debugger_full_filename(filename, ZSTR_VAL(source_root), ZSTR_LEN(source_root));
-    }
+    array_init(return_value);
+    zend_hash_init(&to_invalidate, 8, NULL, NULL, 0);
+    root = breakpoint_root(EX(prev_execute_data), find_option(options, NULL, "sourceRoot"), &root_len);
+
+    ZEND_HASH_FOREACH_KEY_VAL(breakpoints, index, key, breakpoint) {
+        result = FAILURE;
+        full_filename = NULL;
+        snapshot_id = NULL;
+
+        if (Z_TYPE_P(breakpoint) == IS_ARRAY) {
+            bp = Z_ARRVAL_P(breakpoint);
+            filename = NULL;
+            zv = zend_hash_str_find(bp, "filename", strlen("filename"));
+            if (zv != NULL && Z_TYPE_P(zv) == IS_STRING) {
+                filename = Z_STR_P(zv);
+            }
+            type = NULL;
+            zv = zend_hash_str_find(bp, "type", strlen("type"));
+            if (zv != NULL && Z_TYPE_P(zv) == IS_STRING) {
+                type = Z_STR_P(zv);
+            }
+            zv = zend_hash_str_find(bp, "line", strlen("line"));
+
+            if (filename == NULL || zv == NULL || Z_TYPE_P(zv) != IS_LONG) {
+                php_error_docref(NULL, E_WARNING, "Breakpoints require a filename and line.");
+            } else if (type == NULL || zend_string_equals_literal(type, "snapshot")) {
+                result = add_snapshot(filename, Z_LVAL_P(zv), bp, options, root, root_len, &full_filename, &snapshot_id);
+            } else if (zend_string_equals_literal(type, "logpoint")) {
+                log_level = find_string_option(bp, options, "logLevel");
+                format = find_string_option(bp, options, "format");
+                if (log_level == NULL || format == NULL) {
+                    php_error_docref(NULL, E_WARNING, "Logpoints require a logLevel and format.");
+                } else {
+                    result = add_logpoint(filename, Z_LVAL_P(zv), log_level, format, bp, options, root, root_len, &full_filename, &snapshot_id);
+                }
+            } else {
+                php_error_docref(NULL, E_WARNING, "Unknown breakpoint type '%s'.", ZSTR_VAL(type));
+            }
+        } else {
+            php_error_docref(NULL, E_WARNING, "Breakpoints must be arrays.");
+        }
 
-    if (register_logpoint(snapshot_id, full_filename, lineno, log_level, condition, format, expressions, callback) != SUCCESS) {
-        zend_string_release(full_filename);
-        RETURN_FALSE;
-    }
+        if (result == SUCCESS) {
+            if (stackdriver_debugger_needs_invalidation(full_filename, snapshot_id)) {
+                zend_hash_add_empty_element(&to_invalidate, full_filename);
+            }
+            zend_string_release(full_filename);
+        }
 
-    if (stackdriver_debugger_breakpoint_injected(full_filename, snapshot_id) != SUCCESS) {
-        stackdriver_debugger_opcache_invalidate(full_filename);
-    }
-    zend_string_release(full_filename);
+        if (key) {
+            add_assoc_bool_ex(return_value, ZSTR_VAL(key), ZSTR_LEN(key), result == SUCCESS);
+        } else {
+            add_index_bool(return_value, index, result == SUCCESS);
+        }
+    } ZEND_HASH_FOREACH_END();
+    efree(root);
 
-    RETURN_TRUE;
+    ZEND_HASH_FOREACH_STR_KEY(&to_invalidate, filename) {
+        stackdriver_debugger_opcache_invalidate(filename);
+    } ZEND_HASH_FOREACH_END();
+    zend_hash_destroy(&to_invalidate);
 }
 
 /* {{{ PHP_MINIT_FUNCTION
@@ -540,14 +1121,17 @@ PHP_MINIT_FUNCTION(stackdriver_debugger)
 {
     /* allocate global request variables */
 #ifdef ZTS
-    ts_allocate_id(&stackdriver_debugger_globals_id, sizeof(zend_stackdriver_debugger_globals), php_stackdriver_debugger_globals_ctor, NULL);
+    ts_allocate_id(&stackdriver_debugger_globals_id, sizeof(zend_stackdriver_debugger_globals), php_stackdriver_debugger_globals_ctor, php_stackdriver_debugger_globals_dtor);
 #else
-    php_stackdriver_debugger_globals_ctor(&php_stackdriver_debugger_globals_ctor);
+    php_stackdriver_debugger_globals_ctor(&stackdriver_debugger_globals);
 #endif
 
     REGISTER_INI_ENTRIES();
 
     stackdriver_debugger_ast_minit(INIT_FUNC_ARGS_PASSTHRU);
+    stackdriver_debugger_probe_minit(INIT_FUNC_ARGS_PASSTHRU);
+    stackdriver_debugger_shared_minit(INIT_FUNC_ARGS_PASSTHRU);
+    stackdriver_debugger_snapshot_minit(INIT_FUNC_ARGS_PASSTHRU);
 
     stackdriver_debugger_total_time_spent = 0.0;
     stackdriver_debugger_total_requests_handled = 0;
@@ -561,6 +1145,10 @@ PHP_MINIT_FUNCTION(stackdriver_debugger)
 PHP_MSHUTDOWN_FUNCTION(stackdriver_debugger)
 {
     stackdriver_debugger_ast_mshutdown(SHUTDOWN_FUNC_ARGS_PASSTHRU);
+    stackdriver_debugger_batch_mshutdown(SHUTDOWN_FUNC_ARGS_PASSTHRU);
+    stackdriver_debugger_probe_mshutdown(SHUTDOWN_FUNC_ARGS_PASSTHRU);
+    stackdriver_debugger_registry_mshutdown(SHUTDOWN_FUNC_ARGS_PASSTHRU);
+    stackdriver_debugger_shared_mshutdown(SHUTDOWN_FUNC_ARGS_PASSTHRU);
     UNREGISTER_INI_ENTRIES();
 
     return SUCCESS;
@@ -575,11 +1163,17 @@ PHP_RINIT_FUNCTION(stackdriver_debugger)
     STACKDRIVER_DEBUGGER_G(memory_used) = 0;
 
     stackdriver_debugger_ast_rinit(TSRMLS_C);
+    stackdriver_debugger_eval_rinit(TSRMLS_C);
+    stackdriver_debugger_probe_rinit(TSRMLS_C);
     stackdriver_debugger_snapshot_rinit(TSRMLS_C);
     stackdriver_debugger_logpoint_rinit(TSRMLS_C);
+    stackdriver_debugger_batch_rinit(TSRMLS_C);
 
     STACKDRIVER_DEBUGGER_G(opcache_enabled) = stackdriver_debugger_opcache_enabled();
 
+    /* register breakpoints from the shared registry, if configured */
+    stackdriver_debugger_registry_rinit(TSRMLS_C);
+
     return SUCCESS;
 }
 
@@ -590,6 +1184,8 @@ PHP_RSHUTDOWN_FUNCTION(stackdriver_debugger)
     stackdriver_debugger_ast_rshutdown(TSRMLS_C);
     stackdriver_debugger_snapshot_rshutdown(TSRMLS_C);
     stackdriver_debugger_logpoint_rshutdown(TSRMLS_C);
+    stackdriver_debugger_eval_rshutdown(TSRMLS_C);
+    stackdriver_debugger_batch_rshutdown(TSRMLS_C);
 
     stackdriver_debugger_total_time_spent += stackdriver_debugger_now() - STACKDRIVER_DEBUGGER_G(request_start) - STACKDRIVER_DEBUGGER_G(time_spent);
     stackdriver_debugger_total_requests_handled++;
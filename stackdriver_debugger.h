@@ -17,6 +17,7 @@
 #ifndef PHP_STACKDRIVER_DEBUGGER_H
 #define PHP_STACKDRIVER_DEBUGGER_H 1
 
+#include "stackdriver_debugger_logpoint.h"
 #include "stackdriver_debugger_snapshot.h"
 
 /* Debugger functions */
@@ -26,6 +27,22 @@ PHP_FUNCTION(stackdriver_debugger_list_snapshots);
 PHP_FUNCTION(stackdriver_debugger_logpoint);
 PHP_FUNCTION(stackdriver_debugger_add_logpoint);
 PHP_FUNCTION(stackdriver_debugger_list_logpoints);
+PHP_FUNCTION(stackdriver_debugger_add_breakpoints);
 PHP_FUNCTION(stackdriver_debugger_valid_statement);
+PHP_FUNCTION(stackdriver_debugger_list_failed_breakpoints);
+PHP_FUNCTION(stackdriver_debugger_set_batch_callback);
+PHP_FUNCTION(stackdriver_debugger_deliver_batch);
+PHP_FUNCTION(stackdriver_debugger_write_registry);
+PHP_FUNCTION(stackdriver_debugger_update_registry);
+
+/* Breakpoint registration */
+void stackdriver_debugger_ensure_injected(zend_string *filename, zend_string *breakpoint_id);
+
+/* Callbacks */
+int stackdriver_debugger_resolve_callback(zval *callback, const char *kind, zval *resolved, zend_fcall_info *fci, zend_fcall_info_cache *fcc);
+
+/* Breakpoint hit handlers */
+int stackdriver_debugger_snapshot_hit(zend_execute_data *execute_data, stackdriver_debugger_snapshot_t *snapshot);
+int stackdriver_debugger_logpoint_hit(zend_execute_data *execute_data, stackdriver_debugger_logpoint_t *logpoint);
 
 #endif
@@ -18,6 +18,8 @@
 #include "stackdriver_debugger_ast.h"
 #include "stackdriver_debugger_snapshot.h"
 #include "stackdriver_debugger_logpoint.h"
+#include "stackdriver_debugger_probe.h"
+#include "stackdriver_debugger_registry.h"
 #include "zend_language_scanner.h"
 #include "zend_exceptions.h"
 #include "main/php_ini.h"
@@ -32,18 +34,50 @@ static HashTable global_whitelisted_functions;
 /* map of filename -> (map of breakpoint id -> nil) */
 static HashTable registered_breakpoints;
 
+/* Reason reported when no statement could be found for a breakpoint */
+#define FAILED_NO_STATEMENT "No statement found at or after the line in its scope"
+
+/* Breakpoint which could not be injected when its file was last compiled */
+typedef struct stackdriver_debugger_failed_breakpoint_t {
+    /* modification time of the file when it was compiled */
+    time_t mtime;
+
+    /* human readable reason for the failure */
+    const char *reason;
+} stackdriver_debugger_failed_breakpoint_t;
+
+/* Maximum number of statement verdicts to remember per whitelist and thread */
+#define STATEMENT_VERDICTS_MAX_SIZE 4096
+
+/* Maximum number of function whitelists to remember verdicts for per thread */
+#define STATEMENT_VERDICTS_MAX_WHITELISTS 8
+
+/* cached results of validating a statement */
+#define STATEMENT_VALID 0
+#define STATEMENT_COMPILE_ERROR 1
+#define STATEMENT_INVALID_OPERATIONS 2
+
 /**
- * This method generates a new abstract syntax tree that injects a function
- * call to `stackdriver_debugger()`.
+ * This method generates a new abstract syntax tree that injects a probe with
+ * the provided code. The probe compiles to a single ZEND_TICKS opcode which is
+ * handled by our user opcode handler, so no function call is made.
  * Format:
  *
  *   ZEND_AST_STMT_LIST
- *   - ZEND_AST_CALL
- *     - ZEND_AST_ZVAL (string, the callback function)
- *     - ZEND_AST_ARG_LIST (empty list)
- *       - ZEND_AST_ZVAL (string, the breakpoint id)
+ *   - ZEND_AST_DECLARE
+ *     - ZEND_AST_CONST_DECL
+ *       - ZEND_AST_CONST_ELEM
+ *         - ZEND_AST_ZVAL (string, "ticks")
+ *         - ZEND_AST_ZVAL (long, the probe flag and code)
+ *     - ZEND_AST_ECHO
+ *       - ZEND_AST_ZVAL (string, empty)
  *   - original zend_ast node
  *
+ * i.e. `declare(ticks=N) echo '';`. The compiler emits a tick after each
+ * statement in the declare body, and only once if the previous opcode was
+ * already a tick. The empty echo keeps adjacent probes from being merged and
+ * is removed by the optimizer.
+ *
  * Note: we are emalloc-ing memory here, but it is expected that the PHP
  * internals recursively walk the syntax tree and free allocated memory. This
  * method cannot leave dangling pointers or the allocated memory may never be
@@ -52,67 +86,228 @@ static HashTable registered_breakpoints;
  * Note: you also need to set the second child of this result when injecting
  * to execute the statement you are replacing.
  */
-static zend_ast_list *create_debugger_ast(const char *callback, zend_string *breakpoint_id, uint32_t lineno)
-{
-    zend_ast *new_call;
-    zend_ast_zval *var, *snapshot_id;
-    zend_ast_list *new_list, *arg_list;
-
-    var = emalloc(sizeof(zend_ast_zval));
-    var->kind = ZEND_AST_ZVAL;
-    ZVAL_STRING(&var->val, callback);
-    var->val.u2.lineno = lineno;
-    zend_hash_next_index_insert_ptr(STACKDRIVER_DEBUGGER_G(ast_to_clean), var);
-
-    snapshot_id = emalloc(sizeof(zend_ast_zval));
-    snapshot_id->kind = ZEND_AST_ZVAL;
-    ZVAL_STR(&snapshot_id->val, breakpoint_id);
-    snapshot_id->val.u2.lineno = lineno;
-    zend_hash_next_index_insert_ptr(STACKDRIVER_DEBUGGER_G(ast_to_clean), snapshot_id);
-
-    arg_list = emalloc(sizeof(zend_ast_list) + sizeof(zend_ast*));
-    arg_list->kind = ZEND_AST_ARG_LIST;
-    arg_list->lineno = lineno;
-    arg_list->children = 1;
-    arg_list->child[0] = (zend_ast*)snapshot_id;
-    zend_hash_next_index_insert_ptr(STACKDRIVER_DEBUGGER_G(ast_to_clean), arg_list);
-
-    new_call = emalloc(sizeof(zend_ast) + sizeof(zend_ast*));
-    new_call->kind = ZEND_AST_CALL;
-    new_call->lineno = lineno;
-    new_call->child[0] = (zend_ast*)var;
-    new_call->child[1] = (zend_ast*)arg_list;
-    zend_hash_next_index_insert_ptr(STACKDRIVER_DEBUGGER_G(ast_to_clean), new_call);
+static zend_ast_list *create_probe_ast(zend_long code, uint32_t lineno)
+{
+    zend_ast *declare, *elem, *echo;
+    zend_ast_zval *name, *value, *output;
+    zend_ast_list *new_list, *declare_list;
+
+    name = emalloc(sizeof(zend_ast_zval));
+    name->kind = ZEND_AST_ZVAL;
+    ZVAL_STRING(&name->val, "ticks");
+    name->val.u2.lineno = lineno;
+    zend_hash_next_index_insert_ptr(STACKDRIVER_DEBUGGER_G(ast_to_clean), name);
+
+    value = emalloc(sizeof(zend_ast_zval));
+    value->kind = ZEND_AST_ZVAL;
+    ZVAL_LONG(&value->val, STACKDRIVER_DEBUGGER_PROBE_FLAG | code);
+    value->val.u2.lineno = lineno;
+    zend_hash_next_index_insert_ptr(STACKDRIVER_DEBUGGER_G(ast_to_clean), value);
+
+    /* allocate room for the doc comment child added in later PHP versions */
+    elem = emalloc(sizeof(zend_ast) + 2 * sizeof(zend_ast*));
+    elem->kind = ZEND_AST_CONST_ELEM;
+    elem->attr = 0;
+    elem->lineno = lineno;
+    elem->child[0] = (zend_ast*)name;
+    elem->child[1] = (zend_ast*)value;
+    elem->child[2] = NULL;
+    zend_hash_next_index_insert_ptr(STACKDRIVER_DEBUGGER_G(ast_to_clean), elem);
+
+    declare_list = emalloc(sizeof(zend_ast_list));
+    declare_list->kind = ZEND_AST_CONST_DECL;
+    declare_list->attr = 0;
+    declare_list->lineno = lineno;
+    declare_list->children = 1;
+    declare_list->child[0] = elem;
+    zend_hash_next_index_insert_ptr(STACKDRIVER_DEBUGGER_G(ast_to_clean), declare_list);
+
+    output = emalloc(sizeof(zend_ast_zval));
+    output->kind = ZEND_AST_ZVAL;
+    ZVAL_EMPTY_STRING(&output->val);
+    output->val.u2.lineno = lineno;
+    zend_hash_next_index_insert_ptr(STACKDRIVER_DEBUGGER_G(ast_to_clean), output);
+
+    echo = emalloc(sizeof(zend_ast));
+    echo->kind = ZEND_AST_ECHO;
+    echo->attr = 0;
+    echo->lineno = lineno;
+    echo->child[0] = (zend_ast*)output;
+    zend_hash_next_index_insert_ptr(STACKDRIVER_DEBUGGER_G(ast_to_clean), echo);
+
+    declare = emalloc(sizeof(zend_ast) + sizeof(zend_ast*));
+    declare->kind = ZEND_AST_DECLARE;
+    declare->attr = 0;
+    declare->lineno = lineno;
+    declare->child[0] = (zend_ast*)declare_list;
+    declare->child[1] = echo;
+    zend_hash_next_index_insert_ptr(STACKDRIVER_DEBUGGER_G(ast_to_clean), declare);
 
     /* create a new statement list */
     new_list = emalloc(sizeof(zend_ast_list) + sizeof(zend_ast*));
     new_list->kind = ZEND_AST_STMT_LIST;
+    new_list->attr = 0;
     new_list->lineno = lineno;
     new_list->children = 2;
-    new_list->child[0] = new_call;
+    new_list->child[0] = declare;
     zend_hash_next_index_insert_ptr(STACKDRIVER_DEBUGGER_G(ast_to_clean), new_list);
 
     return new_list;
 }
 
+/* AST nodes are at least 8 bytes apart, so drop the always-zero low bits */
+#define AST_INDEX_KEY(ast) (((zend_ulong)(uintptr_t)(ast)) >> 3)
+
 /**
- * This method walks through the AST looking for the last non-list statement to
- * replace with a new AST node that first calls the `stackdriver_debugger()`
- * function, then calls the original statement.
+ * Walk the AST once, recording every node whose subtree contains a statement
+ * list in the provided index. Statement lists are the only place we can
+ * inject, so `inject_probes` can skip any other node missing from the index
+ * instead of walking every expression in the file.
  *
- * This function returns SUCCESS if we have already injected into the syntax
- * tree. Otherwise, the function returns FAILURE.
+ * Returns 1 if the provided AST contains a statement list, 0 otherwise.
  */
-static int inject_ast(zend_ast *ast, zend_ast_list *to_insert)
+static int index_statement_lists(zend_ast *ast, HashTable *index)
+{
+    int i, num_children, found = 0;
+    zend_ast_list *list;
+    zend_ast_decl *decl;
+
+    if (ast == NULL) {
+        return 0;
+    }
+
+    if (ast->kind >> ZEND_AST_IS_LIST_SHIFT == 1) {
+        list = zend_ast_get_list(ast);
+        found = ast->kind == ZEND_AST_STMT_LIST;
+        for (i = 0; i < list->children; i++) {
+            found |= index_statement_lists(list->child[i], index);
+        }
+    } else if (ast->kind >> ZEND_AST_SPECIAL_SHIFT == 1) {
+        switch(ast->kind) {
+            case ZEND_AST_FUNC_DECL:
+            case ZEND_AST_CLOSURE:
+            case ZEND_AST_METHOD:
+            case ZEND_AST_CLASS:
+                decl = (zend_ast_decl *)ast;
+                /* For decl, the 3rd child is the body of the declaration */
+                found = index_statement_lists(decl->child[2], index);
+                break;
+        }
+    } else {
+        num_children = ast->kind >> ZEND_AST_NUM_CHILDREN_SHIFT;
+        for (i = 0; i < num_children; i++) {
+            found |= index_statement_lists(ast->child[i], index);
+        }
+    }
+
+    if (found) {
+        zend_hash_index_add_empty_element(index, AST_INDEX_KEY(ast));
+    }
+    return found;
+}
+
+/* A breakpoint waiting to be injected into the file being compiled */
+typedef struct stackdriver_debugger_pending_probe_t {
+    zend_ast_list *to_insert;
+    zend_string *breakpoint_id;
+    zend_bool injected;
+} stackdriver_debugger_pending_probe_t;
+
+#define PROBE_LINENO(probe) ((probe)->to_insert->lineno)
+
+static uint32_t inject_probes(zend_ast *ast, stackdriver_debugger_pending_probe_t **probes, uint32_t count, HashTable *index);
+
+/**
+ * Swap the probes which are not injected yet to the front, keeping them
+ * sorted, and return their number.
+ */
+static uint32_t pending_probes(stackdriver_debugger_pending_probe_t **probes, uint32_t count)
+{
+    stackdriver_debugger_pending_probe_t *probe;
+    uint32_t i, pending = 0;
+
+    for (i = 0; i < count; i++) {
+        if (!probes[i]->injected) {
+            probe = probes[i];
+            probes[i] = probes[pending];
+            probes[pending++] = probe;
+        }
+    }
+    return pending;
+}
+
+/**
+ * Replace the statement with the provided probes followed by the original
+ * statement. The probes run in the order provided.
+ */
+static void wrap_statement(zend_ast **statement, stackdriver_debugger_pending_probe_t **probes, uint32_t count)
+{
+    zend_ast *current = *statement;
+    uint32_t i;
+
+    for (i = count; i > 0; i--) {
+        probes[i - 1]->to_insert->child[1] = current;
+        probes[i - 1]->injected = 1;
+        current = (zend_ast *)probes[i - 1]->to_insert;
+    }
+    *statement = current;
+}
+
+/**
+ * Inject the probes into the statement, or in front of it if none of its
+ * statement lists can hold them.
+ */
+static void inject_statement(zend_ast **statement, stackdriver_debugger_pending_probe_t **probes, uint32_t count, HashTable *index)
+{
+    count = inject_probes(*statement, probes, count, index);
+    wrap_statement(statement, probes, count);
+}
+
+/**
+ * Offer the probes to each child, last first, until all of them are
+ * injected. Returns the number of probes left, which are moved to the front.
+ */
+static uint32_t inject_children(zend_ast **children, int num_children, stackdriver_debugger_pending_probe_t **probes, uint32_t count, HashTable *index)
+{
+    int i;
+
+    for (i = num_children - 1; i >= 0 && count > 0; i--) {
+        count = inject_probes(children[i], probes, count, index);
+    }
+    return count;
+}
+
+/**
+ * This method walks through the AST once for all of the provided probes,
+ * which are sorted by line. Each probe replaces the last non-list statement at
+ * or before its line with a new AST node that first runs the probe, then the
+ * original statement. Within a statement list, the probes are bucketed by the
+ * statement they belong to, so each subtree is only visited with the probes
+ * that can land in it.
+ *
+ * This function returns the number of probes which could not be injected into
+ * the syntax tree, which are moved to the front of `probes` in order.
+ */
+static uint32_t inject_probes(zend_ast *ast, stackdriver_debugger_pending_probe_t **probes, uint32_t count, HashTable *index)
 {
     int i, num_children;
+    uint32_t first, start, split, last;
     zend_ast *current;
     zend_ast_list *list;
     zend_ast_decl *decl;
-    zend_ast_zval *azval;
 
-    if (ast == NULL) {
-        return FAILURE;
+    if (ast == NULL || count == 0) {
+        return count;
+    }
+
+    /*
+     * Nothing can be injected into a subtree without a statement list.
+     * Statement lists we injected ourselves are not in the index, but are
+     * always statement lists.
+     */
+    if (ast->kind != ZEND_AST_STMT_LIST &&
+        !zend_hash_index_exists(index, AST_INDEX_KEY(ast))) {
+        return count;
     }
 
     /*
@@ -122,66 +317,70 @@ static int inject_ast(zend_ast *ast, zend_ast_list *to_insert)
      */
     if (ast->kind == ZEND_AST_IF) {
         list = zend_ast_get_list(ast);
-        if (list->child[0]->lineno < to_insert->lineno) {
-            for (i = list->children - 1; i >= 0; i--) {
-                current = list->child[i];
-                if (inject_ast(current, to_insert) == SUCCESS) {
-                    return SUCCESS;
-                }
-            }
+        first = 0;
+        while (first < count && PROBE_LINENO(probes[first]) <= list->child[0]->lineno) {
+            first++;
+        }
+        if (first < count) {
+            inject_children(list->child, list->children, probes + first, count - first, index);
+            count = pending_probes(probes, count);
         }
     }
 
-    if (ast->lineno > to_insert->lineno) {
-        return FAILURE;
+    /* probes before this node cannot be injected into it */
+    first = 0;
+    while (first < count && PROBE_LINENO(probes[first]) < ast->lineno) {
+        first++;
+    }
+    if (first == count) {
+        return count;
     }
 
     if (ast->kind == ZEND_AST_STMT_LIST) {
         list = zend_ast_get_list(ast);
+        last = count;
 
-        for (i = list->children - 1; i >= 0; i--) {
+        for (i = list->children - 1; i >= 0 && last > first; i--) {
             current = list->child[i];
 
+            /* the probes left at or after this statement's line belong to it */
+            start = last;
+            while (start > first && PROBE_LINENO(probes[start - 1]) >= current->lineno) {
+                start--;
+            }
+            if (start == last) {
+                continue;
+            }
+
             /*
              * If the candidate line is before the snapshot point, we could be
              * on whitespace or if the candidate line is a list or special type,
              * we need to drill in further.
              */
-            if (current->lineno < to_insert->lineno &&
-                i < list->children - 1 &&
+            if (i < list->children - 1 &&
                 current->kind >> ZEND_AST_IS_LIST_SHIFT != 1 &&
                 current->kind >> ZEND_AST_SPECIAL_SHIFT != 1 &&
                 current->kind >> ZEND_AST_NUM_CHILDREN_SHIFT != 4) {
 
-                if (inject_ast(current, to_insert) != SUCCESS) {
-                    current = list->child[i+1];
-                    if (inject_ast(current, to_insert) != SUCCESS) {
-                        list->child[i+1] = (zend_ast *)to_insert;
-                        to_insert->child[1] = current;
-                    }
+                split = start;
+                while (split < last && PROBE_LINENO(probes[split]) == current->lineno) {
+                    split++;
                 }
-                return SUCCESS;
-            }
-
-            if (current->lineno <= to_insert->lineno) {
-                /* if not yet injected, inject the debugger code */
-                if (inject_ast(current, to_insert) != SUCCESS) {
-                    to_insert->child[1] = current;
-                    list->child[i] = (zend_ast *)to_insert;
+                if (split < last) {
+                    /* probes after the statement's line go before the next one */
+                    uint32_t left = inject_probes(current, probes + split, last - split, index);
+                    inject_statement(&list->child[i + 1], probes + split, left, index);
                 }
-                return SUCCESS;
+                inject_statement(&list->child[i], probes + start, split - start, index);
+            } else {
+                inject_statement(&list->child[i], probes + start, last - start, index);
             }
+            last = start;
         }
 
     } else if (ast->kind >> ZEND_AST_IS_LIST_SHIFT == 1) {
         list = zend_ast_get_list(ast);
-
-        for (i = list->children - 1; i >= 0; i--) {
-            current = list->child[i];
-            if (inject_ast(current, to_insert) == SUCCESS) {
-                return SUCCESS;
-            }
-        }
+        inject_children(list->child, list->children, probes + first, count - first, index);
 
     } else if (ast->kind >> ZEND_AST_SPECIAL_SHIFT == 1) {
         switch(ast->kind) {
@@ -191,20 +390,16 @@ static int inject_ast(zend_ast *ast, zend_ast_list *to_insert)
             case ZEND_AST_CLASS:
                 decl = (zend_ast_decl *)ast;
                 /* For decl, the 3rd child is the body of the declaration */
-                return inject_ast(decl->child[2], to_insert);
+                inject_probes(decl->child[2], probes + first, count - first, index);
+                break;
         }
     } else {
         /* number of nodes */
         num_children = ast->kind >> ZEND_AST_NUM_CHILDREN_SHIFT;
-        for (i = num_children - 1; i >= 0; i--) {
-            current = ast->child[i];
-            if (inject_ast(current, to_insert) == SUCCESS) {
-                return SUCCESS;
-            }
-        }
+        inject_children(ast->child, num_children, probes + first, count - first, index);
     }
 
-    return FAILURE;
+    return pending_probes(probes, count);
 }
 
 /**
@@ -276,6 +471,104 @@ static void reset_registered_breakpoints_for_filename(zend_string *filename)
     }
 }
 
+/**
+ * Returns the modification time of the provided file, or 0 if it cannot be
+ * determined.
+ */
+static time_t file_mtime(zend_string *filename)
+{
+    zend_stat_t sb;
+
+    if (VCWD_STAT(ZSTR_VAL(filename), &sb) != 0) {
+        return 0;
+    }
+    return sb.st_mtime;
+}
+
+/**
+ * Returns SUCCESS if the specified breakpoint_id failed to inject when the
+ * specified file was last compiled and the file has not changed since. There
+ * is no point invalidating the file for these breakpoints as recompiling it
+ * would fail again.
+ */
+int stackdriver_debugger_breakpoint_failed(zend_string *filename, zend_string *breakpoint_id)
+{
+    HashTable *breakpoints = zend_hash_find_ptr(STACKDRIVER_DEBUGGER_G(failed_breakpoints), filename);
+    stackdriver_debugger_failed_breakpoint_t *failed;
+
+    if (breakpoints == NULL || breakpoint_id == NULL) {
+        return FAILURE;
+    }
+
+    failed = zend_hash_find_ptr(breakpoints, breakpoint_id);
+    if (failed == NULL || failed->mtime != file_mtime(filename)) {
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/**
+ * Fills an initialized PHP array with an entry for each breakpoint which
+ * failed to inject when its file was last compiled.
+ */
+void stackdriver_debugger_list_failed_breakpoints(zval *return_value)
+{
+    HashTable *breakpoints;
+    zend_string *filename, *breakpoint_id;
+    stackdriver_debugger_failed_breakpoint_t *failed;
+
+    ZEND_HASH_FOREACH_STR_KEY_PTR(STACKDRIVER_DEBUGGER_G(failed_breakpoints), filename, breakpoints) {
+        ZEND_HASH_FOREACH_STR_KEY_PTR(breakpoints, breakpoint_id, failed) {
+            zval entry;
+            array_init(&entry);
+            add_assoc_str(&entry, "filename", zend_string_init(ZSTR_VAL(filename), ZSTR_LEN(filename), 0));
+            add_assoc_str(&entry, "id", zend_string_init(ZSTR_VAL(breakpoint_id), ZSTR_LEN(breakpoint_id), 0));
+            add_assoc_string(&entry, "reason", (char *)failed->reason);
+            add_assoc_long(&entry, "mtime", failed->mtime);
+            add_next_index_zval(return_value, &entry);
+        } ZEND_HASH_FOREACH_END();
+    } ZEND_HASH_FOREACH_END();
+}
+
+static void reset_failed_breakpoints_for_filename(zend_string *filename)
+{
+    HashTable *breakpoints = zend_hash_find_ptr(STACKDRIVER_DEBUGGER_G(failed_breakpoints), filename);
+    if (breakpoints != NULL) {
+        zend_hash_clean(breakpoints);
+    }
+}
+
+/**
+ * Callback for destroying each value stored in a failed_breakpoints entry.
+ */
+static void failed_breakpoint_dtor(zval *zv)
+{
+    /* use free directly because we are not handling a request */
+    free(Z_PTR_P(zv));
+    ZVAL_PTR_DTOR(zv);
+}
+
+static void register_failed_breakpoint_id(zend_string *filename, zend_string *id, const char *reason)
+{
+    HashTable *breakpoints = zend_hash_find_ptr(STACKDRIVER_DEBUGGER_G(failed_breakpoints), filename);
+    stackdriver_debugger_failed_breakpoint_t *failed;
+
+    if (breakpoints == NULL) {
+        /* Use malloc directly because we are not handling a request */
+        breakpoints = malloc(sizeof(HashTable));
+        zend_hash_init(breakpoints, 4, NULL, failed_breakpoint_dtor, 1);
+        zend_hash_str_add_ptr(STACKDRIVER_DEBUGGER_G(failed_breakpoints), ZSTR_VAL(filename), ZSTR_LEN(filename), breakpoints);
+    }
+
+    failed = zend_hash_find_ptr(breakpoints, id);
+    if (failed == NULL) {
+        failed = malloc(sizeof(stackdriver_debugger_failed_breakpoint_t));
+        zend_hash_str_add_ptr(breakpoints, ZSTR_VAL(id), ZSTR_LEN(id), failed);
+    }
+    failed->mtime = file_mtime(filename);
+    failed->reason = reason;
+}
+
 static void register_breakpoint_id(zend_string *filename, zend_string *id)
 {
     zend_string *id2 = zend_string_dup(id, 1);
@@ -283,6 +576,98 @@ static void register_breakpoint_id(zend_string *filename, zend_string *id)
     zend_hash_add_empty_element(breakpoints, id2);
 }
 
+/* The file being compiled, passed to add_registry_breakpoint */
+typedef struct stackdriver_debugger_compiled_file_t {
+    zend_string *filename;
+
+    /* breakpoints to inject, in the order they were added */
+    stackdriver_debugger_pending_probe_t *probes;
+    uint32_t num_probes;
+    uint32_t size;
+} stackdriver_debugger_compiled_file_t;
+
+/* Add a breakpoint to inject into the compiled file */
+static void add_breakpoint(stackdriver_debugger_compiled_file_t *file, int kind, zend_string *breakpoint_id, zend_long lineno)
+{
+    stackdriver_debugger_pending_probe_t *probe;
+
+    if (file->num_probes == file->size) {
+        file->size = file->size > 0 ? file->size * 2 : 8;
+        file->probes = safe_erealloc(file->probes, file->size, sizeof(stackdriver_debugger_pending_probe_t), 0);
+    }
+
+    probe = &file->probes[file->num_probes++];
+    probe->to_insert = create_probe_ast(stackdriver_debugger_probe_code(kind, breakpoint_id), lineno);
+    probe->breakpoint_id = breakpoint_id;
+    probe->injected = 0;
+}
+
+/* Add a breakpoint of the breakpoint registry to inject into the compiled file */
+static void add_registry_breakpoint(int kind, zend_string *breakpoint_id, zend_long lineno, void *data)
+{
+    add_breakpoint((stackdriver_debugger_compiled_file_t *)data, kind, breakpoint_id, lineno);
+}
+
+/* Orders probes by line, then by the order their breakpoints were added */
+static int compare_pending_probes(const void *a, const void *b)
+{
+    stackdriver_debugger_pending_probe_t *probe_a = *(stackdriver_debugger_pending_probe_t **)a;
+    stackdriver_debugger_pending_probe_t *probe_b = *(stackdriver_debugger_pending_probe_t **)b;
+
+    if (PROBE_LINENO(probe_a) != PROBE_LINENO(probe_b)) {
+        return PROBE_LINENO(probe_a) < PROBE_LINENO(probe_b) ? -1 : 1;
+    }
+    return probe_a < probe_b ? -1 : (probe_a > probe_b ? 1 : 0);
+}
+
+static void swap_pending_probes(void *a, void *b)
+{
+    stackdriver_debugger_pending_probe_t *tmp = *(stackdriver_debugger_pending_probe_t **)a;
+
+    *(stackdriver_debugger_pending_probe_t **)a = *(stackdriver_debugger_pending_probe_t **)b;
+    *(stackdriver_debugger_pending_probe_t **)b = tmp;
+}
+
+/**
+ * Inject all breakpoints of the compiled file in a single walk of its AST and
+ * record each breakpoint as injected or failed.
+ */
+static void inject_breakpoints(zend_ast *ast, stackdriver_debugger_compiled_file_t *file)
+{
+    HashTable index;
+    stackdriver_debugger_pending_probe_t **sorted;
+    stackdriver_debugger_pending_probe_t *probe;
+    uint32_t i;
+
+    reset_registered_breakpoints_for_filename(file->filename);
+    reset_failed_breakpoints_for_filename(file->filename);
+
+    /* Index the file once so the walk only visits statements */
+    zend_hash_init(&index, 256, NULL, NULL, 0);
+    index_statement_lists(ast, &index);
+
+    sorted = safe_emalloc(file->num_probes, sizeof(stackdriver_debugger_pending_probe_t *), 0);
+    for (i = 0; i < file->num_probes; i++) {
+        sorted[i] = &file->probes[i];
+    }
+    zend_sort(sorted, file->num_probes, sizeof(stackdriver_debugger_pending_probe_t *),
+        compare_pending_probes, swap_pending_probes);
+
+    inject_probes(ast, sorted, file->num_probes, &index);
+
+    for (i = 0; i < file->num_probes; i++) {
+        probe = &file->probes[i];
+        if (probe->injected) {
+            register_breakpoint_id(file->filename, probe->breakpoint_id);
+        } else {
+            register_failed_breakpoint_id(file->filename, probe->breakpoint_id, FAILED_NO_STATEMENT);
+        }
+    }
+
+    efree(sorted);
+    zend_hash_destroy(&index);
+}
+
 /**
  * This function replaces the original `zend_ast_process` function. If one was
  * previously provided, call that one after this one.
@@ -292,30 +677,17 @@ void stackdriver_debugger_ast_process(zend_ast *ast)
     HashTable *ht;
     stackdriver_debugger_snapshot_t *snapshot;
     stackdriver_debugger_logpoint_t *logpoint;
-    zend_ast_list *to_insert;
     zend_string *filename = zend_get_compiled_filename();
+    stackdriver_debugger_compiled_file_t file = {filename, NULL, 0, 0};
 
     zval *snapshots = zend_hash_find(STACKDRIVER_DEBUGGER_G(snapshots_by_file), filename);
     zval *logpoints = zend_hash_find(STACKDRIVER_DEBUGGER_G(logpoints_by_file), filename);
 
-    if (snapshots != NULL || logpoints != NULL) {
-        reset_registered_breakpoints_for_filename(filename);
-    }
-
     if (snapshots != NULL) {
         ht = Z_ARR_P(snapshots);
 
         ZEND_HASH_FOREACH_PTR(ht, snapshot) {
-            to_insert = create_debugger_ast(
-                "stackdriver_debugger_snapshot",
-                snapshot->id,
-                snapshot->lineno
-            );
-            if (inject_ast(ast, to_insert) == SUCCESS) {
-                register_breakpoint_id(filename, snapshot->id);
-            } else {
-                // failed to insert
-            }
+            add_breakpoint(&file, STACKDRIVER_DEBUGGER_PROBE_SNAPSHOT, snapshot->id, snapshot->lineno);
         } ZEND_HASH_FOREACH_END();
     }
 
@@ -323,19 +695,18 @@ void stackdriver_debugger_ast_process(zend_ast *ast)
         ht = Z_ARR_P(logpoints);
 
         ZEND_HASH_FOREACH_PTR(ht, logpoint) {
-            to_insert = create_debugger_ast(
-                "stackdriver_debugger_logpoint",
-                logpoint->id,
-                logpoint->lineno
-            );
-            if (inject_ast(ast, to_insert) == SUCCESS) {
-                register_breakpoint_id(filename, logpoint->id);
-            } else {
-                // failed to insert
-            }
+            add_breakpoint(&file, STACKDRIVER_DEBUGGER_PROBE_LOGPOINT, logpoint->id, logpoint->lineno);
         } ZEND_HASH_FOREACH_END();
     }
 
+    /* registry breakpoints not overridden by this request */
+    stackdriver_debugger_registry_apply(filename, add_registry_breakpoint, &file);
+
+    if (file.num_probes > 0) {
+        inject_breakpoints(ast, &file);
+        efree(file.probes);
+    }
+
     /* call the original zend_ast_process function if one was set */
     if (original_zend_ast_process) {
         original_zend_ast_process(ast);
@@ -526,32 +897,119 @@ static int valid_debugger_ast(zend_ast *ast)
  * that the statement will compile and contains only valid operations.
  */
 int valid_debugger_statement(zend_string *statement)
+{
+    return valid_debugger_statement_ex(statement, NULL, NULL, 0);
+}
+
+/**
+ * Find the cached verdict for the provided statement. Returns NULL if the
+ * statement has not been validated against the current whitelist.
+ */
+static zval *find_statement_verdict(zend_string *statement)
+{
+    if (STACKDRIVER_DEBUGGER_G(whitelist_verdicts) == NULL) {
+        return NULL;
+    }
+    return zend_hash_find(STACKDRIVER_DEBUGGER_G(whitelist_verdicts), statement);
+}
+
+/**
+ * Remember the verdict for the provided statement so that subsequent requests
+ * with the same function whitelist do not need to parse it again.
+ */
+static void store_statement_verdict(zend_string *statement, int result)
+{
+    HashTable *verdicts = STACKDRIVER_DEBUGGER_G(whitelist_verdicts);
+    zval verdict;
+
+    if (verdicts == NULL) {
+        return;
+    }
+    if (zend_hash_num_elements(verdicts) >= STATEMENT_VERDICTS_MAX_SIZE &&
+        !zend_hash_exists(verdicts, statement)) {
+        zend_hash_clean(verdicts);
+    }
+
+    /*
+     * The table is persistent and the statement may be a request string, so
+     * let the table create its own persistent key.
+     */
+    ZVAL_LONG(&verdict, result);
+    zend_hash_str_update(verdicts, ZSTR_VAL(statement), ZSTR_LEN(statement), &verdict);
+}
+
+/**
+ * Convert a statement verdict into SUCCESS | FAILURE, emitting the matching
+ * warning unless silenced.
+ */
+static int report_statement_verdict(int verdict, zend_bool silent)
+{
+    switch (verdict) {
+        case STATEMENT_VALID:
+            return SUCCESS;
+        case STATEMENT_COMPILE_ERROR:
+            if (!silent) {
+                php_error_docref(NULL, E_WARNING, "Unable to compile condition.");
+            }
+            return FAILURE;
+        default:
+            if (!silent) {
+                php_error_docref(NULL, E_WARNING, "Condition contains invalid operations");
+            }
+            return FAILURE;
+    }
+}
+
+/**
+ * Validate the provided statement. If the statement is valid and a callback is
+ * provided, the callback is invoked with the parsed AST before it is
+ * destroyed. The AST must not be retained by the callback. If `silent` is set,
+ * no warnings are emitted for invalid statements.
+ *
+ * Verdicts are cached per thread and keyed by the function whitelist, so
+ * without a callback each statement is only parsed once per worker and
+ * whitelist.
+ */
+int valid_debugger_statement_ex(zend_string *statement, stackdriver_debugger_ast_callback callback, void *data, zend_bool silent)
 {
     zend_lex_state original_lex_state;
     zend_ast *ast_p, *old_ast = CG(ast);
     zend_arena *old_arena = CG(ast_arena);
+    zval *verdict;
+    zend_string *extended_statement;
+
+    if (callback == NULL) {
+        verdict = find_statement_verdict(statement);
+        if (verdict != NULL) {
+            return report_statement_verdict(Z_LVAL_P(verdict), silent);
+        }
+    }
 
     /*
      * Append ';' to the end for lexing/parsing. Evaluating the statement
      * doesn't require a ';' at the end of the statement and could actually
      * change the semantics of the return value;
      */
-    zend_string *extended_statement = strpprintf(ZSTR_LEN(statement) + 1, "%s%c", ZSTR_VAL(statement), ';');
+    extended_statement = strpprintf(ZSTR_LEN(statement) + 1, "%s%c", ZSTR_VAL(statement), ';');
     if (compile_ast(extended_statement, &ast_p, &original_lex_state) != SUCCESS) {
         zend_string_release(extended_statement);
-        php_error_docref(NULL, E_WARNING, "Unable to compile condition.");
-        return FAILURE;
+        store_statement_verdict(statement, STATEMENT_COMPILE_ERROR);
+        return report_statement_verdict(STATEMENT_COMPILE_ERROR, silent);
     }
     zend_string_release(extended_statement);
 
     if (valid_debugger_ast(ast_p) != SUCCESS) {
-        php_error_docref(NULL, E_WARNING, "Condition contains invalid operations");
         zend_ast_destroy(CG(ast));
         zend_arena_destroy(CG(ast_arena));
         zend_restore_lexical_state(&original_lex_state);
         CG(ast) = NULL;
         CG(ast_arena) = NULL;
-        return FAILURE;
+        store_statement_verdict(statement, STATEMENT_INVALID_OPERATIONS);
+        return report_statement_verdict(STATEMENT_INVALID_OPERATIONS, silent);
+    }
+
+    if (callback != NULL) {
+        callback(ast_p, data);
     }
 
     zend_ast_destroy(CG(ast));
@@ -560,14 +1018,38 @@ int valid_debugger_statement(zend_string *statement)
     CG(ast) = old_ast;
     CG(ast_arena) = old_arena;
 
+    store_statement_verdict(statement, STATEMENT_VALID);
     return SUCCESS;
 }
 
+/**
+ * Select the cached statement verdicts for the provided user function
+ * whitelist. Verdicts are keyed by the whitelist's contents, so switching
+ * between whitelists keeps the verdicts of each.
+ */
+static void select_statement_verdicts(const char *str, int len)
+{
+    HashTable *verdicts = zend_hash_str_find_ptr(STACKDRIVER_DEBUGGER_G(statement_verdicts), str, len);
+
+    if (verdicts == NULL) {
+        if (zend_hash_num_elements(STACKDRIVER_DEBUGGER_G(statement_verdicts)) >= STATEMENT_VERDICTS_MAX_WHITELISTS) {
+            zend_hash_clean(STACKDRIVER_DEBUGGER_G(statement_verdicts));
+        }
+
+        verdicts = pemalloc(sizeof(HashTable), 1);
+        zend_hash_init(verdicts, 64, NULL, NULL, 1);
+        zend_hash_str_add_ptr(STACKDRIVER_DEBUGGER_G(statement_verdicts), str, len, verdicts);
+    }
+    STACKDRIVER_DEBUGGER_G(whitelist_verdicts) = verdicts;
+}
+
 static void register_user_whitelisted_functions_str(const char *str, int len)
 {
     char *key = NULL, *last = NULL;
     char *tmp = estrndup(str, len);
 
+    select_statement_verdicts(str, len);
+
     for (key = php_strtok_r(tmp, ",", &last); key; key = php_strtok_r(NULL, ",", &last)) {
         zend_hash_str_add_empty_element(STACKDRIVER_DEBUGGER_G(user_whitelisted_functions), key, strlen(key));
     }
@@ -843,6 +1325,8 @@ int stackdriver_debugger_ast_rinit(TSRMLS_D)
     char *ini = INI_STR(PHP_STACKDRIVER_DEBUGGER_INI_WHITELISTED_FUNCTIONS);
     if (ini) {
         register_user_whitelisted_functions_str(ini, strlen(ini));
+    } else {
+        select_statement_verdicts("", 0);
     }
 
     ALLOC_HASHTABLE(STACKDRIVER_DEBUGGER_G(ast_to_clean));
@@ -881,6 +1365,51 @@ static void breakpoints_dtor(zval *zv)
     ZVAL_PTR_DTOR(zv);
 }
 
+/**
+ * Callback for destroying the verdicts of each whitelist stored in the
+ * statement_verdicts global.
+ */
+static void statement_verdicts_dtor(zval *zv)
+{
+    HashTable *ht = Z_PTR_P(zv);
+    zend_hash_destroy(ht);
+    pefree(ht, 1);
+}
+
+/**
+ * Allocate the statement verdict cache and the failed breakpoints of a
+ * thread's globals. Both are kept between requests and never shared between
+ * threads.
+ */
+void stackdriver_debugger_ast_globals_ctor(zend_stackdriver_debugger_globals *globals)
+{
+    globals->statement_verdicts = pemalloc(sizeof(HashTable), 1);
+    zend_hash_init(globals->statement_verdicts, 8, NULL, statement_verdicts_dtor, 1);
+    globals->whitelist_verdicts = NULL;
+
+    globals->failed_breakpoints = pemalloc(sizeof(HashTable), 1);
+    zend_hash_init(globals->failed_breakpoints, 16, NULL, breakpoints_dtor, 1);
+}
+
+/**
+ * Free the statement verdict cache and the failed breakpoints of a thread's
+ * globals, if not already freed.
+ */
+void stackdriver_debugger_ast_globals_dtor(zend_stackdriver_debugger_globals *globals)
+{
+    if (globals->statement_verdicts == NULL) {
+        return;
+    }
+    zend_hash_destroy(globals->statement_verdicts);
+    pefree(globals->statement_verdicts, 1);
+    globals->statement_verdicts = NULL;
+    globals->whitelist_verdicts = NULL;
+
+    zend_hash_destroy(globals->failed_breakpoints);
+    pefree(globals->failed_breakpoints, 1);
+    globals->failed_breakpoints = NULL;
+}
+
 /**
  * Module initialization lifecycle hook. Registers our AST processor so we can
  * modify the AST after compilation.
@@ -912,6 +1441,9 @@ int stackdriver_debugger_ast_mshutdown(SHUTDOWN_FUNC_ARGS)
     zend_ast_process = original_zend_ast_process;
     zend_hash_destroy(&global_whitelisted_functions);
     zend_hash_destroy(&registered_breakpoints);
+#ifndef ZTS
+    stackdriver_debugger_ast_globals_dtor(&stackdriver_debugger_globals);
+#endif
 
     return SUCCESS;
 }
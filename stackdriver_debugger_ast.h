@@ -18,15 +18,24 @@
 #define PHP_STACKDRIVER_DEBUGGER_AST_H 1
 
 #include "php.h"
+#include "php_stackdriver_debugger.h"
+
+/* Callback invoked with the AST of a statement that passed validation */
+typedef void (*stackdriver_debugger_ast_callback)(zend_ast *ast, void *data);
 
 int valid_debugger_statement(zend_string *statement);
+int valid_debugger_statement_ex(zend_string *statement, stackdriver_debugger_ast_callback callback, void *data, zend_bool silent);
 void stackdriver_debugger_ast_process(zend_ast *ast);
+void stackdriver_debugger_ast_globals_ctor(zend_stackdriver_debugger_globals *globals);
+void stackdriver_debugger_ast_globals_dtor(zend_stackdriver_debugger_globals *globals);
 int stackdriver_debugger_ast_minit(INIT_FUNC_ARGS);
 int stackdriver_debugger_ast_mshutdown(SHUTDOWN_FUNC_ARGS);
 int stackdriver_debugger_ast_rinit(TSRMLS_D);
 int stackdriver_debugger_ast_rshutdown(TSRMLS_D);
 void stackdriver_list_breakpoint_ids(zval *return_value);
 int stackdriver_debugger_breakpoint_injected(zend_string *filename, zend_string *breakpoint_id);
+int stackdriver_debugger_breakpoint_failed(zend_string *filename, zend_string *breakpoint_id);
+void stackdriver_debugger_list_failed_breakpoints(zval *return_value);
 
 PHP_INI_MH(OnUpdate_stackdriver_debugger_whitelisted_functions);
 
@@ -0,0 +1,199 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "php.h"
+#include "php_stackdriver_debugger.h"
+#include "stackdriver_debugger_batch.h"
+#include "stackdriver_debugger_logpoint.h"
+#include "stackdriver_debugger_snapshot.h"
+#include "zend_exceptions.h"
+#include "ext/standard/basic_functions.h"
+
+#ifndef ZTS
+typedef void (*stackdriver_debugger_handler_t)(INTERNAL_FUNCTION_PARAMETERS);
+
+/* fastcgi_finish_request() and its original handler, if wrapped */
+static zend_internal_function *fastcgi_finish_request_function = NULL;
+static stackdriver_debugger_handler_t original_fastcgi_finish_request = NULL;
+
+/**
+ * Replacement handler for fastcgi_finish_request(). Once the response has
+ * been sent to the client, deliver everything collected so far.
+ */
+static void stackdriver_debugger_fastcgi_finish_request(INTERNAL_FUNCTION_PARAMETERS)
+{
+    original_fastcgi_finish_request(INTERNAL_FUNCTION_PARAM_PASSTHRU);
+    stackdriver_debugger_deliver_batch();
+}
+
+/**
+ * Wrap fastcgi_finish_request() if the SAPI provides it. SAPI functions are
+ * registered after module startup, so this is done on the first request.
+ *
+ * Thread safe builds give each thread its own copy of the function table,
+ * which a process wide wrap could neither cover nor safely restore, so they
+ * rely on the shutdown function alone.
+ */
+static void wrap_fastcgi_finish_request()
+{
+    zend_function *func;
+
+    if (fastcgi_finish_request_function != NULL) {
+        return;
+    }
+
+    func = zend_hash_str_find_ptr(CG(function_table), "fastcgi_finish_request", strlen("fastcgi_finish_request"));
+    if (func == NULL || func->type != ZEND_INTERNAL_FUNCTION) {
+        return;
+    }
+
+    fastcgi_finish_request_function = &func->internal_function;
+    original_fastcgi_finish_request = fastcgi_finish_request_function->handler;
+    fastcgi_finish_request_function->handler = stackdriver_debugger_fastcgi_finish_request;
+}
+#endif
+
+/**
+ * Register stackdriver_debugger_deliver_batch() as a shutdown function. It
+ * then runs with the other shutdown functions, before objects are destructed
+ * and from a function frame so exceptions thrown by the callback can be
+ * caught. Registering it again replaces the earlier registration.
+ */
+static void register_batch_shutdown_function()
+{
+    php_shutdown_function_entry entry;
+
+    entry.arg_count = 1;
+    entry.arguments = (zval *)safe_emalloc(sizeof(zval), 1, 0);
+    ZVAL_STRING(&entry.arguments[0], "stackdriver_debugger_deliver_batch");
+
+    if (!register_user_shutdown_function(Z_STRVAL(entry.arguments[0]), Z_STRLEN(entry.arguments[0]), &entry)) {
+        zval_ptr_dtor(&entry.arguments[0]);
+        efree(entry.arguments);
+    }
+}
+
+/**
+ * Set the callable which receives all collected snapshots and logpoint
+ * messages once the request is over. Replaces any previous batch callback.
+ */
+int stackdriver_debugger_set_batch_callback(zval *callback)
+{
+    zval resolved;
+    zend_fcall_info fci;
+    zend_fcall_info_cache fcc;
+
+    if (stackdriver_debugger_resolve_callback(callback, "batch", &resolved, &fci, &fcc) != SUCCESS) {
+        return FAILURE;
+    }
+
+    zval_ptr_dtor(&STACKDRIVER_DEBUGGER_G(batch_callback));
+    ZVAL_COPY_VALUE(&STACKDRIVER_DEBUGGER_G(batch_callback), &resolved);
+    STACKDRIVER_DEBUGGER_G(batch_fci) = fci;
+    STACKDRIVER_DEBUGGER_G(batch_fcc) = fcc;
+    register_batch_shutdown_function();
+
+    return SUCCESS;
+}
+
+/**
+ * Call the batch callback with the snapshots and logpoint messages collected
+ * since the last delivery, then forget them. Does nothing if no batch
+ * callback is set or nothing was collected.
+ */
+void stackdriver_debugger_deliver_batch()
+{
+    zval args[2], callback_result;
+    zend_fcall_info fci;
+
+    if (Z_TYPE(STACKDRIVER_DEBUGGER_G(batch_callback)) == IS_UNDEF) {
+        return;
+    }
+
+    if (zend_hash_num_elements(STACKDRIVER_DEBUGGER_G(collected_snapshots_by_id)) == 0 &&
+        zend_hash_num_elements(STACKDRIVER_DEBUGGER_G(collected_messages)) == 0) {
+        return;
+    }
+
+    array_init(&args[0]);
+    list_snapshots(&args[0]);
+    array_init(&args[1]);
+    list_logpoints(&args[1]);
+
+    /* items are only delivered once, even if the callback fails */
+    zend_hash_clean(STACKDRIVER_DEBUGGER_G(collected_snapshots_by_id));
+    zend_hash_clean(STACKDRIVER_DEBUGGER_G(collected_messages));
+
+    fci = STACKDRIVER_DEBUGGER_G(batch_fci);
+    ZVAL_UNDEF(&callback_result);
+    fci.retval = &callback_result;
+    fci.params = args;
+    fci.param_count = 2;
+
+    if (zend_call_function(&fci, &STACKDRIVER_DEBUGGER_G(batch_fcc)) != SUCCESS) {
+        php_error_docref(NULL, E_WARNING, "Error running batch callback.");
+    }
+    if (EG(exception) != NULL) {
+        zend_clear_exception();
+        php_error_docref(NULL, E_WARNING, "Error running batch callback.");
+    }
+
+    zval_ptr_dtor(&args[0]);
+    zval_ptr_dtor(&args[1]);
+    zval_ptr_dtor(&callback_result);
+}
+
+/**
+ * Module shutdown lifecycle hook. Restores fastcgi_finish_request() if it
+ * was wrapped.
+ */
+int stackdriver_debugger_batch_mshutdown(SHUTDOWN_FUNC_ARGS)
+{
+#ifndef ZTS
+    if (fastcgi_finish_request_function != NULL) {
+        fastcgi_finish_request_function->handler = original_fastcgi_finish_request;
+        fastcgi_finish_request_function = NULL;
+    }
+#endif
+
+    return SUCCESS;
+}
+
+/**
+ * Request initialization lifecycle hook. Initializes request global variables.
+ */
+int stackdriver_debugger_batch_rinit(TSRMLS_D)
+{
+    ZVAL_UNDEF(&STACKDRIVER_DEBUGGER_G(batch_callback));
+#ifndef ZTS
+    wrap_fastcgi_finish_request();
+#endif
+
+    return SUCCESS;
+}
+
+/**
+ * Request shutdown lifecycle hook. Destroys request global variables.
+ * Collected breakpoints are delivered earlier by the shutdown function.
+ */
+int stackdriver_debugger_batch_rshutdown(TSRMLS_D)
+{
+    zval_ptr_dtor(&STACKDRIVER_DEBUGGER_G(batch_callback));
+    ZVAL_UNDEF(&STACKDRIVER_DEBUGGER_G(batch_callback));
+
+    return SUCCESS;
+}
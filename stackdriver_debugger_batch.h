@@ -0,0 +1,31 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef PHP_STACKDRIVER_DEBUGGER_BATCH_H
+#define PHP_STACKDRIVER_DEBUGGER_BATCH_H 1
+
+#include "php.h"
+
+int stackdriver_debugger_set_batch_callback(zval *callback);
+void stackdriver_debugger_deliver_batch();
+
+/* lifecycle callbacks */
+int stackdriver_debugger_batch_mshutdown(SHUTDOWN_FUNC_ARGS);
+int stackdriver_debugger_batch_rinit(TSRMLS_D);
+int stackdriver_debugger_batch_rshutdown(TSRMLS_D);
+
+#endif /* PHP_STACKDRIVER_DEBUGGER_BATCH_H */
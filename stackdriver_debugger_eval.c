@@ -0,0 +1,877 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "php.h"
+#include "php_stackdriver_debugger.h"
+#include "stackdriver_debugger_ast.h"
+#include "stackdriver_debugger_eval.h"
+#include "zend_compile.h"
+#include "zend_execute.h"
+#include "zend_object_handlers.h"
+
+/* Initialize an empty, allocated native expression node */
+static stackdriver_debugger_native_expr_t *create_native_expr(zend_ast_kind kind, zend_ast_attr attr)
+{
+    stackdriver_debugger_native_expr_t *expr = emalloc(sizeof(stackdriver_debugger_native_expr_t));
+    expr->kind = kind;
+    expr->attr = attr;
+    ZVAL_UNDEF(&expr->value);
+    expr->cv_slot.op_array = NULL;
+    expr->child[0] = NULL;
+    expr->child[1] = NULL;
+    return expr;
+}
+
+/* Cleanup an allocated native expression tree including freeing memory */
+static void destroy_native_expr(stackdriver_debugger_native_expr_t *expr)
+{
+    if (expr == NULL) {
+        return;
+    }
+
+    destroy_native_expr(expr->child[0]);
+    destroy_native_expr(expr->child[1]);
+    zval_ptr_dtor(&expr->value);
+    efree(expr);
+}
+
+static stackdriver_debugger_native_expr_t *build_native_expr(zend_ast *ast);
+
+/**
+ * Build the first `num_children` children of a native expression node. Returns
+ * SUCCESS if all of the children are natively supported.
+ */
+static int build_native_children(stackdriver_debugger_native_expr_t *expr, zend_ast *ast, int num_children)
+{
+    int i;
+
+    for (i = 0; i < num_children; i++) {
+        expr->child[i] = build_native_expr(ast->child[i]);
+        if (expr->child[i] == NULL) {
+            return FAILURE;
+        }
+    }
+    return SUCCESS;
+}
+
+/**
+ * Returns whether the provided AST node is a literal string. Used for variable
+ * and property names which may otherwise be arbitrary expressions.
+ */
+static int is_literal_string_ast(zend_ast *ast)
+{
+    return ast != NULL &&
+        ast->kind == ZEND_AST_ZVAL &&
+        Z_TYPE_P(zend_ast_get_zval(ast)) == IS_STRING;
+}
+
+/**
+ * Translate a validated AST into a native expression tree. Returns NULL if the
+ * AST contains any node kind that we do not handle natively.
+ */
+static stackdriver_debugger_native_expr_t *build_native_expr(zend_ast *ast)
+{
+    stackdriver_debugger_native_expr_t *expr;
+    zend_string *name;
+    zval *zv;
+
+    if (ast == NULL) {
+        return NULL;
+    }
+
+    switch (ast->kind) {
+        case ZEND_AST_ZVAL:
+            zv = zend_ast_get_zval(ast);
+            if (Z_TYPE_P(zv) > IS_STRING) {
+                return NULL;
+            }
+            expr = create_native_expr(ZEND_AST_ZVAL, 0);
+            ZVAL_COPY(&expr->value, zv);
+            return expr;
+
+        case ZEND_AST_CONST:
+            if (!is_literal_string_ast(ast->child[0])) {
+                return NULL;
+            }
+            name = zend_ast_get_str(ast->child[0]);
+            expr = create_native_expr(ZEND_AST_ZVAL, 0);
+            if (zend_string_equals_literal_ci(name, "true")) {
+                ZVAL_TRUE(&expr->value);
+            } else if (zend_string_equals_literal_ci(name, "false")) {
+                ZVAL_FALSE(&expr->value);
+            } else if (zend_string_equals_literal_ci(name, "null")) {
+                ZVAL_NULL(&expr->value);
+            } else {
+                destroy_native_expr(expr);
+                return NULL;
+            }
+            return expr;
+
+        case ZEND_AST_VAR:
+            if (!is_literal_string_ast(ast->child[0])) {
+                return NULL;
+            }
+            name = zend_ast_get_str(ast->child[0]);
+            if (zend_string_equals_literal(name, "this")) {
+                return NULL;
+            }
+            expr = create_native_expr(ZEND_AST_VAR, 0);
+            ZVAL_STR_COPY(&expr->value, name);
+            return expr;
+
+        case ZEND_AST_PROP:
+            if (!is_literal_string_ast(ast->child[1])) {
+                return NULL;
+            }
+            expr = create_native_expr(ZEND_AST_PROP, 0);
+            ZVAL_STR_COPY(&expr->value, zend_ast_get_str(ast->child[1]));
+            if (build_native_children(expr, ast, 1) != SUCCESS) {
+                destroy_native_expr(expr);
+                return NULL;
+            }
+            return expr;
+
+        case ZEND_AST_ISSET:
+        case ZEND_AST_EMPTY:
+            switch (ast->child[0]->kind) {
+                case ZEND_AST_VAR:
+                case ZEND_AST_DIM:
+                case ZEND_AST_PROP:
+                    break;
+                default:
+                    return NULL;
+            }
+            expr = create_native_expr(ast->kind, 0);
+            if (build_native_children(expr, ast, 1) != SUCCESS) {
+                destroy_native_expr(expr);
+                return NULL;
+            }
+            return expr;
+
+        case ZEND_AST_UNARY_OP:
+            if (ast->attr != ZEND_BOOL_NOT) {
+                return NULL;
+            }
+            expr = create_native_expr(ZEND_AST_UNARY_OP, ast->attr);
+            if (build_native_children(expr, ast, 1) != SUCCESS) {
+                destroy_native_expr(expr);
+                return NULL;
+            }
+            return expr;
+
+        case ZEND_AST_BINARY_OP:
+            switch (ast->attr) {
+                case ZEND_IS_EQUAL:
+                case ZEND_IS_NOT_EQUAL:
+                case ZEND_IS_IDENTICAL:
+                case ZEND_IS_NOT_IDENTICAL:
+                case ZEND_IS_SMALLER:
+                case ZEND_IS_SMALLER_OR_EQUAL:
+                case ZEND_ADD:
+                case ZEND_SUB:
+                case ZEND_MUL:
+                    break;
+                default:
+                    return NULL;
+            }
+            /* fall through */
+        case ZEND_AST_DIM:
+        case ZEND_AST_GREATER:
+        case ZEND_AST_GREATER_EQUAL:
+        case ZEND_AST_AND:
+        case ZEND_AST_OR:
+            expr = create_native_expr(ast->kind, ast->attr);
+            if (build_native_children(expr, ast, 2) != SUCCESS) {
+                destroy_native_expr(expr);
+                return NULL;
+            }
+            return expr;
+    }
+
+    return NULL;
+}
+
+/**
+ * Returns whether the provided call AST calls a function which reads the
+ * calling scope implicitly, rather than through variables it names.
+ */
+static int is_scope_reading_call(zend_ast *ast)
+{
+    zend_string *name;
+    const char *function_name;
+    size_t len;
+
+    if (!is_literal_string_ast(ast->child[0])) {
+        return 0;
+    }
+
+    name = zend_ast_get_str(ast->child[0]);
+    function_name = ZSTR_VAL(name);
+    len = ZSTR_LEN(name);
+    if (len > 0 && function_name[0] == '\\') {
+        function_name++;
+        len--;
+    }
+
+#define SCOPE_READING_FUNCTION(f) (len == sizeof(f) - 1 && zend_binary_strcasecmp(function_name, len, f, sizeof(f) - 1) == 0)
+    return SCOPE_READING_FUNCTION("compact") ||
+        SCOPE_READING_FUNCTION("extract") ||
+        SCOPE_READING_FUNCTION("get_defined_vars") ||
+        SCOPE_READING_FUNCTION("func_get_arg") ||
+        SCOPE_READING_FUNCTION("func_get_args") ||
+        SCOPE_READING_FUNCTION("func_num_args");
+#undef SCOPE_READING_FUNCTION
+}
+
+/**
+ * Collect the names of all variables referenced by the provided AST. Returns
+ * FAILURE if a referenced variable cannot be determined statically, including
+ * calls to functions which read the calling scope.
+ */
+static int collect_variables(zend_ast *ast, HashTable *variables)
+{
+    int i, num_children;
+    zend_ast_list *list;
+    zend_string *name;
+
+    if (ast == NULL) {
+        return SUCCESS;
+    }
+
+    if (ast->kind >> ZEND_AST_IS_LIST_SHIFT == 1) {
+        list = zend_ast_get_list(ast);
+        for (i = 0; i < list->children; i++) {
+            if (collect_variables(list->child[i], variables) != SUCCESS) {
+                return FAILURE;
+            }
+        }
+        return SUCCESS;
+    }
+
+    switch (ast->kind) {
+        case ZEND_AST_ZVAL:
+        case ZEND_AST_ZNODE:
+            return SUCCESS;
+        case ZEND_AST_VAR:
+            if (!is_literal_string_ast(ast->child[0])) {
+                return FAILURE;
+            }
+            name = zend_ast_get_str(ast->child[0]);
+            if (zend_string_equals_literal(name, "this")) {
+                return FAILURE;
+            }
+            zend_hash_add_empty_element(variables, name);
+            return SUCCESS;
+        case ZEND_AST_CALL:
+            if (is_scope_reading_call(ast)) {
+                return FAILURE;
+            }
+            break;
+    }
+
+    /* declarations (closures) may capture variables implicitly */
+    if (ast->kind >> ZEND_AST_SPECIAL_SHIFT == 1) {
+        return FAILURE;
+    }
+
+    num_children = zend_ast_get_num_children(ast);
+    for (i = 0; i < num_children; i++) {
+        if (collect_variables(ast->child[i], variables) != SUCCESS) {
+            return FAILURE;
+        }
+    }
+    return SUCCESS;
+}
+
+/**
+ * Callback for valid_debugger_statement_ex. Records the variables referenced
+ * by the statement and builds the native fast path. The statement AST is a
+ * statement list which we only handle natively if it contains a single
+ * expression.
+ */
+static void analyze_statement(zend_ast *ast, void *data)
+{
+    stackdriver_debugger_compiled_statement_t *compiled = (stackdriver_debugger_compiled_statement_t *)data;
+    zend_ast_list *list;
+    zend_ast *expression = NULL;
+    int i;
+
+    if (ast == NULL || ast->kind != ZEND_AST_STMT_LIST) {
+        return;
+    }
+
+    ALLOC_HASHTABLE(compiled->variables);
+    zend_hash_init(compiled->variables, 8, NULL, NULL, 0);
+    if (collect_variables(ast, compiled->variables) != SUCCESS) {
+        zend_hash_destroy(compiled->variables);
+        FREE_HASHTABLE(compiled->variables);
+        compiled->variables = NULL;
+    } else if (zend_hash_num_elements(compiled->variables) > 0) {
+        compiled->variable_slots = ecalloc(zend_hash_num_elements(compiled->variables), sizeof(stackdriver_debugger_cv_slot_t));
+    }
+
+    list = zend_ast_get_list(ast);
+    for (i = 0; i < list->children; i++) {
+        if (list->child[i] == NULL) {
+            continue;
+        }
+        if (expression != NULL) {
+            return;
+        }
+        expression = list->child[i];
+    }
+
+    compiled->native = build_native_expr(expression);
+}
+
+/**
+ * Find the closest executing user code frame. This is the frame whose
+ * variables a statement is evaluated against.
+ */
+static zend_execute_data *find_user_frame()
+{
+    zend_execute_data *ex = EG(current_execute_data);
+
+    while (ex && (!ex->func || !ZEND_USER_CODE(ex->func->type))) {
+        ex = ex->prev_execute_data;
+    }
+    return ex;
+}
+
+/**
+ * Find the named variable in the provided frame. Compiled variables are read
+ * directly from their slot, which is only searched for once per op_array and
+ * then remembered in `cv_slot`. Returns NULL if the variable does not exist.
+ */
+static zval *find_frame_variable(zend_execute_data *frame, zend_string *name, stackdriver_debugger_cv_slot_t *cv_slot)
+{
+    zend_op_array *op_array = &frame->func->op_array;
+    zval *zv;
+    int i;
+
+    /* the op_array may have been freed and its memory reused, so check the name */
+    if (cv_slot->op_array == op_array && cv_slot->slot < op_array->last_var &&
+        (op_array->vars[cv_slot->slot] == name || zend_string_equals(op_array->vars[cv_slot->slot], name))) {
+        return ZEND_CALL_VAR_NUM(frame, cv_slot->slot);
+    }
+
+    for (i = 0; i < op_array->last_var; i++) {
+        if (op_array->vars[i] == name || zend_string_equals(op_array->vars[i], name)) {
+            cv_slot->op_array = op_array;
+            cv_slot->slot = i;
+            return ZEND_CALL_VAR_NUM(frame, i);
+        }
+    }
+
+#if PHP_VERSION_ID < 70100
+    if (frame->symbol_table) {
+#else
+    if (ZEND_CALL_INFO(frame) & ZEND_CALL_HAS_SYMBOL_TABLE) {
+#endif
+        zv = zend_hash_find(frame->symbol_table, name);
+        if (zv != NULL && Z_TYPE_P(zv) == IS_INDIRECT) {
+            zv = Z_INDIRECT_P(zv);
+        }
+        return zv;
+    }
+
+    return NULL;
+}
+
+/**
+ * Copy a fetched value into `result`, or NULL if the value does not exist. A
+ * missing value is only acceptable in silent (isset/empty) mode as otherwise
+ * PHP would raise a notice which we leave to the full evaluation path.
+ */
+static int native_fetch_result(zval *zv, zval *result, zend_bool silent)
+{
+    if (zv == NULL || Z_TYPE_P(zv) == IS_UNDEF) {
+        if (!silent) {
+            return FAILURE;
+        }
+        ZVAL_NULL(result);
+        return SUCCESS;
+    }
+
+    ZVAL_DEREF(zv);
+    ZVAL_COPY(result, zv);
+    return SUCCESS;
+}
+
+static int native_evaluate(stackdriver_debugger_native_expr_t *expr, zend_execute_data *frame, zval *result, zend_bool silent);
+
+/* Natively read a public property from an object without magic methods */
+static int native_evaluate_prop(stackdriver_debugger_native_expr_t *expr, zend_execute_data *frame, zval *result, zend_bool silent)
+{
+    zval container, rv, *zv;
+    int ret;
+
+    if (native_evaluate(expr->child[0], frame, &container, silent) != SUCCESS) {
+        return FAILURE;
+    }
+
+    if (Z_TYPE(container) != IS_OBJECT) {
+        ret = FAILURE;
+        if (silent && Z_TYPE(container) == IS_NULL) {
+            ZVAL_NULL(result);
+            ret = SUCCESS;
+        }
+        zval_ptr_dtor(&container);
+        return ret;
+    }
+
+    /* Magic methods and custom handlers could run user code */
+    if (Z_OBJ_HT(container) != &std_object_handlers ||
+        Z_OBJCE(container)->__get != NULL ||
+        Z_OBJCE(container)->__isset != NULL) {
+        zval_ptr_dtor(&container);
+        return FAILURE;
+    }
+
+    ZVAL_UNDEF(&rv);
+    zv = Z_OBJ_HT(container)->read_property(&container, &expr->value, BP_VAR_IS, NULL, &rv);
+    if (zv == &EG(uninitialized_zval)) {
+        zv = NULL;
+    }
+    ret = native_fetch_result(zv, result, silent);
+    zval_ptr_dtor(&rv);
+    zval_ptr_dtor(&container);
+    return ret;
+}
+
+/* Natively read an array offset */
+static int native_evaluate_dim(stackdriver_debugger_native_expr_t *expr, zend_execute_data *frame, zval *result, zend_bool silent)
+{
+    zval container, dim, *zv = NULL;
+    int ret = FAILURE;
+
+    if (native_evaluate(expr->child[0], frame, &container, silent) != SUCCESS) {
+        return FAILURE;
+    }
+    if (native_evaluate(expr->child[1], frame, &dim, 0) != SUCCESS) {
+        zval_ptr_dtor(&container);
+        return FAILURE;
+    }
+
+    if (Z_TYPE(container) == IS_ARRAY) {
+        if (Z_TYPE(dim) == IS_LONG) {
+            zv = zend_hash_index_find(Z_ARRVAL(container), Z_LVAL(dim));
+            ret = SUCCESS;
+        } else if (Z_TYPE(dim) == IS_STRING) {
+            zv = zend_symtable_find(Z_ARRVAL(container), Z_STR(dim));
+            ret = SUCCESS;
+        }
+        if (ret == SUCCESS) {
+            if (zv != NULL && Z_TYPE_P(zv) == IS_INDIRECT) {
+                zv = Z_INDIRECT_P(zv);
+            }
+            ret = native_fetch_result(zv, result, silent);
+        }
+    } else if (silent && Z_TYPE(container) == IS_NULL) {
+        ZVAL_NULL(result);
+        ret = SUCCESS;
+    }
+
+    zval_ptr_dtor(&dim);
+    zval_ptr_dtor(&container);
+    return ret;
+}
+
+/* Natively evaluate a binary operation or comparison */
+static int native_evaluate_binary(stackdriver_debugger_native_expr_t *expr, zend_execute_data *frame, zval *result)
+{
+    zval op1, op2;
+    int ret = FAILURE;
+
+    if (native_evaluate(expr->child[0], frame, &op1, 0) != SUCCESS) {
+        return FAILURE;
+    }
+    if (native_evaluate(expr->child[1], frame, &op2, 0) != SUCCESS) {
+        zval_ptr_dtor(&op1);
+        return FAILURE;
+    }
+
+    /* Objects may be converted or compared with user code */
+    if (Z_TYPE(op1) != IS_OBJECT && Z_TYPE(op2) != IS_OBJECT) {
+        switch (expr->kind) {
+            case ZEND_AST_GREATER:
+                ret = is_smaller_function(result, &op2, &op1);
+                break;
+            case ZEND_AST_GREATER_EQUAL:
+                ret = is_smaller_or_equal_function(result, &op2, &op1);
+                break;
+            default:
+                switch (expr->attr) {
+                    case ZEND_ADD:
+                    case ZEND_SUB:
+                    case ZEND_MUL:
+                        /* Only numbers are guaranteed not to raise warnings */
+                        if ((Z_TYPE(op1) != IS_LONG && Z_TYPE(op1) != IS_DOUBLE) ||
+                            (Z_TYPE(op2) != IS_LONG && Z_TYPE(op2) != IS_DOUBLE)) {
+                            break;
+                        }
+                        /* fall through */
+                    default:
+                        ret = get_binary_op(expr->attr)(result, &op1, &op2);
+                }
+        }
+    }
+
+    zval_ptr_dtor(&op1);
+    zval_ptr_dtor(&op2);
+    return ret;
+}
+
+/**
+ * Evaluate a native expression tree against the variables in the provided
+ * frame. Returns FAILURE if the expression could not be evaluated natively
+ * without side effects, in which case the full evaluation path should be used.
+ */
+static int native_evaluate(stackdriver_debugger_native_expr_t *expr, zend_execute_data *frame, zval *result, zend_bool silent)
+{
+    zval operand;
+
+    switch (expr->kind) {
+        case ZEND_AST_ZVAL:
+            ZVAL_COPY(result, &expr->value);
+            return SUCCESS;
+
+        case ZEND_AST_VAR:
+            return native_fetch_result(find_frame_variable(frame, Z_STR(expr->value), &expr->cv_slot), result, silent);
+
+        case ZEND_AST_PROP:
+            return native_evaluate_prop(expr, frame, result, silent);
+
+        case ZEND_AST_DIM:
+            return native_evaluate_dim(expr, frame, result, silent);
+
+        case ZEND_AST_ISSET:
+        case ZEND_AST_EMPTY:
+            if (native_evaluate(expr->child[0], frame, &operand, 1) != SUCCESS) {
+                return FAILURE;
+            }
+            if (expr->kind == ZEND_AST_ISSET) {
+                ZVAL_BOOL(result, Z_TYPE(operand) != IS_NULL);
+            } else {
+                ZVAL_BOOL(result, !zend_is_true(&operand));
+            }
+            zval_ptr_dtor(&operand);
+            return SUCCESS;
+
+        case ZEND_AST_UNARY_OP:
+            if (native_evaluate(expr->child[0], frame, &operand, 0) != SUCCESS) {
+                return FAILURE;
+            }
+            ZVAL_BOOL(result, !zend_is_true(&operand));
+            zval_ptr_dtor(&operand);
+            return SUCCESS;
+
+        case ZEND_AST_AND:
+        case ZEND_AST_OR:
+            if (native_evaluate(expr->child[0], frame, &operand, 0) != SUCCESS) {
+                return FAILURE;
+            }
+            if (zend_is_true(&operand) == (expr->kind == ZEND_AST_OR)) {
+                /* short circuit */
+                zval_ptr_dtor(&operand);
+                ZVAL_BOOL(result, expr->kind == ZEND_AST_OR);
+                return SUCCESS;
+            }
+            zval_ptr_dtor(&operand);
+            if (native_evaluate(expr->child[1], frame, &operand, 0) != SUCCESS) {
+                return FAILURE;
+            }
+            ZVAL_BOOL(result, zend_is_true(&operand));
+            zval_ptr_dtor(&operand);
+            return SUCCESS;
+
+        case ZEND_AST_BINARY_OP:
+        case ZEND_AST_GREATER:
+        case ZEND_AST_GREATER_EQUAL:
+            return native_evaluate_binary(expr, frame, result);
+    }
+
+    return FAILURE;
+}
+
+/* Initialize an empty, allocated compiled statement */
+static void init_compiled_statement(stackdriver_debugger_compiled_statement_t *compiled)
+{
+    compiled->native = NULL;
+    compiled->op_array = NULL;
+    compiled->variables = NULL;
+    compiled->variable_slots = NULL;
+}
+
+/* Cleanup an allocated compiled statement including freeing memory */
+static void destroy_compiled_statement(stackdriver_debugger_compiled_statement_t *compiled)
+{
+    destroy_native_expr(compiled->native);
+
+    if (compiled->variables) {
+        zend_hash_destroy(compiled->variables);
+        FREE_HASHTABLE(compiled->variables);
+    }
+    if (compiled->variable_slots) {
+        efree(compiled->variable_slots);
+    }
+
+    if (compiled->op_array) {
+        destroy_op_array(compiled->op_array);
+        efree(compiled->op_array);
+    }
+
+    efree(compiled);
+}
+
+/**
+ * Destructor for cleaning up a zval pointer which contains a manually
+ * emalloc'ed compiled statement pointer.
+ */
+static void compiled_statement_dtor(zval *zv)
+{
+    stackdriver_debugger_compiled_statement_t *compiled = (stackdriver_debugger_compiled_statement_t *)Z_PTR_P(zv);
+    destroy_compiled_statement(compiled);
+    ZVAL_PTR_DTOR(zv);
+}
+
+/**
+ * Compile the provided statement into an op_array which returns the result of
+ * the statement. This matches the code that `zend_eval_string` would compile.
+ * Returns NULL if the statement fails to compile.
+ */
+static zend_op_array *compile_statement(zend_string *statement, char *snippet_name)
+{
+    zval source;
+    zend_op_array *op_array;
+    uint32_t original_compiler_options = CG(compiler_options);
+
+    ZVAL_STR(&source, strpprintf(ZSTR_LEN(statement) + sizeof("return ;") - 1, "return %s;", ZSTR_VAL(statement)));
+
+    CG(compiler_options) = ZEND_COMPILE_DEFAULT_FOR_EVAL;
+    op_array = zend_compile_string(&source, snippet_name);
+    CG(compiler_options) = original_compiler_options;
+
+    zval_dtor(&source);
+    return op_array;
+}
+
+/**
+ * Build a private symbol table containing only the statement's variables,
+ * copied from the frame's compiled variables or its existing symbol table.
+ */
+static zend_array *build_isolated_symbol_table(stackdriver_debugger_compiled_statement_t *compiled, zend_execute_data *frame)
+{
+    zend_array *symbol_table;
+    zend_string *name;
+    zval *zv;
+    uint32_t i = 0;
+
+    ALLOC_HASHTABLE(symbol_table);
+    zend_hash_init(symbol_table, zend_hash_num_elements(compiled->variables), NULL, ZVAL_PTR_DTOR, 0);
+
+    ZEND_HASH_FOREACH_STR_KEY(compiled->variables, name) {
+        zv = find_frame_variable(frame, name, &compiled->variable_slots[i++]);
+        if (zv == NULL || Z_TYPE_P(zv) == IS_UNDEF) {
+            continue;
+        }
+        ZVAL_DEREF(zv);
+        Z_TRY_ADDREF_P(zv);
+        zend_hash_add_new(symbol_table, name, zv);
+    } ZEND_HASH_FOREACH_END();
+
+    return symbol_table;
+}
+
+/**
+ * Execute a previously compiled statement against a private symbol table
+ * which only binds the variables the statement references. Unlike
+ * `zend_execute`, this does not rebuild and attach a symbol table to the
+ * frame being debugged, which would otherwise stay attached for the rest of
+ * the function's execution.
+ */
+static void execute_statement_isolated(stackdriver_debugger_compiled_statement_t *compiled, zend_execute_data *frame, zval *retval)
+{
+    zend_op_array *op_array = compiled->op_array;
+    zend_execute_data *execute_data;
+    zend_array *symbol_table;
+    uint32_t call_info = ZEND_CALL_TOP_CODE;
+#if PHP_VERSION_ID >= 70100
+    zend_class_entry *original_scope = op_array->scope;
+#endif
+
+    ZVAL_NULL(retval);
+    if (EG(exception) != NULL) {
+        return;
+    }
+
+#if PHP_VERSION_ID >= 70100
+    /*
+     * The executed scope is read from the function, so borrow the frame's
+     * scope for this execution only. The cached op_array may be executed
+     * again, including by a nested evaluation, from another scope.
+     */
+    call_info |= ZEND_CALL_HAS_SYMBOL_TABLE;
+    op_array->scope = frame->func->common.scope;
+#endif
+
+    symbol_table = build_isolated_symbol_table(compiled, frame);
+
+    execute_data = zend_vm_stack_push_call_frame(call_info, (zend_function *)op_array, 0, zend_get_called_scope(frame), NULL);
+    EX(symbol_table) = symbol_table;
+
+    EG(no_extensions) = 1;
+    ZVAL_UNDEF(retval);
+    zend_init_execute_data(execute_data, op_array, retval);
+    zend_execute_ex(execute_data);
+    zend_vm_stack_free_call_frame(execute_data);
+    EG(no_extensions) = 0;
+
+#if PHP_VERSION_ID >= 70100
+    op_array->scope = original_scope;
+#endif
+
+    zend_array_destroy(symbol_table);
+
+    if (Z_TYPE_P(retval) == IS_UNDEF) {
+        ZVAL_NULL(retval);
+    }
+}
+
+/**
+ * Execute a previously compiled statement in the current execution scope and
+ * store the result in `retval`. The op_array is not destroyed so that it can
+ * be executed again on the next hit.
+ */
+static void execute_statement(zend_op_array *op_array, zval *retval)
+{
+    zval local_retval;
+#if PHP_VERSION_ID >= 70100
+    zend_class_entry *original_scope = op_array->scope;
+
+    /* borrow the executed scope for this execution only */
+    op_array->scope = zend_get_executed_scope();
+#endif
+
+    EG(no_extensions) = 1;
+    ZVAL_UNDEF(&local_retval);
+    zend_execute(op_array, &local_retval);
+    EG(no_extensions) = 0;
+
+#if PHP_VERSION_ID >= 70100
+    op_array->scope = original_scope;
+#endif
+
+    if (Z_TYPE(local_retval) != IS_UNDEF) {
+        ZVAL_COPY_VALUE(retval, &local_retval);
+    } else {
+        ZVAL_NULL(retval);
+    }
+}
+
+/**
+ * Find the compiled version of the provided statement, creating and caching
+ * it if this is the first time we have seen this statement in this request.
+ */
+static stackdriver_debugger_compiled_statement_t *find_or_create_compiled_statement(zend_string *statement)
+{
+    stackdriver_debugger_compiled_statement_t *compiled;
+
+    compiled = zend_hash_find_ptr(STACKDRIVER_DEBUGGER_G(compiled_statements), statement);
+    if (compiled != NULL) {
+        return compiled;
+    }
+
+    compiled = emalloc(sizeof(stackdriver_debugger_compiled_statement_t));
+    init_compiled_statement(compiled);
+
+    /* Analyze the validated AST for the native and isolated paths */
+    valid_debugger_statement_ex(statement, analyze_statement, compiled, 1);
+
+    zend_hash_update_ptr(STACKDRIVER_DEBUGGER_G(compiled_statements), statement, compiled);
+    return compiled;
+}
+
+/**
+ * Evaluate the provided statement in the current execution scope. This
+ * behaves like `zend_eval_string`, but simple statements are interpreted
+ * natively and all others are only compiled once per request and executed
+ * against only the variables they reference. Returns SUCCESS | FAILURE.
+ */
+int evaluate_debugger_statement(zend_string *statement, zval *retval, char *snippet_name)
+{
+    stackdriver_debugger_compiled_statement_t *compiled = find_or_create_compiled_statement(statement);
+    zend_execute_data *frame = find_user_frame();
+
+    if (compiled->native != NULL) {
+        if (frame != NULL && native_evaluate(compiled->native, frame, retval, 0) == SUCCESS) {
+            return SUCCESS;
+        }
+    }
+
+    if (compiled->op_array == NULL) {
+        compiled->op_array = compile_statement(statement, snippet_name);
+        if (compiled->op_array == NULL) {
+            return FAILURE;
+        }
+    }
+
+    if (compiled->variables != NULL && frame != NULL) {
+        execute_statement_isolated(compiled, frame, retval);
+    } else {
+        execute_statement(compiled->op_array, retval);
+    }
+    return SUCCESS;
+}
+
+/**
+ * Add the names of the variables referenced by the provided statement to
+ * `variables`. Returns FAILURE if they cannot be determined statically, e.g.
+ * for variable variables, statements using $this or calls like compact().
+ */
+int stackdriver_debugger_statement_variables(zend_string *statement, HashTable *variables)
+{
+    stackdriver_debugger_compiled_statement_t *compiled = find_or_create_compiled_statement(statement);
+
+    if (compiled->variables == NULL) {
+        return FAILURE;
+    }
+    zend_hash_merge(variables, compiled->variables, NULL, 0);
+    return SUCCESS;
+}
+
+/**
+ * Request initialization lifecycle hook. Initializes the compiled statement
+ * cache.
+ */
+int stackdriver_debugger_eval_rinit(TSRMLS_D)
+{
+    ALLOC_HASHTABLE(STACKDRIVER_DEBUGGER_G(compiled_statements));
+    zend_hash_init(STACKDRIVER_DEBUGGER_G(compiled_statements), 16, NULL, compiled_statement_dtor, 0);
+
+    return SUCCESS;
+}
+
+/**
+ * Request shutdown lifecycle hook. Destroys the compiled statement cache.
+ */
+int stackdriver_debugger_eval_rshutdown(TSRMLS_D)
+{
+    zend_hash_destroy(STACKDRIVER_DEBUGGER_G(compiled_statements));
+    FREE_HASHTABLE(STACKDRIVER_DEBUGGER_G(compiled_statements));
+
+    return SUCCESS;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PHP_STACKDRIVER_DEBUGGER_EVAL_H
+#define PHP_STACKDRIVER_DEBUGGER_EVAL_H 1
+
+#include "php.h"
+
+/*
+ * Compiled variable slot of a variable name, resolved for the op_array it was
+ * last looked up in.
+ */
+typedef struct stackdriver_debugger_cv_slot_t {
+    const zend_op_array *op_array;
+    int slot;
+} stackdriver_debugger_cv_slot_t;
+
+/*
+ * Natively evaluated expression node. This mirrors the subset of the validated
+ * statement AST that can be interpreted without compiling an op_array.
+ */
+typedef struct stackdriver_debugger_native_expr_t {
+    zend_ast_kind kind;
+    zend_ast_attr attr;
+
+    /* constant value for ZEND_AST_ZVAL, name for ZEND_AST_VAR/ZEND_AST_PROP */
+    zval value;
+
+    /* slot of the variable for ZEND_AST_VAR */
+    stackdriver_debugger_cv_slot_t cv_slot;
+
+    struct stackdriver_debugger_native_expr_t *child[2];
+} stackdriver_debugger_native_expr_t;
+
+/* Compiled statement struct */
+typedef struct stackdriver_debugger_compiled_statement_t {
+    /* native fast path, NULL if the statement is not natively supported */
+    stackdriver_debugger_native_expr_t *native;
+
+    /* the compiled "return <statement>;" op_array, compiled on first use */
+    zend_op_array *op_array;
+
+    /*
+     * names of the variables referenced by the statement, NULL if they cannot
+     * be determined statically (variable variables or $this)
+     */
+    HashTable *variables;
+
+    /* slots of the variables, in the order of `variables` */
+    stackdriver_debugger_cv_slot_t *variable_slots;
+} stackdriver_debugger_compiled_statement_t;
+
+int evaluate_debugger_statement(zend_string *statement, zval *retval, char *snippet_name);
+int stackdriver_debugger_statement_variables(zend_string *statement, HashTable *variables);
+/* request lifecycle callbacks */
+int stackdriver_debugger_eval_rinit(TSRMLS_D);
+int stackdriver_debugger_eval_rshutdown(TSRMLS_D);
+
+#endif /* PHP_STACKDRIVER_DEBUGGER_EVAL_H */
@@ -0,0 +1,507 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "php.h"
+#include "zend_smart_str.h"
+#include "php_stackdriver_debugger.h"
+#include "stackdriver_debugger_json.h"
+#include "stackdriver_debugger_snapshot.h"
+#include "ext/standard/html.h"
+#include "ext/standard/php_incomplete_class.h"
+
+/*
+ * Encodes collected snapshots into the Breakpoint JSON layout of the
+ * Stackdriver Debugger API (Breakpoint, StackFrame and Variable resources), so
+ * that the agent can forward the result without walking it again.
+ */
+
+#define TRUNCATED_DESCRIPTION "Value truncated by capture limits"
+
+/* property holding the original class name of frozen objects */
+#define INCOMPLETE_CLASS_NAME_MEMBER "__PHP_Incomplete_Class_Name"
+
+#define BUF_LEN(buf) ((buf)->s ? ZSTR_LEN((buf)->s) : 0)
+
+/* State shared while encoding a single snapshot */
+typedef struct json_encoder_t {
+    smart_str *buf;
+    stackdriver_debugger_capture_options_t *options;
+
+    /* length of the buffer when encoding started, for max_total_bytes */
+    size_t start;
+} json_encoder_t;
+
+static int encode_value(json_encoder_t *encoder, zval *zv, zend_long depth);
+
+/* Append `str` as a JSON string, replacing invalid UTF-8 sequences */
+static void encode_string(smart_str *buf, const char *str, size_t len)
+{
+    size_t pos = 0, start;
+    int status;
+    unsigned int c;
+
+    smart_str_appendc(buf, '"');
+    while (pos < len) {
+        start = pos;
+        c = php_next_utf8_char((const unsigned char *)str, len, &pos, &status);
+        if (status != SUCCESS) {
+            smart_str_appendl(buf, "\\ufffd", 6);
+            if (pos == start) {
+                pos++;
+            }
+            continue;
+        }
+
+        switch (c) {
+            case '"':
+                smart_str_appendl(buf, "\\\"", 2);
+                break;
+            case '\\':
+                smart_str_appendl(buf, "\\\\", 2);
+                break;
+            case '\b':
+                smart_str_appendl(buf, "\\b", 2);
+                break;
+            case '\f':
+                smart_str_appendl(buf, "\\f", 2);
+                break;
+            case '\n':
+                smart_str_appendl(buf, "\\n", 2);
+                break;
+            case '\r':
+                smart_str_appendl(buf, "\\r", 2);
+                break;
+            case '\t':
+                smart_str_appendl(buf, "\\t", 2);
+                break;
+            default:
+                if (c < 0x20) {
+                    static const char digits[] = "0123456789abcdef";
+                    smart_str_appendl(buf, "\\u00", 4);
+                    smart_str_appendc(buf, digits[c >> 4]);
+                    smart_str_appendc(buf, digits[c & 0xf]);
+                } else {
+                    smart_str_appendl(buf, str + start, pos - start);
+                }
+        }
+    }
+    smart_str_appendc(buf, '"');
+}
+
+/* Append `"key":` */
+static zend_always_inline void encode_key(smart_str *buf, const char *key)
+{
+    smart_str_appendc(buf, '"');
+    smart_str_appends(buf, key);
+    smart_str_appendl(buf, "\":", 2);
+}
+
+/* Append a "location" object */
+static void encode_location(smart_str *buf, zend_string *path, zend_long line)
+{
+    encode_key(buf, "location");
+    smart_str_appendc(buf, '{');
+    encode_key(buf, "path");
+    encode_string(buf, ZSTR_VAL(path), ZSTR_LEN(path));
+    smart_str_appendc(buf, ',');
+    encode_key(buf, "line");
+    smart_str_append_long(buf, line);
+    smart_str_appendc(buf, '}');
+}
+
+/* Append a non-error StatusMessage referring to the variable value */
+static void encode_truncated_status(smart_str *buf)
+{
+    smart_str_appendl(buf, ",\"status\":{\"isError\":false,\"refersTo\":\"VARIABLE_VALUE\",\"description\":{\"format\":\"", sizeof(",\"status\":{\"isError\":false,\"refersTo\":\"VARIABLE_VALUE\",\"description\":{\"format\":\"") - 1);
+    smart_str_appends(buf, TRUNCATED_DESCRIPTION);
+    smart_str_appendl(buf, "\"}}", 3);
+}
+
+/* Returns whether the encoded output reached the snapshot's max_total_bytes */
+static zend_always_inline int over_budget(json_encoder_t *encoder)
+{
+    return encoder->options->max_total_bytes > 0 &&
+        BUF_LEN(encoder->buf) - encoder->start >= (size_t)encoder->options->max_total_bytes;
+}
+
+/* Append the "type" and "value" of a scalar */
+static void encode_scalar(json_encoder_t *encoder, zval *zv)
+{
+    smart_str *buf = encoder->buf;
+    char num[64];
+
+    switch (Z_TYPE_P(zv)) {
+        case IS_NULL:
+            smart_str_appends(buf, "\"type\":\"NULL\",\"value\":\"NULL\"");
+            break;
+        case IS_FALSE:
+            smart_str_appends(buf, "\"type\":\"bool\",\"value\":\"false\"");
+            break;
+        case IS_TRUE:
+            smart_str_appends(buf, "\"type\":\"bool\",\"value\":\"true\"");
+            break;
+        case IS_LONG:
+            smart_str_appends(buf, "\"type\":\"int\",\"value\":\"");
+            smart_str_append_long(buf, Z_LVAL_P(zv));
+            smart_str_appendc(buf, '"');
+            break;
+        case IS_DOUBLE:
+            snprintf(num, sizeof(num), "%.*G", (int)EG(precision), Z_DVAL_P(zv));
+            smart_str_appends(buf, "\"type\":\"float\",\"value\":");
+            encode_string(buf, num, strlen(num));
+            break;
+        case IS_RESOURCE:
+            smart_str_appends(buf, "\"type\":\"resource\",\"value\":\"resource(");
+            smart_str_append_long(buf, Z_RES_HANDLE_P(zv));
+            smart_str_appendl(buf, ")\"", 2);
+            break;
+        default:
+            smart_str_appends(buf, "\"type\":\"unknown\"");
+    }
+}
+
+/**
+ * Append the "type" and "value" of a string, honoring max_string_length.
+ * Returns whether the value was truncated.
+ */
+static int encode_string_value(json_encoder_t *encoder, zend_string *str)
+{
+    size_t len = ZSTR_LEN(str);
+    zend_long max = encoder->options->max_string_length;
+
+    smart_str_appends(encoder->buf, "\"type\":\"string\",\"value\":");
+    if (max > 0 && len > (size_t)max) {
+        encode_string(encoder->buf, ZSTR_VAL(str), (size_t)max);
+        return 1;
+    }
+    encode_string(encoder->buf, ZSTR_VAL(str), len);
+    return 0;
+}
+
+/**
+ * Append the "members" of an array or object property table, honoring
+ * max_member_depth, max_members and max_total_bytes. Object property names are
+ * unmangled, and the class name bookkeeping property of frozen objects is
+ * skipped if `frozen` is set. Returns whether members were left out.
+ */
+static int encode_members(json_encoder_t *encoder, HashTable *ht, zend_long depth, int unmangle, int frozen)
+{
+    smart_str *buf = encoder->buf;
+    stackdriver_debugger_capture_options_t *options = encoder->options;
+    uint32_t count = 0, total = zend_hash_num_elements(ht);
+    zend_string *key;
+    zend_ulong idx;
+    zval *val;
+
+    if (zend_hash_num_elements(ht) == 0) {
+        return 0;
+    }
+    if (options->max_member_depth > 0 && depth >= options->max_member_depth) {
+        return 1;
+    }
+
+    smart_str_appends(buf, ",\"members\":[");
+    ZEND_HASH_FOREACH_KEY_VAL_IND(ht, idx, key, val) {
+        if (frozen && key && zend_string_equals_literal(key, INCOMPLETE_CLASS_NAME_MEMBER)) {
+            total--;
+            continue;
+        }
+        if ((options->max_members > 0 && count >= options->max_members) || over_budget(encoder)) {
+            break;
+        }
+        if (count > 0) {
+            smart_str_appendc(buf, ',');
+        }
+        smart_str_appendc(buf, '{');
+        encode_key(buf, "name");
+        if (key == NULL) {
+            smart_str_appendc(buf, '"');
+            smart_str_append_unsigned(buf, idx);
+            smart_str_appendc(buf, '"');
+        } else if (unmangle) {
+            const char *class_name, *prop_name;
+            size_t prop_len;
+
+            zend_unmangle_property_name_ex(key, &class_name, &prop_name, &prop_len);
+            encode_string(buf, prop_name, prop_len);
+        } else {
+            encode_string(buf, ZSTR_VAL(key), ZSTR_LEN(key));
+        }
+        smart_str_appendc(buf, ',');
+        if (encode_value(encoder, val, depth + 1)) {
+            encode_truncated_status(buf);
+        }
+        smart_str_appendc(buf, '}');
+        count++;
+    } ZEND_HASH_FOREACH_END();
+    smart_str_appendc(buf, ']');
+
+    return count < total;
+}
+
+/* Append the "type" and "members" of an array. Returns whether members were left out */
+static int encode_array(json_encoder_t *encoder, zval *zv, zend_long depth)
+{
+    HashTable *ht = Z_ARRVAL_P(zv);
+    int protect = Z_REFCOUNTED_P(zv) && CAPTURE_PROTECTED(ht);
+    int truncated;
+
+    smart_str_appends(encoder->buf, "\"type\":\"array\"");
+    if (protect && CAPTURE_IS_RECURSIVE(ht)) {
+        return 1;
+    }
+
+    if (protect) {
+        CAPTURE_PROTECT_RECURSION(ht);
+    }
+    truncated = encode_members(encoder, ht, depth, 0, 0);
+    if (protect) {
+        CAPTURE_UNPROTECT_RECURSION(ht);
+    }
+    return truncated;
+}
+
+/**
+ * Append the "type" and "members" of an object. Properties are read from the
+ * property table, no user code (e.g. __debugInfo) is run. Frozen objects are
+ * reported with their original class name. Returns whether members were left
+ * out.
+ */
+static int encode_object(json_encoder_t *encoder, zval *zv, zend_long depth)
+{
+    smart_str *buf = encoder->buf;
+    zend_class_entry *ce = Z_OBJCE_P(zv);
+    HashTable *properties;
+    zend_string *class_name = NULL;
+    int truncated;
+
+    if (ce == PHP_IC_ENTRY) {
+        class_name = php_lookup_class_name(zv);
+    }
+    smart_str_appends(buf, "\"type\":");
+    if (class_name) {
+        encode_string(buf, ZSTR_VAL(class_name), ZSTR_LEN(class_name));
+        zend_string_release(class_name);
+    } else {
+        encode_string(buf, ZSTR_VAL(ce->name), ZSTR_LEN(ce->name));
+    }
+
+    if (CAPTURE_OBJ_IS_RECURSIVE(zv)) {
+        return 1;
+    }
+    properties = Z_OBJ_HT_P(zv)->get_properties ? Z_OBJPROP_P(zv) : NULL;
+    if (properties == NULL) {
+        return 0;
+    }
+
+    CAPTURE_OBJ_PROTECT_RECURSION(zv);
+    truncated = encode_members(encoder, properties, depth, 1, ce == PHP_IC_ENTRY);
+    CAPTURE_OBJ_UNPROTECT_RECURSION(zv);
+
+    return truncated;
+}
+
+/**
+ * Append the fields of a Variable describing `zv`, without its name or status.
+ * Returns whether the value was truncated, in which case the caller appends
+ * the status.
+ */
+static int encode_value(json_encoder_t *encoder, zval *zv, zend_long depth)
+{
+    ZVAL_DEREF(zv);
+
+    if (over_budget(encoder)) {
+        smart_str_appends(encoder->buf, "\"type\":\"unknown\"");
+        return 1;
+    }
+
+    /* a value cut off when it was captured */
+    if (Z_TYPE_P(zv) == IS_STRING && Z_STR_P(zv) == stackdriver_debugger_truncated_marker) {
+        smart_str_appends(encoder->buf, "\"type\":\"unknown\"");
+        return 1;
+    }
+
+    switch (Z_TYPE_P(zv)) {
+        case IS_STRING:
+            return encode_string_value(encoder, Z_STR_P(zv));
+        case IS_ARRAY:
+            return encode_array(encoder, zv, depth);
+        case IS_OBJECT:
+            return encode_object(encoder, zv, depth);
+        default:
+            encode_scalar(encoder, zv);
+            return 0;
+    }
+}
+
+/* Append a captured variable as a Variable */
+static void encode_variable(json_encoder_t *encoder, stackdriver_debugger_variable_t *variable)
+{
+    smart_str *buf = encoder->buf;
+
+    smart_str_appendc(buf, '{');
+    encode_key(buf, "name");
+    encode_string(buf, ZSTR_VAL(variable->name), ZSTR_LEN(variable->name));
+    smart_str_appendc(buf, ',');
+    if (variable->var_table_index != STACKDRIVER_DEBUGGER_NO_VAR_TABLE_INDEX) {
+        /* the value itself is encoded once in the variable table */
+        encode_key(buf, "varTableIndex");
+        smart_str_append_long(buf, variable->var_table_index);
+    } else if (encode_value(encoder, &variable->value, 0) || variable->truncated) {
+        encode_truncated_status(buf);
+    }
+    smart_str_appendc(buf, '}');
+}
+
+/* Append the "stackFrames" of the snapshot */
+static void encode_stackframes(json_encoder_t *encoder, stackdriver_debugger_snapshot_t *snapshot)
+{
+    smart_str *buf = encoder->buf;
+    uint32_t i, j;
+
+    encode_key(buf, "stackFrames");
+    smart_str_appendc(buf, '[');
+    for (i = 0; i < snapshot->num_stackframes; i++) {
+        stackdriver_debugger_stackframe_t *stackframe = &snapshot->stackframes[i];
+
+        if (i > 0) {
+            smart_str_appendc(buf, ',');
+        }
+        smart_str_appendc(buf, '{');
+        if (stackframe->function) {
+            encode_key(buf, "function");
+            encode_string(buf, ZSTR_VAL(stackframe->function), ZSTR_LEN(stackframe->function));
+            smart_str_appendc(buf, ',');
+        }
+        encode_location(buf, stackframe->filename, stackframe->lineno);
+        smart_str_appendc(buf, ',');
+        encode_key(buf, "locals");
+        smart_str_appendc(buf, '[');
+        for (j = 0; j < stackframe->num_locals; j++) {
+            if (j > 0) {
+                smart_str_appendc(buf, ',');
+            }
+            encode_variable(encoder, &stackframe->locals[j]);
+        }
+        smart_str_appends(buf, "]}");
+    }
+    smart_str_appendc(buf, ']');
+}
+
+/* Append the "variableTable" of the snapshot, in index order */
+static void encode_variable_table(json_encoder_t *encoder, stackdriver_debugger_snapshot_t *snapshot)
+{
+    smart_str *buf = encoder->buf;
+    uint32_t i, j, count = 0;
+
+    encode_key(buf, "variableTable");
+    smart_str_appendc(buf, '[');
+    for (i = 0; i < snapshot->num_stackframes; i++) {
+        stackdriver_debugger_stackframe_t *stackframe = &snapshot->stackframes[i];
+
+        for (j = 0; j < stackframe->num_locals; j++) {
+            stackdriver_debugger_variable_t *variable = &stackframe->locals[j];
+
+            if (!variable->var_table_owner) {
+                continue;
+            }
+            if (count++ > 0) {
+                smart_str_appendc(buf, ',');
+            }
+            smart_str_appendc(buf, '{');
+            if (encode_value(encoder, &variable->value, 0) || variable->truncated) {
+                encode_truncated_status(buf);
+            }
+            smart_str_appendc(buf, '}');
+        }
+    }
+    smart_str_appendc(buf, ']');
+}
+
+/* Append the "expressions" and "evaluatedExpressions" of the snapshot */
+static void encode_expressions(json_encoder_t *encoder, stackdriver_debugger_snapshot_t *snapshot)
+{
+    smart_str *buf = encoder->buf;
+    zend_string *expression;
+    zval *value;
+    int first = 1;
+
+    encode_key(buf, "expressions");
+    smart_str_appendc(buf, '[');
+    ZEND_HASH_FOREACH_VAL(snapshot->expressions, value) {
+        if (!first) {
+            smart_str_appendc(buf, ',');
+        }
+        first = 0;
+        encode_string(buf, Z_STRVAL_P(value), Z_STRLEN_P(value));
+    } ZEND_HASH_FOREACH_END();
+    smart_str_appends(buf, "],");
+
+    first = 1;
+    encode_key(buf, "evaluatedExpressions");
+    smart_str_appendc(buf, '[');
+    ZEND_HASH_FOREACH_STR_KEY_VAL(snapshot->evaluated_expressions, expression, value) {
+        if (expression == NULL) {
+            continue;
+        }
+        if (!first) {
+            smart_str_appendc(buf, ',');
+        }
+        first = 0;
+        smart_str_appendc(buf, '{');
+        encode_key(buf, "name");
+        encode_string(buf, ZSTR_VAL(expression), ZSTR_LEN(expression));
+        smart_str_appendc(buf, ',');
+        if (encode_value(encoder, value, 0)) {
+            encode_truncated_status(buf);
+        }
+        smart_str_appendc(buf, '}');
+    } ZEND_HASH_FOREACH_END();
+    smart_str_appendc(buf, ']');
+}
+
+/**
+ * Append the collected snapshot to `buf` as a Breakpoint JSON object. Captured
+ * values are encoded within the snapshot's capture limits.
+ */
+void stackdriver_debugger_snapshot_to_json(smart_str *buf, stackdriver_debugger_snapshot_t *snapshot)
+{
+    json_encoder_t encoder;
+
+    encoder.buf = buf;
+    encoder.options = &snapshot->capture_options;
+    encoder.start = BUF_LEN(buf);
+
+    smart_str_appendc(buf, '{');
+    encode_key(buf, "id");
+    encode_string(buf, ZSTR_VAL(snapshot->id), ZSTR_LEN(snapshot->id));
+    smart_str_appendc(buf, ',');
+    encode_location(buf, snapshot->filename, snapshot->lineno);
+    smart_str_appendc(buf, ',');
+    if (snapshot->condition) {
+        encode_key(buf, "condition");
+        encode_string(buf, ZSTR_VAL(snapshot->condition), ZSTR_LEN(snapshot->condition));
+        smart_str_appendc(buf, ',');
+    }
+    smart_str_appends(buf, "\"isFinalState\":true,");
+    encode_expressions(&encoder, snapshot);
+    smart_str_appendc(buf, ',');
+    encode_stackframes(&encoder, snapshot);
+    smart_str_appendc(buf, ',');
+    encode_variable_table(&encoder, snapshot);
+    smart_str_appendc(buf, '}');
+}
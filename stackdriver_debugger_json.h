@@ -0,0 +1,27 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef PHP_STACKDRIVER_DEBUGGER_JSON_H
+#define PHP_STACKDRIVER_DEBUGGER_JSON_H 1
+
+#include "php.h"
+#include "zend_smart_str.h"
+#include "stackdriver_debugger_snapshot.h"
+
+void stackdriver_debugger_snapshot_to_json(smart_str *buf, stackdriver_debugger_snapshot_t *snapshot);
+
+#endif /* PHP_STACKDRIVER_DEBUGGER_JSON_H */
@@ -17,37 +17,14 @@
 #include "php.h"
 #include "php_stackdriver_debugger.h"
 #include "stackdriver_debugger_ast.h"
+#include "stackdriver_debugger_eval.h"
 #include "stackdriver_debugger_logpoint.h"
+#include "stackdriver_debugger_probe.h"
 #include "zend_exceptions.h"
 #include "stackdriver_debugger_time_functions.h"
 #include "stackdriver_debugger_random.h"
 
-#include "ext/pcre/php_pcre.h"
-
-#if PHP_VERSION_ID < 70200
-#define REGEX_REPLACE_ALL(regex, subject, replace) \
-    php_pcre_replace( \
-        regex, \
-        subject, \
-        ZSTR_VAL(subject), \
-        ZSTR_LEN(subject), \
-        replace, \
-        0, \
-        -1, \
-        NULL \
-    )
-#else
-#define REGEX_REPLACE_ALL(regex, subject, replace) \
-    php_pcre_replace( \
-        regex, \
-        subject, \
-        ZSTR_VAL(subject), \
-        ZSTR_LEN(subject), \
-        Z_STR_P(replace), \
-        -1, \
-        NULL \
-    )
-#endif
+#include "zend_smart_str.h"
 
 /* Initialize an empty, allocated logpoint */
 static void init_logpoint(stackdriver_debugger_logpoint_t *logpoint)
@@ -61,6 +38,9 @@ static void init_logpoint(stackdriver_debugger_logpoint_t *logpoint)
     ALLOC_HASHTABLE(logpoint->expressions);
     zend_hash_init(logpoint->expressions, 4, NULL, ZVAL_PTR_DTOR, 0);
     ZVAL_NULL(&logpoint->callback);
+    ZVAL_NULL(&logpoint->callback_context);
+    logpoint->segments = NULL;
+    logpoint->num_segments = 0;
 }
 
 /* Cleanup an allocated logpoint including freeing memory */
@@ -76,12 +56,17 @@ static void destroy_logpoint(stackdriver_debugger_logpoint_t *logpoint)
     zend_string_release(logpoint->log_level);
     zend_string_release(logpoint->format);
 
+    if (logpoint->segments) {
+        efree(logpoint->segments);
+    }
+
     zend_hash_destroy(logpoint->expressions);
     FREE_HASHTABLE(logpoint->expressions);
 
     if (Z_TYPE(logpoint->callback) != IS_NULL) {
         ZVAL_DESTRUCTOR(&logpoint->callback);
     }
+    zval_ptr_dtor(&logpoint->callback_context);
 
     efree(logpoint);
 }
@@ -106,37 +91,145 @@ static void destroy_message(stackdriver_debugger_message_t *message)
     efree(message);
 }
 
-static int handle_message_callback(zval *callback, stackdriver_debugger_message_t *message)
+static int handle_message_callback(stackdriver_debugger_logpoint_t *logpoint, stackdriver_debugger_message_t *message)
 {
     zval callback_result;
     zval args[3];
-    ZVAL_STR(&args[0], zend_string_copy(message->log_level));
+    zend_fcall_info fci = logpoint->callback_fci;
+    int call_result;
+
+    ZVAL_STR_COPY(&args[0], message->log_level);
     ZVAL_COPY(&args[1], &message->message);
-    array_init(&args[2]);
-    add_assoc_str(&args[2], "filename", message->filename);
-    add_assoc_long(&args[2], "line", message->lineno);
-
-    if (call_user_function_ex(EG(function_table), NULL, callback, &callback_result, 3, args, 0, NULL) != SUCCESS) {
-        ZVAL_DESTRUCTOR(&args[0]);
-        ZVAL_DESTRUCTOR(&args[1]);
-        ZVAL_DESTRUCTOR(&args[2]);
-        ZVAL_DESTRUCTOR(&callback_result);
+    ZVAL_COPY(&args[2], &logpoint->callback_context);
+
+    ZVAL_UNDEF(&callback_result);
+    fci.retval = &callback_result;
+    fci.params = args;
+    fci.param_count = 3;
+
+    call_result = zend_call_function(&fci, &logpoint->callback_fcc);
+
+    zval_ptr_dtor(&args[0]);
+    zval_ptr_dtor(&args[1]);
+    zval_ptr_dtor(&args[2]);
+    zval_ptr_dtor(&callback_result);
+    return call_result;
+}
+
+/**
+ * Warn that the logpoint's callback failed. Probes run in the frame of the user
+ * code being debugged, so the warning is attributed to
+ * stackdriver_debugger_logpoint() as it was when breakpoints were injected as
+ * calls to it.
+ */
+static void logpoint_callback_error()
+{
+    zend_error(E_WARNING, "stackdriver_debugger_logpoint(): Error running logpoint callback.");
+}
+
+/**
+ * Resolve the logpoint's callback once so each hit can call it directly
+ * without looking the callable up again.
+ */
+static int resolve_logpoint_callback(stackdriver_debugger_logpoint_t *logpoint, zval *callback)
+{
+    if (stackdriver_debugger_resolve_callback(callback, "logpoint", &logpoint->callback,
+        &logpoint->callback_fci, &logpoint->callback_fcc) != SUCCESS) {
         return FAILURE;
     }
-    ZVAL_DESTRUCTOR(&args[0]);
-    ZVAL_DESTRUCTOR(&args[1]);
-    ZVAL_DESTRUCTOR(&args[2]);
-    ZVAL_DESTRUCTOR(&callback_result);
+
+    array_init(&logpoint->callback_context);
+    add_assoc_str(&logpoint->callback_context, "filename", zend_string_copy(logpoint->filename));
+    add_assoc_long(&logpoint->callback_context, "line", logpoint->lineno);
+
     return SUCCESS;
 }
 
+/**
+ * Append a segment to the logpoint's parsed format, merging adjacent literals.
+ */
+static void add_format_segment(stackdriver_debugger_logpoint_t *logpoint, size_t offset, size_t length, zend_long expression)
+{
+    stackdriver_debugger_format_segment_t *last;
+
+    if (length == 0) {
+        return;
+    }
+
+    if (expression == -1 && logpoint->num_segments > 0) {
+        last = &logpoint->segments[logpoint->num_segments - 1];
+        if (last->expression == -1 && last->offset + last->length == offset) {
+            last->length += length;
+            return;
+        }
+    }
+
+    logpoint->segments[logpoint->num_segments].offset = offset;
+    logpoint->segments[logpoint->num_segments].length = length;
+    logpoint->segments[logpoint->num_segments].expression = expression;
+    logpoint->num_segments++;
+}
+
+/**
+ * Parse the logpoint's format string into literal and placeholder segments.
+ * A placeholder is a `$` followed by the index of an expression, where the
+ * longest run of digits naming a configured expression is used. A `$`
+ * preceded by another `$` is escaped and left as is.
+ */
+static void parse_logpoint_format(stackdriver_debugger_logpoint_t *logpoint)
+{
+    const char *format = ZSTR_VAL(logpoint->format);
+    size_t len = ZSTR_LEN(logpoint->format);
+    size_t i = 0, literal_start = 0, digits, matched;
+    zend_long index, expression;
+    zend_long num_expressions = zend_hash_num_elements(logpoint->expressions);
+
+    /* Each placeholder can split a literal in two */
+    logpoint->segments = safe_emalloc(len + 1, sizeof(stackdriver_debugger_format_segment_t), 0);
+    logpoint->num_segments = 0;
+
+    while (i < len) {
+        if (format[i] != '$' || (i > 0 && format[i - 1] == '$')) {
+            i++;
+            continue;
+        }
+
+        /* Find the longest digit prefix which names an expression */
+        index = 0;
+        matched = 0;
+        expression = -1;
+        for (digits = 1; i + digits < len && format[i + digits] >= '0' && format[i + digits] <= '9'; digits++) {
+            index = index * 10 + (format[i + digits] - '0');
+            if (index >= num_expressions) {
+                break;
+            }
+            matched = digits;
+            expression = index;
+        }
+
+        if (expression == -1) {
+            i++;
+            continue;
+        }
+
+        add_format_segment(logpoint, literal_start, i - literal_start, -1);
+        add_format_segment(logpoint, i, matched + 1, expression);
+        i += matched + 1;
+        literal_start = i;
+    }
+    add_format_segment(logpoint, literal_start, len - literal_start, -1);
+}
+
 /**
  * Evaluate the provided logpoint in the provided executing scope.
  */
 void evaluate_logpoint(zend_execute_data *execute_data, stackdriver_debugger_logpoint_t *logpoint)
 {
-    zval *expression;
-    zend_string *m, *replaced;
+    zval *expression, *values = NULL;
+    zend_ulong i;
+    int j, num_expressions = zend_hash_num_elements(logpoint->expressions);
+    stackdriver_debugger_format_segment_t *segment;
+    smart_str m = {0};
 
     stackdriver_debugger_message_t *message = (stackdriver_debugger_message_t*)emalloc(sizeof(stackdriver_debugger_message_t));
     init_message(message);
@@ -144,35 +237,49 @@ void evaluate_logpoint(zend_execute_data *execute_data, stackdriver_debugger_log
     message->filename = zend_string_copy(logpoint->filename);
     message->lineno = logpoint->lineno;
     message->log_level = zend_string_copy(logpoint->log_level);
-    m = zend_string_copy(logpoint->format);
 
-    /* Evaluate logpoint message and store in message struct */
-    if (logpoint->expressions) {
-        int i;
+    /* Evaluate each expression once, UNDEF if evaluation fails */
+    if (num_expressions > 0) {
+        values = safe_emalloc(num_expressions, sizeof(zval), 0);
         ZEND_HASH_FOREACH_NUM_KEY_VAL(logpoint->expressions, i, expression) {
-            zval retval;
-
-            if (zend_eval_string(Z_STRVAL_P(expression), &retval, "expression evaluation") == SUCCESS) {
-                convert_to_string(&retval);
-
-                zend_string *regex = strpprintf(sizeof("/(?<!\\$)\\$/") + 2, "/(?<!\\$)\\$%d/", i);
-                replaced = REGEX_REPLACE_ALL(regex, m, &retval);
-                zend_string_release(m);
-                zend_string_release(regex);
-                m = replaced;
+            ZVAL_UNDEF(&values[i]);
+            if (evaluate_debugger_statement(Z_STR_P(expression), &values[i], "expression evaluation") == SUCCESS) {
+                convert_to_string(&values[i]);
             }
-            ZVAL_DESTRUCTOR(&retval);
         } ZEND_HASH_FOREACH_END();
     }
-    ZVAL_STR(&message->message, m);
+
+    /* Build the message from the parsed format in a single pass */
+    for (j = 0; j < logpoint->num_segments; j++) {
+        segment = &logpoint->segments[j];
+        if (segment->expression != -1 && Z_TYPE(values[segment->expression]) == IS_STRING) {
+            smart_str_append(&m, Z_STR(values[segment->expression]));
+        } else {
+            smart_str_appendl(&m, ZSTR_VAL(logpoint->format) + segment->offset, segment->length);
+        }
+    }
+    smart_str_0(&m);
+
+    if (values != NULL) {
+        for (j = 0; j < num_expressions; j++) {
+            zval_ptr_dtor(&values[j]);
+        }
+        efree(values);
+    }
+
+    if (m.s != NULL) {
+        ZVAL_STR(&message->message, m.s);
+    } else {
+        ZVAL_EMPTY_STRING(&message->message);
+    }
 
     if (Z_TYPE(logpoint->callback) != IS_NULL) {
-        if (handle_message_callback(&logpoint->callback, message) != SUCCESS) {
-            php_error_docref(NULL, E_WARNING, "Error running logpoint callback.");
+        if (handle_message_callback(logpoint, message) != SUCCESS) {
+            logpoint_callback_error();
         }
         if (EG(exception) != NULL) {
             zend_clear_exception();
-            php_error_docref(NULL, E_WARNING, "Error running logpoint callback.");
+            logpoint_callback_error();
         }
         destroy_message(message);
     } else {
@@ -187,6 +294,20 @@ void evaluate_logpoint(zend_execute_data *execute_data, stackdriver_debugger_log
 int register_logpoint(zend_string *logpoint_id, zend_string *filename,
     zend_long lineno, zend_string *log_level, zend_string *condition,
     zend_string *format, HashTable *expressions, zval *callback)
+{
+    return register_logpoint_ex(logpoint_id, filename, lineno, log_level,
+        condition, format, expressions, callback, 0);
+}
+
+/**
+ * Registers a logpoint for recording. If `validated` is set, the condition and
+ * expressions are known to be valid debugger statements and are not checked
+ * again.
+ */
+int register_logpoint_ex(zend_string *logpoint_id, zend_string *filename,
+    zend_long lineno, zend_string *log_level, zend_string *condition,
+    zend_string *format, HashTable *expressions, zval *callback,
+    zend_bool validated)
 {
     HashTable *logpoints;
     stackdriver_debugger_logpoint_t *logpoint;
@@ -204,7 +325,8 @@ int register_logpoint(zend_string *logpoint_id, zend_string *filename,
     logpoint->format = zend_string_copy(format);
     logpoint->log_level = zend_string_copy(log_level);
     if (condition != NULL && ZSTR_LEN(condition) > 0) {
-        if (valid_debugger_statement(condition) != SUCCESS) {
+        if (!validated && valid_debugger_statement(condition) != SUCCESS) {
+            destroy_logpoint(logpoint);
             return FAILURE;
         }
 
@@ -214,14 +336,18 @@ int register_logpoint(zend_string *logpoint_id, zend_string *filename,
         zval *expression;
 
         ZEND_HASH_FOREACH_VAL(expressions, expression) {
-            if (valid_debugger_statement(Z_STR_P(expression)) != SUCCESS) {
+            if (!validated && valid_debugger_statement(Z_STR_P(expression)) != SUCCESS) {
+                destroy_logpoint(logpoint);
                 return FAILURE;
             }
+            Z_TRY_ADDREF_P(expression);
             zend_hash_next_index_insert(logpoint->expressions, expression);
         } ZEND_HASH_FOREACH_END();
     }
-    if (callback != NULL) {
-        ZVAL_COPY(&logpoint->callback, callback);
+    parse_logpoint_format(logpoint);
+    if (callback != NULL && resolve_logpoint_callback(logpoint, callback) != SUCCESS) {
+        destroy_logpoint(logpoint);
+        return FAILURE;
     }
 
     logpoints = zend_hash_find_ptr(STACKDRIVER_DEBUGGER_G(logpoints_by_file), filename);
@@ -233,6 +359,7 @@ int register_logpoint(zend_string *logpoint_id, zend_string *filename,
     }
 
     zend_hash_next_index_insert_ptr(logpoints, logpoint);
+    stackdriver_debugger_probe_bind(STACKDRIVER_DEBUGGER_PROBE_LOGPOINT, logpoint->id, logpoint);
     zend_hash_update_ptr(STACKDRIVER_DEBUGGER_G(logpoints_by_id), logpoint->id, logpoint);
 
     return SUCCESS;
@@ -242,11 +369,12 @@ static void message_to_zval(zval *return_value, stackdriver_debugger_message_t *
 {
     array_init(return_value);
 
-    add_assoc_str(return_value, "filename", message->filename);
+    add_assoc_str(return_value, "filename", zend_string_copy(message->filename));
     add_assoc_long(return_value, "line", message->lineno);
+    Z_TRY_ADDREF(message->message);
     add_assoc_zval(return_value, "message", &message->message);
     add_assoc_long(return_value, "timestamp", message->timestamp);
-    add_assoc_str(return_value, "level", message->log_level);
+    add_assoc_str(return_value, "level", zend_string_copy(message->log_level));
 }
 
 /**
@@ -19,6 +19,19 @@
 
 #include "php.h"
 
+/*
+ * A piece of a parsed logpoint format string. Either a literal run of the
+ * format string or a placeholder for the value of an expression.
+ */
+typedef struct stackdriver_debugger_format_segment_t {
+    /* position of the segment's text within the format string */
+    size_t offset;
+    size_t length;
+
+    /* index of the expression to substitute, or -1 for a literal */
+    zend_long expression;
+} stackdriver_debugger_format_segment_t;
+
 typedef struct stackdriver_debugger_logpoint_t {
     zend_string *id;
     zend_string *filename;
@@ -29,6 +42,17 @@ typedef struct stackdriver_debugger_logpoint_t {
     zend_string *format;
     zval callback;
 
+    /* callable resolved at registration, reused on every hit */
+    zend_fcall_info callback_fci;
+    zend_fcall_info_cache callback_fcc;
+
+    /* ['filename' => ..., 'line' => ...] passed to the callback */
+    zval callback_context;
+
+    /* format string parsed at registration time */
+    stackdriver_debugger_format_segment_t *segments;
+    int num_segments;
+
     HashTable *expressions;
 } stackdriver_debugger_logpoint_t;
 
@@ -50,5 +74,9 @@ void list_logpoints(zval *return_value);
 int register_logpoint(zend_string *logpoint_id, zend_string *filename,
     zend_long lineno, zend_string *log_level, zend_string *condition,
     zend_string *format, HashTable *expressions, zval *callback);
+int register_logpoint_ex(zend_string *logpoint_id, zend_string *filename,
+    zend_long lineno, zend_string *log_level, zend_string *condition,
+    zend_string *format, HashTable *expressions, zval *callback,
+    zend_bool validated);
 
 #endif /* PHP_STACKDRIVER_DEBUGGER_LOGPOINT_H */
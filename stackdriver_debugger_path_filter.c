@@ -0,0 +1,124 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "php.h"
+#include "stackdriver_debugger_path_filter.h"
+
+/*
+ * Path filters decide which stackframes of a snapshot have their local
+ * variables captured. Include and exclude prefixes are compiled once, at
+ * registration, into a prefix trie so that each frame is matched with a
+ * single walk over its filename. The longest matching prefix wins, which
+ * allows e.g. excluding "vendor/" while including "vendor/acme/".
+ */
+
+/* Initialize an empty, allocated trie node */
+static void init_path_node(stackdriver_debugger_path_node_t *node, unsigned char c)
+{
+    node->c = c;
+    node->rule = STACKDRIVER_DEBUGGER_PATH_NONE;
+    node->children = NULL;
+    node->next = NULL;
+}
+
+/* Free the children of a trie node, recursively */
+static void destroy_path_children(stackdriver_debugger_path_node_t *node)
+{
+    stackdriver_debugger_path_node_t *child = node->children, *next;
+
+    while (child != NULL) {
+        next = child->next;
+        destroy_path_children(child);
+        efree(child);
+        child = next;
+    }
+}
+
+/* Create an empty path filter */
+stackdriver_debugger_path_filter_t *stackdriver_debugger_path_filter_create()
+{
+    stackdriver_debugger_path_filter_t *filter = emalloc(sizeof(stackdriver_debugger_path_filter_t));
+
+    init_path_node(&filter->root, 0);
+    filter->has_includes = 0;
+
+    return filter;
+}
+
+/**
+ * Add an include or exclude rule for paths starting with `prefix`. A later
+ * rule for the same prefix replaces the earlier one.
+ */
+void stackdriver_debugger_path_filter_add(stackdriver_debugger_path_filter_t *filter, const char *prefix, size_t len, unsigned char rule)
+{
+    stackdriver_debugger_path_node_t *node = &filter->root, *child;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)prefix[i];
+
+        for (child = node->children; child != NULL && child->c != c; child = child->next);
+        if (child == NULL) {
+            child = emalloc(sizeof(stackdriver_debugger_path_node_t));
+            init_path_node(child, c);
+            child->next = node->children;
+            node->children = child;
+        }
+        node = child;
+    }
+
+    node->rule = rule;
+    if (rule == STACKDRIVER_DEBUGGER_PATH_INCLUDE) {
+        filter->has_includes = 1;
+    }
+}
+
+/**
+ * Returns whether the local variables of a stackframe in the file `path`
+ * should be captured.
+ */
+zend_bool stackdriver_debugger_path_filter_match(stackdriver_debugger_path_filter_t *filter, zend_string *path)
+{
+    stackdriver_debugger_path_node_t *node = &filter->root, *child;
+    unsigned char rule = node->rule;
+    size_t i;
+
+    for (i = 0; i < ZSTR_LEN(path); i++) {
+        unsigned char c = (unsigned char)ZSTR_VAL(path)[i];
+
+        for (child = node->children; child != NULL && child->c != c; child = child->next);
+        if (child == NULL) {
+            break;
+        }
+        node = child;
+        if (node->rule != STACKDRIVER_DEBUGGER_PATH_NONE) {
+            rule = node->rule;
+        }
+    }
+
+    if (rule == STACKDRIVER_DEBUGGER_PATH_NONE) {
+        return !filter->has_includes;
+    }
+    return rule == STACKDRIVER_DEBUGGER_PATH_INCLUDE;
+}
+
+/* Cleanup a path filter including freeing memory */
+void stackdriver_debugger_path_filter_destroy(stackdriver_debugger_path_filter_t *filter)
+{
+    destroy_path_children(&filter->root);
+    efree(filter);
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef PHP_STACKDRIVER_DEBUGGER_PATH_FILTER_H
+#define PHP_STACKDRIVER_DEBUGGER_PATH_FILTER_H 1
+
+#include "php.h"
+
+#define STACKDRIVER_DEBUGGER_PATH_NONE 0
+#define STACKDRIVER_DEBUGGER_PATH_INCLUDE 1
+#define STACKDRIVER_DEBUGGER_PATH_EXCLUDE 2
+
+/* Byte-wise prefix trie node, children are kept in a sibling list */
+typedef struct stackdriver_debugger_path_node_t {
+    unsigned char c;
+
+    /* rule of the prefix ending at this node, STACKDRIVER_DEBUGGER_PATH_* */
+    unsigned char rule;
+
+    struct stackdriver_debugger_path_node_t *children;
+    struct stackdriver_debugger_path_node_t *next;
+} stackdriver_debugger_path_node_t;
+
+/* Include/exclude path prefix filter for captured stackframes */
+typedef struct stackdriver_debugger_path_filter_t {
+    stackdriver_debugger_path_node_t root;
+
+    /* if there are include rules, paths matching no rule are excluded */
+    zend_bool has_includes;
+} stackdriver_debugger_path_filter_t;
+
+stackdriver_debugger_path_filter_t *stackdriver_debugger_path_filter_create();
+void stackdriver_debugger_path_filter_add(stackdriver_debugger_path_filter_t *filter, const char *prefix, size_t len, unsigned char rule);
+zend_bool stackdriver_debugger_path_filter_match(stackdriver_debugger_path_filter_t *filter, zend_string *path);
+void stackdriver_debugger_path_filter_destroy(stackdriver_debugger_path_filter_t *filter);
+
+#endif /* PHP_STACKDRIVER_DEBUGGER_PATH_FILTER_H */
@@ -0,0 +1,269 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "php.h"
+#include "php_stackdriver_debugger.h"
+#include "stackdriver_debugger.h"
+#include "stackdriver_debugger_logpoint.h"
+#include "stackdriver_debugger_probe.h"
+#include "stackdriver_debugger_registry.h"
+#include "stackdriver_debugger_snapshot.h"
+#include "zend_vm_opcodes.h"
+
+/* True global for storing any previously installed ZEND_TICKS handler */
+static user_opcode_handler_t original_ticks_handler;
+
+/**
+ * Returns the probe code injected for the provided breakpoint. Breakpoint ids
+ * hash the same in every process, so the code does too.
+ */
+zend_long stackdriver_debugger_probe_code(int kind, zend_string *breakpoint_id)
+{
+    zend_long code = zend_string_hash_val(breakpoint_id) & STACKDRIVER_DEBUGGER_PROBE_HASH_MASK;
+
+    if (kind == STACKDRIVER_DEBUGGER_PROBE_LOGPOINT) {
+        code |= STACKDRIVER_DEBUGGER_PROBE_LOGPOINT_BIT;
+    }
+    return code;
+}
+
+/* Returns the id of the provided breakpoint registered for the probe code */
+static zend_string *bound_breakpoint_id(zend_long code, void *breakpoint)
+{
+    if (code & STACKDRIVER_DEBUGGER_PROBE_LOGPOINT_BIT) {
+        return ((stackdriver_debugger_logpoint_t *)breakpoint)->id;
+    }
+    return ((stackdriver_debugger_snapshot_t *)breakpoint)->id;
+}
+
+/* Returns the file of the provided breakpoint registered for the probe code */
+static zend_string *bound_breakpoint_filename(zend_long code, void *breakpoint)
+{
+    if (code & STACKDRIVER_DEBUGGER_PROBE_LOGPOINT_BIT) {
+        return ((stackdriver_debugger_logpoint_t *)breakpoint)->filename;
+    }
+    return ((stackdriver_debugger_snapshot_t *)breakpoint)->filename;
+}
+
+/**
+ * Bind the breakpoint being registered to its probe slot for the current
+ * request so that probes can find it with an indexed load. This must be
+ * called before the breakpoint replaces any breakpoint with the same id. If
+ * another code or a breakpoint with another id is bound to the slot already,
+ * the slot is marked as shared and probes search for their breakpoint.
+ */
+void stackdriver_debugger_probe_bind(int kind, zend_string *breakpoint_id, void *breakpoint)
+{
+    zend_long code = stackdriver_debugger_probe_code(kind, breakpoint_id);
+    stackdriver_debugger_probe_slot_t *slot = &STACKDRIVER_DEBUGGER_G(probe_slots)[code & STACKDRIVER_DEBUGGER_PROBE_SLOT_MASK];
+
+    STACKDRIVER_DEBUGGER_G(probes_bound) = 1;
+
+    /* a slot only remembering a lookup that found nothing is free */
+    if (slot->generation == STACKDRIVER_DEBUGGER_G(probe_generation) && (slot->shared || slot->breakpoint != NULL)) {
+        if (slot->shared) {
+            return;
+        }
+        if (slot->code != code || !zend_string_equals(bound_breakpoint_id(slot->code, slot->breakpoint), breakpoint_id)) {
+            slot->shared = 1;
+            slot->breakpoint = NULL;
+            return;
+        }
+    }
+
+    slot->generation = STACKDRIVER_DEBUGGER_G(probe_generation);
+    slot->shared = 0;
+    slot->code = code;
+    slot->breakpoint = breakpoint;
+    slot->filename = NULL;
+}
+
+/**
+ * Search all breakpoints registered in the current request for the one with
+ * the provided probe code in the provided file. Only used for shared slots.
+ */
+static void *search_breakpoint(zend_long code, zend_string *filename)
+{
+    stackdriver_debugger_snapshot_t *snapshot;
+    stackdriver_debugger_logpoint_t *logpoint;
+
+    if (code & STACKDRIVER_DEBUGGER_PROBE_LOGPOINT_BIT) {
+        ZEND_HASH_FOREACH_PTR(STACKDRIVER_DEBUGGER_G(logpoints_by_id), logpoint) {
+            if (stackdriver_debugger_probe_code(STACKDRIVER_DEBUGGER_PROBE_LOGPOINT, logpoint->id) == code &&
+                zend_string_equals(logpoint->filename, filename)) {
+                return logpoint;
+            }
+        } ZEND_HASH_FOREACH_END();
+    } else {
+        ZEND_HASH_FOREACH_PTR(STACKDRIVER_DEBUGGER_G(snapshots_by_id), snapshot) {
+            if (stackdriver_debugger_probe_code(STACKDRIVER_DEBUGGER_PROBE_SNAPSHOT, snapshot->id) == code &&
+                zend_string_equals(snapshot->filename, filename)) {
+                return snapshot;
+            }
+        } ZEND_HASH_FOREACH_END();
+    }
+
+    return NULL;
+}
+
+/**
+ * Find the breakpoint for the probe code, registering it from the breakpoint
+ * registry on its first hit in this request if it is not registered yet.
+ *
+ * Slots bound in earlier requests are stale and never dereferenced. The code
+ * does not identify the file, so the breakpoint must also be for the file
+ * being executed. A lookup that finds nothing is remembered in the probe's
+ * slot if the slot is free, so probes without a breakpoint only pay for the
+ * search once per request.
+ */
+static void *find_breakpoint(zend_long code, zend_string *filename)
+{
+    stackdriver_debugger_probe_slot_t *slot = &STACKDRIVER_DEBUGGER_G(probe_slots)[code & STACKDRIVER_DEBUGGER_PROBE_SLOT_MASK];
+    zend_bool current = slot->generation == STACKDRIVER_DEBUGGER_G(probe_generation);
+    void *breakpoint = NULL;
+
+    if (current && !slot->shared && slot->code == code) {
+        if (slot->breakpoint == NULL) {
+            if (slot->filename == filename) {
+                return NULL;
+            }
+        } else if (zend_string_equals(bound_breakpoint_filename(code, slot->breakpoint), filename)) {
+            return slot->breakpoint;
+        }
+    }
+
+    if (current && slot->shared) {
+        breakpoint = search_breakpoint(code, filename);
+    }
+    if (breakpoint == NULL && STACKDRIVER_DEBUGGER_G(registry_breakpoints)) {
+        breakpoint = stackdriver_debugger_registry_find(code, filename);
+    }
+
+    /* registering a breakpoint from the registry may have bound the slot */
+    if (breakpoint == NULL && (slot->generation != STACKDRIVER_DEBUGGER_G(probe_generation) ||
+        (!slot->shared && slot->breakpoint == NULL))) {
+        slot->generation = STACKDRIVER_DEBUGGER_G(probe_generation);
+        slot->shared = 0;
+        slot->code = code;
+        slot->breakpoint = NULL;
+        slot->filename = filename;
+    }
+    return breakpoint;
+}
+
+/**
+ * Handler for ZEND_TICKS. Ticks emitted by our injected probes trigger the
+ * breakpoint for the probe's code. Any other ticks are passed along to the
+ * previously installed handler or the engine.
+ */
+static int stackdriver_debugger_ticks_handler(zend_execute_data *execute_data)
+{
+    const zend_op *opline = EX(opline);
+    zend_long code;
+    void *breakpoint;
+
+    if (!(opline->extended_value & STACKDRIVER_DEBUGGER_PROBE_FLAG)) {
+        if (original_ticks_handler) {
+            return original_ticks_handler(execute_data);
+        }
+        return ZEND_USER_OPCODE_DISPATCH;
+    }
+
+    /* cached probes are a no-op in requests without any breakpoints */
+    if (!STACKDRIVER_DEBUGGER_G(probes_bound) && !STACKDRIVER_DEBUGGER_G(registry_breakpoints)) {
+        EX(opline)++;
+        return ZEND_USER_OPCODE_CONTINUE;
+    }
+
+    code = opline->extended_value & ~STACKDRIVER_DEBUGGER_PROBE_FLAG;
+    breakpoint = find_breakpoint(code, EX(func)->op_array.filename);
+
+    if (breakpoint != NULL) {
+        if (code & STACKDRIVER_DEBUGGER_PROBE_LOGPOINT_BIT) {
+            stackdriver_debugger_logpoint_hit(execute_data, breakpoint);
+        } else {
+            stackdriver_debugger_snapshot_hit(execute_data, breakpoint);
+        }
+    }
+
+    EX(opline)++;
+    return ZEND_USER_OPCODE_CONTINUE;
+}
+
+/**
+ * Module initialization lifecycle hook. Installs our ZEND_TICKS handler. This
+ * must happen before any code is compiled.
+ */
+int stackdriver_debugger_probe_minit(INIT_FUNC_ARGS)
+{
+    original_ticks_handler = zend_get_user_opcode_handler(ZEND_TICKS);
+    zend_set_user_opcode_handler(ZEND_TICKS, stackdriver_debugger_ticks_handler);
+
+    return SUCCESS;
+}
+
+/**
+ * Module shutdown lifecycle hook. Restores the original ZEND_TICKS handler and
+ * frees the probe slots of the current thread.
+ */
+int stackdriver_debugger_probe_mshutdown(SHUTDOWN_FUNC_ARGS)
+{
+    zend_set_user_opcode_handler(ZEND_TICKS, original_ticks_handler);
+#ifndef ZTS
+    stackdriver_debugger_probe_globals_dtor(&stackdriver_debugger_globals);
+#endif
+
+    return SUCCESS;
+}
+
+/**
+ * Allocate the probe slots of a thread's globals. Generation 0 is never
+ * current, so all slots start out stale.
+ */
+void stackdriver_debugger_probe_globals_ctor(zend_stackdriver_debugger_globals *globals)
+{
+    globals->probe_slots = pecalloc(STACKDRIVER_DEBUGGER_PROBE_SLOTS, sizeof(stackdriver_debugger_probe_slot_t), 1);
+    globals->probe_generation = 0;
+}
+
+/**
+ * Free the probe slots of a thread's globals, if not already freed.
+ */
+void stackdriver_debugger_probe_globals_dtor(zend_stackdriver_debugger_globals *globals)
+{
+    if (globals->probe_slots != NULL) {
+        pefree(globals->probe_slots, 1);
+        globals->probe_slots = NULL;
+    }
+}
+
+/**
+ * Request initialization lifecycle hook. Starts a new request generation,
+ * which makes all slots bound in previous requests stale without clearing
+ * them.
+ */
+int stackdriver_debugger_probe_rinit(TSRMLS_D)
+{
+    STACKDRIVER_DEBUGGER_G(probe_generation)++;
+    if (STACKDRIVER_DEBUGGER_G(probe_generation) == 0) {
+        /* 0 is reserved for slots which have never been bound */
+        STACKDRIVER_DEBUGGER_G(probe_generation)++;
+    }
+    STACKDRIVER_DEBUGGER_G(probes_bound) = 0;
+
+    return SUCCESS;
+}
+
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PHP_STACKDRIVER_DEBUGGER_PROBE_H
+#define PHP_STACKDRIVER_DEBUGGER_PROBE_H 1
+
+#include "php.h"
+#include "php_stackdriver_debugger.h"
+
+#define STACKDRIVER_DEBUGGER_PROBE_SNAPSHOT 1
+#define STACKDRIVER_DEBUGGER_PROBE_LOGPOINT 2
+
+/*
+ * Injected probes are `declare(ticks=N)` statements. Our probes set this flag
+ * in N so they can be told apart from user code using ticks. The remaining
+ * bits are the probe's code: a kind bit and a hash of the breakpoint id. The
+ * code only depends on the breakpoint, so compiled code shared through opcache
+ * means the same in every process.
+ */
+#define STACKDRIVER_DEBUGGER_PROBE_FLAG 0x40000000
+#define STACKDRIVER_DEBUGGER_PROBE_LOGPOINT_BIT 0x20000000
+#define STACKDRIVER_DEBUGGER_PROBE_HASH_MASK 0x1fffffff
+
+/* number of probe slots per thread, must be a power of 2 */
+#define STACKDRIVER_DEBUGGER_PROBE_SLOTS 256
+#define STACKDRIVER_DEBUGGER_PROBE_SLOT_MASK (STACKDRIVER_DEBUGGER_PROBE_SLOTS - 1)
+
+/*
+ * Breakpoint registered for a probe slot. A probe's slot is given by the low
+ * bits of its code.
+ */
+typedef struct stackdriver_debugger_probe_slot_t {
+    /* request generation the slot was bound in, stale otherwise */
+    uint32_t generation;
+
+    /* whether several codes or breakpoints were bound to the slot */
+    zend_bool shared;
+
+    zend_long code;
+
+    /*
+     * stackdriver_debugger_snapshot_t or stackdriver_debugger_logpoint_t, or
+     * NULL if a lookup for the code found nothing
+     */
+    void *breakpoint;
+
+    /* file of the probe whose lookup found nothing, only compared by address */
+    zend_string *filename;
+} stackdriver_debugger_probe_slot_t;
+
+zend_long stackdriver_debugger_probe_code(int kind, zend_string *breakpoint_id);
+void stackdriver_debugger_probe_bind(int kind, zend_string *breakpoint_id, void *breakpoint);
+/* module lifecycle callbacks */
+void stackdriver_debugger_probe_globals_ctor(zend_stackdriver_debugger_globals *globals);
+void stackdriver_debugger_probe_globals_dtor(zend_stackdriver_debugger_globals *globals);
+int stackdriver_debugger_probe_minit(INIT_FUNC_ARGS);
+int stackdriver_debugger_probe_mshutdown(SHUTDOWN_FUNC_ARGS);
+/* request lifecycle callbacks */
+int stackdriver_debugger_probe_rinit(TSRMLS_D);
+
+#endif /* PHP_STACKDRIVER_DEBUGGER_PROBE_H */
@@ -0,0 +1,905 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "php.h"
+#include "php_stackdriver_debugger.h"
+#include "stackdriver_debugger.h"
+#include "stackdriver_debugger_ast.h"
+#include "stackdriver_debugger_logpoint.h"
+#include "stackdriver_debugger_probe.h"
+#include "stackdriver_debugger_registry.h"
+#include "stackdriver_debugger_shared.h"
+#include "stackdriver_debugger_snapshot.h"
+
+#include "zend_smart_str.h"
+
+#ifndef PHP_WIN32
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Smallest possible record: type, line and four empty strings or counts */
+#define STACKDRIVER_DEBUGGER_REGISTRY_MIN_RECORD_SIZE (6 * sizeof(uint32_t))
+
+/* Read-only mapping of the registry file, kept between requests */
+typedef struct stackdriver_debugger_registry_map_t {
+    char *addr;
+    size_t size;
+
+    /* identity of the mapped file, a rewrite replaces the file */
+    dev_t device;
+    ino_t inode;
+    time_t mtime;
+} stackdriver_debugger_registry_map_t;
+
+/*
+ * A breakpoint parsed from the registry. Entries are kept between requests in
+ * persistent memory and are only turned into request breakpoints when their
+ * probe is hit, without parsing or validating them again.
+ */
+typedef struct stackdriver_debugger_registry_entry_t {
+    uint32_t type;
+    zend_long lineno;
+    zend_string *id;
+    zend_string *filename;
+    zend_string *condition;
+    zend_string *log_level;
+    zend_string *format;
+
+    /* index => persistent string */
+    HashTable expressions;
+
+    /* whether the statements are valid debugger statements in this process */
+    zend_bool valid;
+
+    /* probe code injected for this breakpoint */
+    zend_long code;
+
+    /* index of the next entry for the same file, or the entry count */
+    uint32_t next_in_file;
+} stackdriver_debugger_registry_entry_t;
+
+/* The breakpoints of the currently mapped registry generation */
+typedef struct stackdriver_debugger_registry_set_t {
+    zend_bool loaded;
+    uint64_t generation;
+    dev_t device;
+    ino_t inode;
+    time_t mtime;
+
+    stackdriver_debugger_registry_entry_t *entries;
+    uint32_t count;
+
+    /* map of filename -> index of the file's first entry */
+    HashTable by_file;
+} stackdriver_debugger_registry_set_t;
+
+/*
+ * Registry state of one thread. The mapping and the parsed set, including
+ * their persistent strings, are never shared between threads.
+ */
+typedef struct stackdriver_debugger_registry_t {
+    stackdriver_debugger_registry_map_t map;
+    stackdriver_debugger_registry_set_t set;
+} stackdriver_debugger_registry_t;
+
+/* Cursor over the records of the mapped registry */
+typedef struct stackdriver_debugger_registry_reader_t {
+    const char *pos;
+    const char *end;
+} stackdriver_debugger_registry_reader_t;
+
+#define REGISTRY_MAP (STACKDRIVER_DEBUGGER_G(registry)->map)
+#define REGISTRY_SET (STACKDRIVER_DEBUGGER_G(registry)->set)
+
+static void unmap_registry_ex(stackdriver_debugger_registry_map_t *map)
+{
+    if (map->addr != NULL) {
+        munmap(map->addr, map->size);
+    }
+    memset(map, 0, sizeof(stackdriver_debugger_registry_map_t));
+}
+
+static void unmap_registry()
+{
+    unmap_registry_ex(&REGISTRY_MAP);
+}
+
+/**
+ * Map the registry file at the provided path, reusing the current mapping if
+ * the file has not been replaced since. Returns FAILURE if there is no valid
+ * registry at the path.
+ */
+static int map_registry(const char *path)
+{
+    zend_stat_t sb;
+    int fd;
+    void *addr;
+    stackdriver_debugger_registry_header_t *header;
+
+    if (VCWD_STAT(path, &sb) != 0) {
+        unmap_registry();
+        return FAILURE;
+    }
+
+    if (REGISTRY_MAP.addr != NULL && REGISTRY_MAP.device == sb.st_dev &&
+        REGISTRY_MAP.inode == sb.st_ino && REGISTRY_MAP.mtime == sb.st_mtime &&
+        REGISTRY_MAP.size == (size_t)sb.st_size) {
+        return SUCCESS;
+    }
+
+    unmap_registry();
+    if ((size_t)sb.st_size < sizeof(stackdriver_debugger_registry_header_t)) {
+        return FAILURE;
+    }
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return FAILURE;
+    }
+    addr = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        return FAILURE;
+    }
+
+    header = (stackdriver_debugger_registry_header_t *)addr;
+    if (memcmp(header->magic, STACKDRIVER_DEBUGGER_REGISTRY_MAGIC, 4) != 0 ||
+        header->version != STACKDRIVER_DEBUGGER_REGISTRY_VERSION ||
+        header->size > (size_t)sb.st_size) {
+        munmap(addr, sb.st_size);
+        return FAILURE;
+    }
+
+    REGISTRY_MAP.addr = addr;
+    REGISTRY_MAP.size = sb.st_size;
+    REGISTRY_MAP.device = sb.st_dev;
+    REGISTRY_MAP.inode = sb.st_ino;
+    REGISTRY_MAP.mtime = sb.st_mtime;
+    return SUCCESS;
+}
+
+static int read_uint32(stackdriver_debugger_registry_reader_t *reader, uint32_t *value)
+{
+    if (reader->end - reader->pos < (ptrdiff_t)sizeof(uint32_t)) {
+        return FAILURE;
+    }
+    memcpy(value, reader->pos, sizeof(uint32_t));
+    reader->pos += sizeof(uint32_t);
+    return SUCCESS;
+}
+
+/* Read a length prefixed string into a persistent string, NULL if empty */
+static int read_string(stackdriver_debugger_registry_reader_t *reader, zend_string **value)
+{
+    uint32_t len;
+
+    if (read_uint32(reader, &len) != SUCCESS || (size_t)(reader->end - reader->pos) < len) {
+        return FAILURE;
+    }
+    *value = len > 0 ? zend_string_init(reader->pos, len, 1) : NULL;
+    reader->pos += len;
+    return SUCCESS;
+}
+
+static void destroy_entry(stackdriver_debugger_registry_entry_t *entry)
+{
+    if (entry->id) {
+        zend_string_release(entry->id);
+    }
+    if (entry->filename) {
+        zend_string_release(entry->filename);
+    }
+    if (entry->condition) {
+        zend_string_release(entry->condition);
+    }
+    if (entry->log_level) {
+        zend_string_release(entry->log_level);
+    }
+    if (entry->format) {
+        zend_string_release(entry->format);
+    }
+    zend_hash_destroy(&entry->expressions);
+}
+
+static void free_registry_set_ex(stackdriver_debugger_registry_set_t *set)
+{
+    uint32_t i;
+
+    for (i = 0; i < set->count; i++) {
+        destroy_entry(&set->entries[i]);
+    }
+    if (set->entries != NULL) {
+        pefree(set->entries, 1);
+    }
+    if (set->loaded) {
+        zend_hash_destroy(&set->by_file);
+    }
+    memset(set, 0, sizeof(stackdriver_debugger_registry_set_t));
+}
+
+static void free_registry_set()
+{
+    free_registry_set_ex(&REGISTRY_SET);
+}
+
+/**
+ * Parse the next record of the registry into the provided entry. The entry
+ * must be destroyed even if parsing fails.
+ */
+static int parse_entry(stackdriver_debugger_registry_reader_t *reader, stackdriver_debugger_registry_entry_t *entry)
+{
+    uint32_t lineno, num_expressions, i;
+    zend_string *statement;
+    zval expression, *zv;
+
+    memset(entry, 0, sizeof(stackdriver_debugger_registry_entry_t));
+    zend_hash_init(&entry->expressions, 4, NULL, ZVAL_INTERNAL_PTR_DTOR, 1);
+
+    if (read_uint32(reader, &entry->type) != SUCCESS ||
+        read_uint32(reader, &lineno) != SUCCESS ||
+        read_string(reader, &entry->id) != SUCCESS ||
+        read_string(reader, &entry->filename) != SUCCESS ||
+        read_string(reader, &entry->condition) != SUCCESS ||
+        read_uint32(reader, &num_expressions) != SUCCESS) {
+        return FAILURE;
+    }
+    entry->lineno = lineno;
+
+    for (i = 0; i < num_expressions; i++) {
+        if (read_string(reader, &statement) != SUCCESS) {
+            return FAILURE;
+        }
+        if (statement == NULL) {
+            ZVAL_EMPTY_STRING(&expression);
+        } else {
+            ZVAL_STR(&expression, statement);
+        }
+        zend_hash_next_index_insert(&entry->expressions, &expression);
+    }
+
+    if (entry->type == STACKDRIVER_DEBUGGER_REGISTRY_LOGPOINT) {
+        if (read_string(reader, &entry->log_level) != SUCCESS ||
+            read_string(reader, &entry->format) != SUCCESS) {
+            return FAILURE;
+        }
+    } else if (entry->type != STACKDRIVER_DEBUGGER_REGISTRY_SNAPSHOT) {
+        return FAILURE;
+    }
+
+    if (entry->id == NULL || entry->filename == NULL) {
+        return FAILURE;
+    }
+
+    /* The function whitelist of this process may differ from the writer's */
+    entry->valid = entry->condition == NULL || valid_debugger_statement(entry->condition) == SUCCESS;
+    ZEND_HASH_FOREACH_VAL(&entry->expressions, zv) {
+        if (entry->valid && valid_debugger_statement(Z_STR_P(zv)) != SUCCESS) {
+            entry->valid = 0;
+        }
+    } ZEND_HASH_FOREACH_END();
+
+    entry->code = stackdriver_debugger_probe_code(
+        entry->type == STACKDRIVER_DEBUGGER_REGISTRY_LOGPOINT ? STACKDRIVER_DEBUGGER_PROBE_LOGPOINT : STACKDRIVER_DEBUGGER_PROBE_SNAPSHOT,
+        entry->id);
+
+    return SUCCESS;
+}
+
+/**
+ * Index the valid entries of the current set by file and make sure each of
+ * them will be injected. This only runs when a new set is loaded.
+ */
+static void index_registry_set()
+{
+    stackdriver_debugger_registry_entry_t *entry;
+    zval *head, index;
+    uint32_t i;
+
+    for (i = REGISTRY_SET.count; i-- > 0; ) {
+        entry = &REGISTRY_SET.entries[i];
+        if (!entry->valid) {
+            continue;
+        }
+
+        head = zend_hash_find(&REGISTRY_SET.by_file, entry->filename);
+        entry->next_in_file = head != NULL ? (uint32_t)Z_LVAL_P(head) : REGISTRY_SET.count;
+        ZVAL_LONG(&index, i);
+        zend_hash_update(&REGISTRY_SET.by_file, entry->filename, &index);
+    }
+
+    for (i = 0; i < REGISTRY_SET.count; i++) {
+        if (REGISTRY_SET.entries[i].valid) {
+            stackdriver_debugger_ensure_injected(REGISTRY_SET.entries[i].filename, REGISTRY_SET.entries[i].id);
+        }
+    }
+}
+
+/* Returns the index of the provided file's first entry, or the entry count */
+static uint32_t first_entry_in_file(zend_string *filename)
+{
+    zval *head;
+
+    if (!REGISTRY_SET.loaded || (head = zend_hash_find(&REGISTRY_SET.by_file, filename)) == NULL) {
+        return REGISTRY_SET.count;
+    }
+    return (uint32_t)Z_LVAL_P(head);
+}
+
+/* Collect the ids of the snapshots in the current set */
+static void collect_snapshot_ids(HashTable *ids)
+{
+    uint32_t i;
+
+    zend_hash_init(ids, 8, NULL, NULL, 0);
+    for (i = 0; i < REGISTRY_SET.count; i++) {
+        if (REGISTRY_SET.entries[i].type == STACKDRIVER_DEBUGGER_REGISTRY_SNAPSHOT) {
+            zend_hash_add_empty_element(ids, REGISTRY_SET.entries[i].id);
+        }
+    }
+}
+
+/**
+ * Release the claims on the provided snapshot ids which are no longer in the
+ * current set, so that they are captured again if they are added back.
+ */
+static void release_removed_snapshots(HashTable *ids)
+{
+    zend_string *id;
+    uint32_t i;
+
+    for (i = 0; i < REGISTRY_SET.count; i++) {
+        if (REGISTRY_SET.entries[i].type == STACKDRIVER_DEBUGGER_REGISTRY_SNAPSHOT) {
+            zend_hash_del(ids, REGISTRY_SET.entries[i].id);
+        }
+    }
+
+    ZEND_HASH_FOREACH_STR_KEY(ids, id) {
+        stackdriver_debugger_release_snapshot(id);
+    } ZEND_HASH_FOREACH_END();
+    zend_hash_destroy(ids);
+}
+
+/**
+ * Make sure the breakpoint set matches the registry at the provided path.
+ * While the registry's generation is unchanged, the set parsed for an earlier
+ * request is reused as is.
+ */
+static int load_registry_set(const char *path)
+{
+    stackdriver_debugger_registry_header_t *header;
+    stackdriver_debugger_registry_reader_t reader;
+    HashTable removed;
+    uint32_t i;
+
+    if (map_registry(path) != SUCCESS) {
+        collect_snapshot_ids(&removed);
+        free_registry_set();
+        release_removed_snapshots(&removed);
+        return FAILURE;
+    }
+
+    header = (stackdriver_debugger_registry_header_t *)REGISTRY_MAP.addr;
+    if (REGISTRY_SET.loaded && REGISTRY_SET.generation == header->generation &&
+        REGISTRY_SET.device == REGISTRY_MAP.device && REGISTRY_SET.inode == REGISTRY_MAP.inode &&
+        REGISTRY_SET.mtime == REGISTRY_MAP.mtime) {
+        return SUCCESS;
+    }
+
+    collect_snapshot_ids(&removed);
+    free_registry_set();
+    REGISTRY_SET.loaded = 1;
+    zend_hash_init(&REGISTRY_SET.by_file, 8, NULL, NULL, 1);
+    REGISTRY_SET.generation = header->generation;
+    REGISTRY_SET.device = REGISTRY_MAP.device;
+    REGISTRY_SET.inode = REGISTRY_MAP.inode;
+    REGISTRY_SET.mtime = REGISTRY_MAP.mtime;
+
+    if (header->count == 0) {
+        release_removed_snapshots(&removed);
+        return SUCCESS;
+    }
+    if (header->count > header->size / STACKDRIVER_DEBUGGER_REGISTRY_MIN_RECORD_SIZE) {
+        php_error_docref(NULL, E_WARNING, "Breakpoint registry %s is corrupt.", path);
+        release_removed_snapshots(&removed);
+        return SUCCESS;
+    }
+
+    REGISTRY_SET.entries = pemalloc(sizeof(stackdriver_debugger_registry_entry_t) * header->count, 1);
+    reader.pos = REGISTRY_MAP.addr + sizeof(stackdriver_debugger_registry_header_t);
+    reader.end = REGISTRY_MAP.addr + header->size;
+
+    for (i = 0; i < header->count; i++) {
+        REGISTRY_SET.count++;
+        if (parse_entry(&reader, &REGISTRY_SET.entries[i]) != SUCCESS) {
+            /* keep the entries before the corrupt record */
+            destroy_entry(&REGISTRY_SET.entries[i]);
+            REGISTRY_SET.count--;
+            php_error_docref(NULL, E_WARNING, "Breakpoint registry %s is corrupt.", path);
+            break;
+        }
+    }
+
+    index_registry_set();
+    release_removed_snapshots(&removed);
+    return SUCCESS;
+}
+
+/* Returns a request copy of the provided persistent string, NULL stays NULL */
+static zend_string *request_string(zend_string *str)
+{
+    return str != NULL ? zend_string_init(ZSTR_VAL(str), ZSTR_LEN(str), 0) : NULL;
+}
+
+static void release_request_string(zend_string *str)
+{
+    if (str != NULL) {
+        zend_string_release(str);
+    }
+}
+
+/**
+ * Register the provided entry as a breakpoint of the current request. The
+ * request breakpoint only holds request copies of the entry's strings, so
+ * request code never changes the refcount of the persistent ones.
+ */
+static void *materialize_entry(stackdriver_debugger_registry_entry_t *entry)
+{
+    zend_string *id = request_string(entry->id);
+    zend_string *filename = request_string(entry->filename);
+    zend_string *condition = request_string(entry->condition);
+    zend_string *log_level, *format;
+    HashTable expressions;
+    zval *zv, expression;
+    void *breakpoint = NULL;
+
+    zend_hash_init(&expressions, zend_hash_num_elements(&entry->expressions), NULL, ZVAL_PTR_DTOR, 0);
+    ZEND_HASH_FOREACH_VAL(&entry->expressions, zv) {
+        ZVAL_STR(&expression, request_string(Z_STR_P(zv)));
+        zend_hash_next_index_insert(&expressions, &expression);
+    } ZEND_HASH_FOREACH_END();
+
+    if (entry->type == STACKDRIVER_DEBUGGER_REGISTRY_LOGPOINT) {
+        log_level = entry->log_level ? request_string(entry->log_level) : ZSTR_EMPTY_ALLOC();
+        format = entry->format ? request_string(entry->format) : ZSTR_EMPTY_ALLOC();
+        if (register_logpoint_ex(id, filename, entry->lineno, log_level, condition, format,
+            &expressions, NULL, 1) == SUCCESS) {
+            breakpoint = zend_hash_find_ptr(STACKDRIVER_DEBUGGER_G(logpoints_by_id), id);
+        }
+        zend_string_release(log_level);
+        zend_string_release(format);
+    } else if (register_snapshot_ex(id, filename, entry->lineno, condition, &expressions,
+        NULL, 0, NULL, NULL, NULL, 1) == SUCCESS) {
+        breakpoint = zend_hash_find_ptr(STACKDRIVER_DEBUGGER_G(snapshots_by_id), id);
+    }
+
+    zend_hash_destroy(&expressions);
+    release_request_string(condition);
+    zend_string_release(filename);
+    zend_string_release(id);
+    return breakpoint;
+}
+
+/* Returns whether a breakpoint with the entry's id is registered this request */
+static zend_bool registered_in_request(stackdriver_debugger_registry_entry_t *entry)
+{
+    if (entry->type == STACKDRIVER_DEBUGGER_REGISTRY_LOGPOINT) {
+        return zend_hash_exists(STACKDRIVER_DEBUGGER_G(logpoints_by_id), entry->id);
+    }
+    return zend_hash_exists(STACKDRIVER_DEBUGGER_G(snapshots_by_id), entry->id);
+}
+
+static void write_uint32(smart_str *buf, uint32_t value)
+{
+    smart_str_appendl(buf, (const char *)&value, sizeof(uint32_t));
+}
+
+static void write_string(smart_str *buf, zend_string *value)
+{
+    if (value == NULL) {
+        write_uint32(buf, 0);
+        return;
+    }
+    write_uint32(buf, (uint32_t)ZSTR_LEN(value));
+    smart_str_append(buf, value);
+}
+
+/* Append a record in the format described by the registry header */
+static void write_record(smart_str *buf, uint32_t type, zend_long lineno,
+    zend_string *id, zend_string *filename, zend_string *condition,
+    HashTable *expressions, zend_string *log_level, zend_string *format)
+{
+    zval *expression;
+
+    write_uint32(buf, type);
+    write_uint32(buf, (uint32_t)lineno);
+    write_string(buf, id);
+    write_string(buf, filename);
+    write_string(buf, condition);
+    if (expressions != NULL) {
+        write_uint32(buf, zend_hash_num_elements(expressions));
+        ZEND_HASH_FOREACH_VAL(expressions, expression) {
+            write_string(buf, Z_STR_P(expression));
+        } ZEND_HASH_FOREACH_END();
+    } else {
+        write_uint32(buf, 0);
+    }
+    if (type == STACKDRIVER_DEBUGGER_REGISTRY_LOGPOINT) {
+        write_string(buf, log_level);
+        write_string(buf, format);
+    }
+}
+
+/* Returns the string stored at `key`, or NULL if it is missing or not a string */
+static zend_string *find_string(HashTable *ht, const char *key)
+{
+    zval *zv = zend_hash_str_find(ht, key, strlen(key));
+    if (zv == NULL || Z_TYPE_P(zv) != IS_STRING) {
+        return NULL;
+    }
+    return Z_STR_P(zv);
+}
+
+/**
+ * Append the record for the provided breakpoint array to the registry. The
+ * breakpoint's statements are validated so that workers only ever load valid
+ * breakpoints.
+ */
+static int write_breakpoint(smart_str *buf, zval *breakpoint)
+{
+    HashTable *ht, *expressions = NULL;
+    zend_string *type, *id, *filename, *condition, *log_level = NULL, *format = NULL;
+    zval *zv, *expression;
+    zend_long lineno;
+    uint32_t record_type = STACKDRIVER_DEBUGGER_REGISTRY_SNAPSHOT;
+
+    if (Z_TYPE_P(breakpoint) != IS_ARRAY) {
+        php_error_docref(NULL, E_WARNING, "Breakpoints must be arrays.");
+        return FAILURE;
+    }
+    ht = Z_ARRVAL_P(breakpoint);
+
+    id = find_string(ht, "id");
+    filename = find_string(ht, "filename");
+    zv = zend_hash_str_find(ht, "line", strlen("line"));
+    if (id == NULL || ZSTR_LEN(id) == 0 || filename == NULL || zv == NULL || Z_TYPE_P(zv) != IS_LONG) {
+        php_error_docref(NULL, E_WARNING, "Breakpoints require an id, filename and line.");
+        return FAILURE;
+    }
+    lineno = Z_LVAL_P(zv);
+
+    if (!IS_ABSOLUTE_PATH(ZSTR_VAL(filename), ZSTR_LEN(filename))) {
+        php_error_docref(NULL, E_WARNING, "Breakpoint filename '%s' must be an absolute path.", ZSTR_VAL(filename));
+        return FAILURE;
+    }
+
+    type = find_string(ht, "type");
+    if (type != NULL && zend_string_equals_literal(type, "logpoint")) {
+        record_type = STACKDRIVER_DEBUGGER_REGISTRY_LOGPOINT;
+        log_level = find_string(ht, "logLevel");
+        format = find_string(ht, "format");
+        if (log_level == NULL || format == NULL) {
+            php_error_docref(NULL, E_WARNING, "Logpoints require a logLevel and format.");
+            return FAILURE;
+        }
+    } else if (type != NULL && !zend_string_equals_literal(type, "snapshot")) {
+        php_error_docref(NULL, E_WARNING, "Unknown breakpoint type '%s'.", ZSTR_VAL(type));
+        return FAILURE;
+    }
+
+    condition = find_string(ht, "condition");
+    if (condition != NULL && ZSTR_LEN(condition) > 0 && valid_debugger_statement(condition) != SUCCESS) {
+        return FAILURE;
+    }
+
+    zv = zend_hash_str_find(ht, "expressions", strlen("expressions"));
+    if (zv != NULL && Z_TYPE_P(zv) == IS_ARRAY) {
+        expressions = Z_ARRVAL_P(zv);
+        ZEND_HASH_FOREACH_VAL(expressions, expression) {
+            if (Z_TYPE_P(expression) != IS_STRING || valid_debugger_statement(Z_STR_P(expression)) != SUCCESS) {
+                return FAILURE;
+            }
+        } ZEND_HASH_FOREACH_END();
+    }
+
+    write_record(buf, record_type, lineno, id, filename, condition, expressions, log_level, format);
+    return SUCCESS;
+}
+
+/**
+ * Write the whole file to a temporary file next to the registry, then rename
+ * it over the registry so workers never map a partially written file. The
+ * temporary file is created with mkstemp so an existing file or symlink at
+ * its path is never written through.
+ */
+static int replace_registry_file(const char *path, smart_str *buf)
+{
+    char *tmp_path;
+    const char *data = ZSTR_VAL(buf->s);
+    size_t remaining = ZSTR_LEN(buf->s);
+    ssize_t written;
+    int fd, result = FAILURE;
+
+    spprintf(&tmp_path, 0, "%s.XXXXXX", path);
+    fd = mkstemp(tmp_path);
+    if (fd < 0) {
+        efree(tmp_path);
+        return FAILURE;
+    }
+
+    /* workers may run as another user, mkstemp creates the file as 0600 */
+    if (fchmod(fd, 0644) != 0) {
+        close(fd);
+        unlink(tmp_path);
+        efree(tmp_path);
+        return FAILURE;
+    }
+
+    while (remaining > 0) {
+        written = write(fd, data, remaining);
+        if (written <= 0) {
+            break;
+        }
+        data += written;
+        remaining -= written;
+    }
+
+    if (close(fd) == 0 && remaining == 0 && rename(tmp_path, path) == 0) {
+        result = SUCCESS;
+    } else {
+        unlink(tmp_path);
+    }
+    efree(tmp_path);
+    return result;
+}
+
+/**
+ * Replace the registry with the breakpoints of the current registry whose ids
+ * are not in `replaced`, followed by the provided breakpoint arrays. On
+ * success, `generation` is set to the generation of the new registry.
+ */
+static int rewrite_registry(zend_bool keep_current, HashTable *replaced, HashTable *breakpoints, zend_long *generation)
+{
+    char *path = INI_STR(PHP_STACKDRIVER_DEBUGGER_INI_REGISTRY_PATH);
+    stackdriver_debugger_registry_header_t header;
+    stackdriver_debugger_registry_entry_t *entry;
+    smart_str buf = {0};
+    zval *breakpoint;
+    uint32_t i;
+
+    if (path == NULL || *path == '\0') {
+        php_error_docref(NULL, E_WARNING, "%s is not set.", PHP_STACKDRIVER_DEBUGGER_INI_REGISTRY_PATH);
+        return FAILURE;
+    }
+
+    memset(&header, 0, sizeof(stackdriver_debugger_registry_header_t));
+    memcpy(header.magic, STACKDRIVER_DEBUGGER_REGISTRY_MAGIC, 4);
+    header.version = STACKDRIVER_DEBUGGER_REGISTRY_VERSION;
+    header.generation = 1;
+    if (load_registry_set(path) == SUCCESS) {
+        header.generation = REGISTRY_SET.generation + 1;
+    }
+
+    /* reserve the header, it is filled in once the size is known */
+    smart_str_appendl(&buf, (const char *)&header, sizeof(stackdriver_debugger_registry_header_t));
+
+    for (i = 0; keep_current && i < REGISTRY_SET.count; i++) {
+        entry = &REGISTRY_SET.entries[i];
+        if (replaced != NULL && zend_hash_exists(replaced, entry->id)) {
+            continue;
+        }
+        write_record(&buf, entry->type, entry->lineno, entry->id, entry->filename,
+            entry->condition, &entry->expressions, entry->log_level, entry->format);
+        header.count++;
+    }
+
+    ZEND_HASH_FOREACH_VAL(breakpoints, breakpoint) {
+        if (write_breakpoint(&buf, breakpoint) != SUCCESS) {
+            smart_str_free(&buf);
+            return FAILURE;
+        }
+        header.count++;
+    } ZEND_HASH_FOREACH_END();
+    header.size = (uint32_t)ZSTR_LEN(buf.s);
+    memcpy(ZSTR_VAL(buf.s), &header, sizeof(stackdriver_debugger_registry_header_t));
+
+    if (replace_registry_file(path, &buf) != SUCCESS) {
+        php_error_docref(NULL, E_WARNING, "Unable to write breakpoint registry %s.", path);
+        smart_str_free(&buf);
+        return FAILURE;
+    }
+    smart_str_free(&buf);
+
+    *generation = header.generation;
+    return SUCCESS;
+}
+
+/**
+ * Replace the breakpoint registry with the provided list of breakpoint arrays.
+ * On success, `generation` is set to the generation of the new registry.
+ */
+int stackdriver_debugger_write_registry(HashTable *breakpoints, zend_long *generation)
+{
+    return rewrite_registry(0, NULL, breakpoints, generation);
+}
+
+/**
+ * Apply a diff to the breakpoint registry: remove the breakpoints with the
+ * provided ids and add (or replace by id) the provided breakpoint arrays.
+ */
+int stackdriver_debugger_update_registry(HashTable *add, HashTable *remove_ids, zend_long *generation)
+{
+    HashTable replaced;
+    zval *zv;
+    zend_string *id;
+    int result;
+
+    zend_hash_init(&replaced, 8, NULL, NULL, 0);
+    if (remove_ids != NULL) {
+        ZEND_HASH_FOREACH_VAL(remove_ids, zv) {
+            if (Z_TYPE_P(zv) == IS_STRING) {
+                zend_hash_add_empty_element(&replaced, Z_STR_P(zv));
+            }
+        } ZEND_HASH_FOREACH_END();
+    }
+    ZEND_HASH_FOREACH_VAL(add, zv) {
+        if (Z_TYPE_P(zv) == IS_ARRAY && (id = find_string(Z_ARRVAL_P(zv), "id")) != NULL) {
+            zend_hash_add_empty_element(&replaced, id);
+        }
+    } ZEND_HASH_FOREACH_END();
+
+    result = rewrite_registry(1, &replaced, add, generation);
+    zend_hash_destroy(&replaced);
+    return result;
+}
+
+/**
+ * Find the registry breakpoint with the provided probe code in the provided
+ * file and register it for the current request. Returns the request
+ * breakpoint, or NULL if there is no such entry or a breakpoint with its id is
+ * already registered this request.
+ */
+void *stackdriver_debugger_registry_find(zend_long code, zend_string *filename)
+{
+    stackdriver_debugger_registry_entry_t *entry;
+    uint32_t i;
+
+    for (i = first_entry_in_file(filename); i < REGISTRY_SET.count; i = entry->next_in_file) {
+        entry = &REGISTRY_SET.entries[i];
+        if (entry->code == code) {
+            return registered_in_request(entry) ? NULL : materialize_entry(entry);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Call `apply` for each valid registry breakpoint in the provided file, except
+ * those whose id is registered in the current request.
+ */
+void stackdriver_debugger_registry_apply(zend_string *filename, stackdriver_debugger_registry_apply_func_t apply, void *data)
+{
+    stackdriver_debugger_registry_entry_t *entry;
+    uint32_t i;
+
+    for (i = first_entry_in_file(filename); i < REGISTRY_SET.count; i = entry->next_in_file) {
+        entry = &REGISTRY_SET.entries[i];
+        if (!registered_in_request(entry)) {
+            apply(entry->type == STACKDRIVER_DEBUGGER_REGISTRY_LOGPOINT ? STACKDRIVER_DEBUGGER_PROBE_LOGPOINT : STACKDRIVER_DEBUGGER_PROBE_SNAPSHOT,
+                entry->id, entry->lineno, data);
+        }
+    }
+}
+
+/**
+ * Allocate the registry state of a thread's globals.
+ */
+void stackdriver_debugger_registry_globals_ctor(zend_stackdriver_debugger_globals *globals)
+{
+    globals->registry = pecalloc(1, sizeof(stackdriver_debugger_registry_t), 1);
+}
+
+/**
+ * Free the registry state of a thread's globals, if not already freed.
+ */
+void stackdriver_debugger_registry_globals_dtor(zend_stackdriver_debugger_globals *globals)
+{
+    if (globals->registry == NULL) {
+        return;
+    }
+    free_registry_set_ex(&globals->registry->set);
+    unmap_registry_ex(&globals->registry->map);
+    pefree(globals->registry, 1);
+    globals->registry = NULL;
+}
+
+/**
+ * Module shutdown lifecycle hook. Frees the breakpoint set and unmaps the
+ * registry of the current thread.
+ */
+int stackdriver_debugger_registry_mshutdown(SHUTDOWN_FUNC_ARGS)
+{
+#ifndef ZTS
+    stackdriver_debugger_registry_globals_dtor(&stackdriver_debugger_globals);
+#endif
+    return SUCCESS;
+}
+
+/**
+ * Request initialization lifecycle hook. Reloads the breakpoint set if the
+ * registry changed since the previous request. Nothing is registered here:
+ * entries are injected when their file is compiled and registered for the
+ * request when their probe is hit.
+ */
+int stackdriver_debugger_registry_rinit(TSRMLS_D)
+{
+    char *path = INI_STR(PHP_STACKDRIVER_DEBUGGER_INI_REGISTRY_PATH);
+
+    if (path != NULL && *path != '\0') {
+        load_registry_set(path);
+    }
+    STACKDRIVER_DEBUGGER_G(registry_breakpoints) = REGISTRY_SET.loaded && REGISTRY_SET.count > 0;
+
+    return SUCCESS;
+}
+
+#else
+
+int stackdriver_debugger_write_registry(HashTable *breakpoints, zend_long *generation)
+{
+    php_error_docref(NULL, E_WARNING, "The breakpoint registry is not supported on Windows.");
+    return FAILURE;
+}
+
+int stackdriver_debugger_update_registry(HashTable *add, HashTable *remove_ids, zend_long *generation)
+{
+    php_error_docref(NULL, E_WARNING, "The breakpoint registry is not supported on Windows.");
+    return FAILURE;
+}
+
+void *stackdriver_debugger_registry_find(zend_long code, zend_string *filename)
+{
+    return NULL;
+}
+
+void stackdriver_debugger_registry_apply(zend_string *filename, stackdriver_debugger_registry_apply_func_t apply, void *data)
+{
+}
+
+void stackdriver_debugger_registry_globals_ctor(zend_stackdriver_debugger_globals *globals)
+{
+    globals->registry = NULL;
+}
+
+void stackdriver_debugger_registry_globals_dtor(zend_stackdriver_debugger_globals *globals)
+{
+}
+
+int stackdriver_debugger_registry_mshutdown(SHUTDOWN_FUNC_ARGS)
+{
+    return SUCCESS;
+}
+
+int stackdriver_debugger_registry_rinit(TSRMLS_D)
+{
+    STACKDRIVER_DEBUGGER_G(registry_breakpoints) = 0;
+    return SUCCESS;
+}
+
+#endif /* PHP_WIN32 */
@@ -0,0 +1,66 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef PHP_STACKDRIVER_DEBUGGER_REGISTRY_H
+#define PHP_STACKDRIVER_DEBUGGER_REGISTRY_H 1
+
+#include "php.h"
+#include "php_stackdriver_debugger.h"
+
+#define STACKDRIVER_DEBUGGER_REGISTRY_MAGIC "SDBR"
+#define STACKDRIVER_DEBUGGER_REGISTRY_VERSION 1
+
+/* breakpoint record types */
+#define STACKDRIVER_DEBUGGER_REGISTRY_SNAPSHOT 1
+#define STACKDRIVER_DEBUGGER_REGISTRY_LOGPOINT 2
+
+/*
+ * Header of the breakpoint registry file. It is followed by `count` records
+ * of uint32_t fields and length prefixed strings:
+ *
+ *   type, line, id, filename, condition, number of expressions,
+ *   expressions..., and for logpoints: log level, format
+ *
+ * Integers are in host byte order as the file is only shared between the
+ * processes of one machine.
+ */
+typedef struct stackdriver_debugger_registry_header_t {
+    char magic[4];
+    uint32_t version;
+    uint64_t generation;
+    uint32_t count;
+
+    /* total size of the registry in bytes, including this header */
+    uint32_t size;
+} stackdriver_debugger_registry_header_t;
+
+/* Callback receiving a registry breakpoint's probe kind, id and line */
+typedef void (*stackdriver_debugger_registry_apply_func_t)(int kind, zend_string *breakpoint_id, zend_long lineno, void *data);
+
+int stackdriver_debugger_write_registry(HashTable *breakpoints, zend_long *generation);
+int stackdriver_debugger_update_registry(HashTable *add, HashTable *remove_ids, zend_long *generation);
+
+void *stackdriver_debugger_registry_find(zend_long code, zend_string *filename);
+void stackdriver_debugger_registry_apply(zend_string *filename, stackdriver_debugger_registry_apply_func_t apply, void *data);
+
+/* lifecycle callbacks */
+void stackdriver_debugger_registry_globals_ctor(zend_stackdriver_debugger_globals *globals);
+void stackdriver_debugger_registry_globals_dtor(zend_stackdriver_debugger_globals *globals);
+int stackdriver_debugger_registry_mshutdown(SHUTDOWN_FUNC_ARGS);
+int stackdriver_debugger_registry_rinit(TSRMLS_D);
+
+#endif /* PHP_STACKDRIVER_DEBUGGER_REGISTRY_H */
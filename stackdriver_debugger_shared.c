@@ -0,0 +1,443 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "php.h"
+#include "php_stackdriver_debugger.h"
+#include "stackdriver_debugger_shared.h"
+#include "stackdriver_debugger_time_functions.h"
+
+#ifndef PHP_WIN32
+#include <sys/mman.h>
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/* results of reading a claim */
+#define CLAIM_FREE 0
+#define CLAIM_HELD 1
+#define CLAIM_OTHER 2
+#define CLAIM_BUSY 3
+
+/*
+ * A claimed snapshot id. Writers take the claim's sequence lock by making its
+ * sequence number odd. Readers treat the claim as being written if the number
+ * changed while they read it, so they never act on a half written claim.
+ */
+typedef struct stackdriver_debugger_claim_t {
+    /* odd while the claim is being written */
+    volatile uint32_t seq;
+
+    volatile uint32_t id_len;
+
+    /* 0 if free, else the hash of the id */
+    volatile uint64_t state;
+
+    /* when the id was claimed, in microseconds since the epoch */
+    volatile int64_t claimed_at;
+
+    char id[STACKDRIVER_DEBUGGER_CLAIM_MAX_ID_LENGTH];
+} stackdriver_debugger_claim_t;
+
+/*
+ * State shared by all worker processes: a token bucket of debugger time and an
+ * open addressed table of claimed snapshot ids. A claim expires after the
+ * configured time to live, so snapshots which were claimed by a worker that
+ * died before delivering them are captured again.
+ */
+typedef struct stackdriver_debugger_shared_t {
+    /* debugger time left to spend in microseconds, negative while in debt */
+    volatile int64_t budget;
+
+    /* when the budget was last refilled, in microseconds since the epoch */
+    volatile int64_t refilled_at;
+
+    uint64_t num_slots;
+    stackdriver_debugger_claim_t claims[1];
+} stackdriver_debugger_shared_t;
+
+static stackdriver_debugger_shared_t *shared = NULL;
+static size_t shared_size = 0;
+
+/* microseconds of budget added per elapsed microsecond, 0 for no budget */
+static double budget_rate = 0;
+static int64_t budget_capacity = 0;
+
+/* microseconds after which a claim expires */
+static int64_t claim_ttl = 0;
+
+static int64_t now_usec()
+{
+    return (int64_t)(stackdriver_debugger_now() * 1000000.0);
+}
+
+/**
+ * Add the budget earned since the last refill. Only the worker that advances
+ * the refill timestamp adds it, so concurrent refills are not counted twice.
+ */
+static void refill_budget(int64_t now)
+{
+    int64_t refilled_at, budget, refilled;
+
+    refilled_at = __atomic_load_n(&shared->refilled_at, __ATOMIC_ACQUIRE);
+    if (now <= refilled_at ||
+        !__sync_bool_compare_and_swap(&shared->refilled_at, refilled_at, now)) {
+        return;
+    }
+
+    do {
+        budget = __atomic_load_n(&shared->budget, __ATOMIC_ACQUIRE);
+        refilled = budget + (int64_t)((now - refilled_at) * budget_rate);
+        if (refilled > budget_capacity) {
+            refilled = budget_capacity;
+        }
+    } while (!__sync_bool_compare_and_swap(&shared->budget, budget, refilled));
+}
+
+/**
+ * Returns whether the debugger time budget shared by all workers has any
+ * time left. Always true if no budget is configured.
+ */
+zend_bool stackdriver_debugger_budget_available()
+{
+    if (shared == NULL || budget_rate <= 0) {
+        return 1;
+    }
+
+    refill_budget(now_usec());
+    return __atomic_load_n(&shared->budget, __ATOMIC_ACQUIRE) > 0;
+}
+
+/**
+ * Charge the provided debugger time in seconds to the shared budget.
+ */
+void stackdriver_debugger_charge_budget(double time_spent)
+{
+    if (shared == NULL || budget_rate <= 0 || time_spent <= 0) {
+        return;
+    }
+
+    __sync_fetch_and_sub(&shared->budget, (int64_t)(time_spent * 1000000.0));
+}
+
+/**
+ * 64 bit FNV-1a hash of the id, which unlike the string hash is 64 bits wide
+ * on every platform. Never returns 0.
+ */
+static uint64_t claim_key(zend_string *snapshot_id)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i;
+
+    for (i = 0; i < ZSTR_LEN(snapshot_id); i++) {
+        hash ^= (unsigned char)ZSTR_VAL(snapshot_id)[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash != 0 ? hash : 1;
+}
+
+/* Returns whether the claim can hold the provided snapshot id */
+static zend_always_inline zend_bool claimable(zend_string *snapshot_id)
+{
+    return shared != NULL && shared->num_slots > 0 &&
+        ZSTR_LEN(snapshot_id) <= STACKDRIVER_DEBUGGER_CLAIM_MAX_ID_LENGTH;
+}
+
+/**
+ * Read the claim in the provided slot. Returns CLAIM_HELD if it is a live
+ * claim of the provided id, CLAIM_OTHER for a live claim of another id,
+ * CLAIM_FREE for a free or expired slot and CLAIM_BUSY if the claim is being
+ * written, in which case it cannot be told whose it is. The sequence number
+ * the claim was read at is stored in `seq`.
+ */
+static int read_claim(stackdriver_debugger_claim_t *claim, uint64_t key, zend_string *snapshot_id, int64_t now, uint32_t *seq)
+{
+    uint64_t state;
+    int64_t claimed_at;
+    zend_bool same_id;
+
+    *seq = __atomic_load_n(&claim->seq, __ATOMIC_ACQUIRE);
+    if (*seq & 1) {
+        return CLAIM_BUSY;
+    }
+
+    state = __atomic_load_n(&claim->state, __ATOMIC_RELAXED);
+    claimed_at = __atomic_load_n(&claim->claimed_at, __ATOMIC_RELAXED);
+    same_id = state == key && __atomic_load_n(&claim->id_len, __ATOMIC_RELAXED) == ZSTR_LEN(snapshot_id) &&
+        memcmp(claim->id, ZSTR_VAL(snapshot_id), ZSTR_LEN(snapshot_id)) == 0;
+
+    /* the fields are only consistent if no writer took the lock meanwhile */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&claim->seq, __ATOMIC_RELAXED) != *seq) {
+        return CLAIM_BUSY;
+    }
+
+    if (state == 0 || (claim_ttl > 0 && now - claimed_at > claim_ttl)) {
+        return CLAIM_FREE;
+    }
+    return same_id ? CLAIM_HELD : CLAIM_OTHER;
+}
+
+/**
+ * Free the claim in the provided slot if it has not changed since it was
+ * read at `seq`.
+ */
+static void free_claim(stackdriver_debugger_claim_t *claim, uint32_t seq)
+{
+    if (!__sync_bool_compare_and_swap(&claim->seq, seq, seq + 1)) {
+        return;
+    }
+    __atomic_store_n(&claim->state, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&claim->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/**
+ * Returns whether the provided snapshot id has a live claim in any slot the
+ * id may be in other than `except`. Claims can be released, so all of these
+ * slots are searched rather than stopping at the first free one.
+ */
+static zend_bool find_other_claim(uint64_t key, zend_string *snapshot_id, int64_t now, stackdriver_debugger_claim_t *except)
+{
+    uint64_t i, slot = key % shared->num_slots;
+    uint32_t seq;
+
+    for (i = 0; i < STACKDRIVER_DEBUGGER_CLAIM_MAX_PROBES && i < shared->num_slots; i++) {
+        if (&shared->claims[slot] != except &&
+            read_claim(&shared->claims[slot], key, snapshot_id, now, &seq) == CLAIM_HELD) {
+            return 1;
+        }
+        slot = (slot + 1) % shared->num_slots;
+    }
+
+    return 0;
+}
+
+/**
+ * Returns whether another hit has already claimed the provided snapshot id.
+ * A claim being written may be for this id, so it counts as claimed.
+ */
+zend_bool stackdriver_debugger_snapshot_claimed(zend_string *snapshot_id)
+{
+    uint64_t key, i, slot;
+    int64_t now;
+    uint32_t seq;
+    int result;
+
+    if (!claimable(snapshot_id)) {
+        return 0;
+    }
+
+    key = claim_key(snapshot_id);
+    now = now_usec();
+    slot = key % shared->num_slots;
+    for (i = 0; i < STACKDRIVER_DEBUGGER_CLAIM_MAX_PROBES && i < shared->num_slots; i++) {
+        result = read_claim(&shared->claims[slot], key, snapshot_id, now, &seq);
+        if (result == CLAIM_HELD || result == CLAIM_BUSY) {
+            return 1;
+        }
+        slot = (slot + 1) % shared->num_slots;
+    }
+
+    return 0;
+}
+
+/**
+ * Claim the provided snapshot id for this hit. Returns SUCCESS if no other
+ * hit holds or is writing a claim on it. If every slot the id may be in holds
+ * a live claim, the hit is allowed so that snapshots are never lost.
+ *
+ * Two hits may still claim different free slots for the same id at once, for
+ * example when a claim expires between their searches. After publishing its
+ * claim, each hit searches again and backs off if it finds another claim of
+ * the id, so at most one of them captures.
+ */
+int stackdriver_debugger_claim_snapshot(zend_string *snapshot_id)
+{
+    stackdriver_debugger_claim_t *claim, *free_slot;
+    uint64_t key, i, slot;
+    uint32_t seq, free_seq = 0;
+    int64_t now;
+    int attempt, result;
+
+    if (!claimable(snapshot_id)) {
+        return SUCCESS;
+    }
+
+    key = claim_key(snapshot_id);
+    now = now_usec();
+
+    for (attempt = 0; attempt < STACKDRIVER_DEBUGGER_CLAIM_MAX_PROBES; attempt++) {
+        free_slot = NULL;
+        slot = key % shared->num_slots;
+        for (i = 0; i < STACKDRIVER_DEBUGGER_CLAIM_MAX_PROBES && i < shared->num_slots; i++) {
+            claim = &shared->claims[slot];
+            result = read_claim(claim, key, snapshot_id, now, &seq);
+            if (result == CLAIM_HELD || result == CLAIM_BUSY) {
+                return FAILURE;
+            }
+            if (result == CLAIM_FREE && free_slot == NULL) {
+                free_slot = claim;
+                free_seq = seq;
+            }
+            slot = (slot + 1) % shared->num_slots;
+        }
+
+        if (free_slot == NULL) {
+            return SUCCESS;
+        }
+
+        /* take the slot's lock, which fails if it changed since it was read */
+        if (__sync_bool_compare_and_swap(&free_slot->seq, free_seq, free_seq + 1)) {
+            __atomic_store_n(&free_slot->state, key, __ATOMIC_RELAXED);
+            __atomic_store_n(&free_slot->claimed_at, now, __ATOMIC_RELAXED);
+            __atomic_store_n(&free_slot->id_len, (uint32_t)ZSTR_LEN(snapshot_id), __ATOMIC_RELAXED);
+            memcpy(free_slot->id, ZSTR_VAL(snapshot_id), ZSTR_LEN(snapshot_id));
+            __atomic_store_n(&free_slot->seq, free_seq + 2, __ATOMIC_RELEASE);
+
+            /* order the published claim before searching for a concurrent one */
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (find_other_claim(key, snapshot_id, now, free_slot)) {
+                free_claim(free_slot, free_seq + 2);
+                return FAILURE;
+            }
+            return SUCCESS;
+        }
+
+        /* another hit took the slot first, possibly for this id */
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * Release the claims on the provided snapshot id so that the next hit
+ * captures it again.
+ */
+void stackdriver_debugger_release_snapshot(zend_string *snapshot_id)
+{
+    uint64_t key, i, slot;
+    int64_t now;
+    uint32_t seq;
+
+    if (!claimable(snapshot_id)) {
+        return;
+    }
+
+    key = claim_key(snapshot_id);
+    now = now_usec();
+    slot = key % shared->num_slots;
+    for (i = 0; i < STACKDRIVER_DEBUGGER_CLAIM_MAX_PROBES && i < shared->num_slots; i++) {
+        if (read_claim(&shared->claims[slot], key, snapshot_id, now, &seq) == CLAIM_HELD) {
+            free_claim(&shared->claims[slot], seq);
+        }
+        slot = (slot + 1) % shared->num_slots;
+    }
+}
+
+/**
+ * Module initialization lifecycle hook. Maps the shared state before any
+ * worker processes are forked so that they all share it.
+ */
+int stackdriver_debugger_shared_minit(INIT_FUNC_ARGS)
+{
+    zend_long num_slots = INI_INT(PHP_STACKDRIVER_DEBUGGER_INI_SNAPSHOT_CLAIM_SLOTS);
+    zend_long ttl = INI_INT(PHP_STACKDRIVER_DEBUGGER_INI_SNAPSHOT_CLAIM_TTL);
+    double percentage = INI_FLT(PHP_STACKDRIVER_DEBUGGER_INI_MAX_HOST_TIME_PERCENTAGE);
+    void *addr;
+    size_t size;
+
+    if (num_slots < 0) {
+        num_slots = 0;
+    }
+    if (ttl > 0) {
+        claim_ttl = (int64_t)ttl * 1000000;
+    }
+    if (percentage > 0) {
+        budget_rate = percentage * 0.01;
+        budget_capacity = (int64_t)(budget_rate * STACKDRIVER_DEBUGGER_BUDGET_WINDOW);
+    }
+    if (num_slots == 0 && budget_rate <= 0) {
+        return SUCCESS;
+    }
+
+    size = sizeof(stackdriver_debugger_shared_t) + num_slots * sizeof(stackdriver_debugger_claim_t);
+    addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) {
+        php_error_docref(NULL, E_WARNING, "Failed to allocate shared memory for the debugger.");
+        return SUCCESS;
+    }
+
+    /* anonymous mappings are zero filled, so every slot starts free */
+    shared = (stackdriver_debugger_shared_t *)addr;
+    shared->num_slots = num_slots;
+    shared->budget = budget_capacity;
+    shared->refilled_at = now_usec();
+    shared_size = size;
+
+    return SUCCESS;
+}
+
+/**
+ * Module shutdown lifecycle hook. Unmaps the shared state.
+ */
+int stackdriver_debugger_shared_mshutdown(SHUTDOWN_FUNC_ARGS)
+{
+    if (shared != NULL) {
+        munmap((void *)shared, shared_size);
+        shared = NULL;
+        shared_size = 0;
+    }
+    return SUCCESS;
+}
+
+#else
+
+zend_bool stackdriver_debugger_budget_available()
+{
+    return 1;
+}
+
+void stackdriver_debugger_charge_budget(double time_spent)
+{
+}
+
+zend_bool stackdriver_debugger_snapshot_claimed(zend_string *snapshot_id)
+{
+    return 0;
+}
+
+int stackdriver_debugger_claim_snapshot(zend_string *snapshot_id)
+{
+    return SUCCESS;
+}
+
+void stackdriver_debugger_release_snapshot(zend_string *snapshot_id)
+{
+}
+
+int stackdriver_debugger_shared_minit(INIT_FUNC_ARGS)
+{
+    return SUCCESS;
+}
+
+int stackdriver_debugger_shared_mshutdown(SHUTDOWN_FUNC_ARGS)
+{
+    return SUCCESS;
+}
+
+#endif /* PHP_WIN32 */
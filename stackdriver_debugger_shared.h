@@ -0,0 +1,54 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef PHP_STACKDRIVER_DEBUGGER_SHARED_H
+#define PHP_STACKDRIVER_DEBUGGER_SHARED_H 1
+
+#include "php.h"
+
+/* give up on claiming after this many occupied slots */
+#define STACKDRIVER_DEBUGGER_CLAIM_MAX_PROBES 16
+
+/* longer snapshot ids are not claimed, and captured once per request */
+#define STACKDRIVER_DEBUGGER_CLAIM_MAX_ID_LENGTH 128
+
+/* the time budget holds at most this many microseconds worth of refills */
+#define STACKDRIVER_DEBUGGER_BUDGET_WINDOW 1000000
+
+/*
+ * Debugger time is drawn from a token bucket shared by all the processes
+ * forked from the process that loaded the extension, which caps the debugger's
+ * overhead for the whole server rather than for each worker.
+ */
+zend_bool stackdriver_debugger_budget_available();
+void stackdriver_debugger_charge_budget(double time_spent);
+
+/*
+ * Claims on snapshot ids are kept in memory shared by all the processes
+ * forked from the process that loaded the extension, so a snapshot is only
+ * captured by the first worker to hit it. A claim is released if the snapshot
+ * is not delivered, and expires after the configured time to live.
+ */
+zend_bool stackdriver_debugger_snapshot_claimed(zend_string *snapshot_id);
+int stackdriver_debugger_claim_snapshot(zend_string *snapshot_id);
+void stackdriver_debugger_release_snapshot(zend_string *snapshot_id);
+
+/* lifecycle callbacks */
+int stackdriver_debugger_shared_minit(INIT_FUNC_ARGS);
+int stackdriver_debugger_shared_mshutdown(SHUTDOWN_FUNC_ARGS);
+
+#endif /* PHP_STACKDRIVER_DEBUGGER_SHARED_H */
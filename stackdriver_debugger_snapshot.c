@@ -15,54 +15,57 @@
  */
 
 #include "php.h"
+#include "zend_arena.h"
 #include "php_stackdriver_debugger.h"
 #include "stackdriver_debugger_ast.h"
+#include "stackdriver_debugger_eval.h"
 #include "stackdriver_debugger_snapshot.h"
+#include "stackdriver_debugger_json.h"
+#include "stackdriver_debugger_probe.h"
+#include "stackdriver_debugger_shared.h"
 #include "zend_exceptions.h"
 #include "stackdriver_debugger_random.h"
 #include "spl/php_spl.h"
+#include "spl/spl_array.h"
+#include "zend_interfaces.h"
+#include "ext/standard/php_incomplete_class.h"
 
-/* Initialize an empty, allocated variable */
-static void init_variable(stackdriver_debugger_variable_t *variable)
-{
-    variable->name = NULL;
-    ZVAL_NULL(&variable->value);
-    variable->indirect = 0;
-}
+/*
+ * Initial arena size per captured stackframe. The arena grows on demand, this
+ * only sizes the first page so that typical stacks fit in a single allocation.
+ */
+#define STACKDRIVER_DEBUGGER_ARENA_FRAME_SIZE \
+    (sizeof(stackdriver_debugger_stackframe_t) + 16 * sizeof(stackdriver_debugger_variable_t))
+#define STACKDRIVER_DEBUGGER_ARENA_MIN_SIZE 4096
+
+/* Whether values, including objects, are copied within the capture limits */
+#define CAPTURE_COPIES(options) \
+    ((options)->freeze_objects || \
+     (options)->max_member_depth > 0 || (options)->max_members > 0 || \
+     (options)->max_string_length > 0 || (options)->max_total_bytes > 0)
+
+/* Result flags of capturing a value */
+#define CAPTURE_TRUNCATED 1 /* part of the value was left out */
+#define CAPTURE_DETACHED  2 /* the value no longer shares the original */
 
-/* Cleanup an allocated variable including freeing memory */
+/* Cleanup a captured variable. The variable memory itself belongs to the arena */
 static void destroy_variable(stackdriver_debugger_variable_t *variable)
 {
     if (variable->name) {
         zend_string_release(variable->name);
     }
-
-    efree(variable);
-}
-
-static void stackframe_locals_dtor(zval *zv)
-{
-    stackdriver_debugger_variable_t *variable = (stackdriver_debugger_variable_t *)Z_PTR_P(zv);
-    destroy_variable(variable);
-    ZVAL_PTR_DTOR(zv);
-}
-
-/* Initialize an empty, allocated stackframe */
-static void init_stackframe(stackdriver_debugger_stackframe_t *stackframe)
-{
-    stackframe->function = NULL;
-    stackframe->filename = NULL;
-    stackframe->lineno = -1;
-    ALLOC_HASHTABLE(stackframe->locals);
-    zend_hash_init(stackframe->locals, 16, NULL, stackframe_locals_dtor, 0);
+    if (variable->id) {
+        zend_string_release(variable->id);
+    }
+    zval_ptr_dtor(&variable->value);
 }
 
-/* Cleanup an allocated stackframe including freeing memory */
+/* Cleanup a captured stackframe. The stackframe memory belongs to the arena */
 static void destroy_stackframe(stackdriver_debugger_stackframe_t *stackframe)
 {
-    int i;
+    uint32_t i;
 
-    if (stackframe->function && (int)stackframe->function != -1) {
+    if (stackframe->function) {
         zend_string_release(stackframe->function);
     }
 
@@ -70,17 +73,9 @@ static void destroy_stackframe(stackdriver_debugger_stackframe_t *stackframe)
         zend_string_release(stackframe->filename);
     }
 
-    zend_hash_destroy(stackframe->locals);
-    FREE_HASHTABLE(stackframe->locals);
-
-    efree(stackframe);
-}
-
-static void stackframes_dtor(zval *zv)
-{
-    stackdriver_debugger_stackframe_t *sf = (stackdriver_debugger_stackframe_t *)Z_PTR_P(zv);
-    destroy_stackframe(sf);
-    ZVAL_PTR_DTOR(zv);
+    for (i = 0; i < stackframe->num_locals; i++) {
+        destroy_variable(&stackframe->locals[i]);
+    }
 }
 
 /* Initialize an empty, allocated snapshot */
@@ -91,19 +86,34 @@ static void init_snapshot(stackdriver_debugger_snapshot_t *snapshot)
     snapshot->lineno = -1;
     snapshot->condition = NULL;
     snapshot->fulfilled = 0;
+    snapshot->claimable = 0;
+    snapshot->claimed = 0;
+    snapshot->refcount = 1;
+    memset(&snapshot->capture_options, 0, sizeof(stackdriver_debugger_capture_options_t));
+    snapshot->captured_bytes = 0;
     ALLOC_HASHTABLE(snapshot->expressions);
     zend_hash_init(snapshot->expressions, 16, NULL, ZVAL_PTR_DTOR, 0);
     ALLOC_HASHTABLE(snapshot->evaluated_expressions);
     zend_hash_init(snapshot->evaluated_expressions, 16, NULL, ZVAL_PTR_DTOR, 0);
-    ALLOC_HASHTABLE(snapshot->stackframes);
-    zend_hash_init(snapshot->stackframes, 16, NULL, stackframes_dtor, 0);
+    snapshot->capture_variables = NULL;
+    snapshot->path_filter = NULL;
+    snapshot->arena = NULL;
+    snapshot->var_table_size = 0;
+    snapshot->var_table_lookup = NULL;
+    snapshot->stackframes = NULL;
+    snapshot->num_stackframes = 0;
     ZVAL_NULL(&snapshot->callback);
 }
 
 /* Cleanup an allocated snapshot including freeing memory */
 static void destroy_snapshot(stackdriver_debugger_snapshot_t *snapshot)
 {
-    int i;
+    uint32_t i;
+
+    /* let another hit capture the snapshot if it was never delivered */
+    if (snapshot->claimed) {
+        stackdriver_debugger_release_snapshot(snapshot->id);
+    }
 
     zend_string_release(snapshot->id);
     zend_string_release(snapshot->filename);
@@ -118,8 +128,22 @@ static void destroy_snapshot(stackdriver_debugger_snapshot_t *snapshot)
     zend_hash_destroy(snapshot->evaluated_expressions);
     FREE_HASHTABLE(snapshot->evaluated_expressions);
 
-    zend_hash_destroy(snapshot->stackframes);
-    FREE_HASHTABLE(snapshot->stackframes);
+    if (snapshot->capture_variables) {
+        zend_hash_destroy(snapshot->capture_variables);
+        FREE_HASHTABLE(snapshot->capture_variables);
+    }
+
+    if (snapshot->path_filter) {
+        stackdriver_debugger_path_filter_destroy(snapshot->path_filter);
+    }
+
+    /* release captured references, then free all captured memory at once */
+    for (i = 0; i < snapshot->num_stackframes; i++) {
+        destroy_stackframe(&snapshot->stackframes[i]);
+    }
+    if (snapshot->arena) {
+        zend_arena_destroy(snapshot->arena);
+    }
 
     if (Z_TYPE(snapshot->callback) != IS_NULL) {
         ZVAL_DESTRUCTOR(&snapshot->callback);
@@ -129,39 +153,274 @@ static void destroy_snapshot(stackdriver_debugger_snapshot_t *snapshot)
 
 /**
  * Convert a collected stackdriver_debugger_variable_t into an array zval with
- * keys of name and value.
+ * keys of name and value. Values in the variable table also carry their
+ * varTableIndex, but keep their value so that existing consumers still work.
+ * Only the JSON encoder reports them solely through the table.
  */
 static void variable_to_zval(zval *return_value, stackdriver_debugger_variable_t *variable)
 {
     zend_string *hash = NULL;
     array_init(return_value);
-    add_assoc_str(return_value, "name", variable->name);
+    add_assoc_str(return_value, "name", zend_string_copy(variable->name));
+    Z_TRY_ADDREF(variable->value);
     add_assoc_zval(return_value, "value", &variable->value);
-    switch (Z_TYPE(variable->value)) {
-        case IS_OBJECT:
-            /* Use the spl_object_hash value */
-            hash = php_spl_object_hash(&variable->value);
+    if (variable->id) {
+        /* The live value was frozen at capture, use its identity */
+        hash = zend_string_copy(variable->id);
+    } else {
+        switch (Z_TYPE(variable->value)) {
+            case IS_OBJECT:
+                /* Use the spl_object_hash value */
+                hash = php_spl_object_hash(&variable->value);
+                break;
+            case IS_ARRAY:
+                /* Use the memory address of the zend_array */
+                hash = strpprintf(16, "%016zx", Z_ARR(variable->value));
+                break;
+            case IS_STRING:
+                /* Use the internal HashTable value */
+                hash = strpprintf(32, "%016zx", ZSTR_HASH(Z_STR(variable->value)));
+                break;
+        }
+    }
+    if (hash != NULL) {
+        add_assoc_str(return_value, "id", hash);
+    }
+    if (variable->truncated) {
+        add_assoc_bool(return_value, "truncated", 1);
+    }
+    if (variable->var_table_index != STACKDRIVER_DEBUGGER_NO_VAR_TABLE_INDEX) {
+        add_assoc_long(return_value, "varTableIndex", variable->var_table_index);
+    }
+}
+
+/**
+ * Reserve up to `wanted` bytes of the snapshot's capture budget. Returns the
+ * number of bytes that may actually be captured.
+ */
+static size_t capture_budget(stackdriver_debugger_snapshot_t *snapshot, size_t wanted)
+{
+    size_t max = (size_t)snapshot->capture_options.max_total_bytes;
+
+    if (max > 0) {
+        if (snapshot->captured_bytes >= max) {
+            return 0;
+        }
+        if (wanted > max - snapshot->captured_bytes) {
+            wanted = max - snapshot->captured_bytes;
+        }
+    }
+    snapshot->captured_bytes += wanted;
+    return wanted;
+}
+
+static int capture_value(zval *dst, zval *src, zend_long depth, stackdriver_debugger_snapshot_t *snapshot);
+
+/* Interned STACKDRIVER_DEBUGGER_TRUNCATED_MARKER, compared by identity */
+zend_string *stackdriver_debugger_truncated_marker;
+
+/* Capture the marker for a value cut off at this point. Returns the CAPTURE_* flags */
+static int capture_truncated(zval *dst)
+{
+    ZVAL_INTERNED_STR(dst, stackdriver_debugger_truncated_marker);
+    return CAPTURE_TRUNCATED | CAPTURE_DETACHED;
+}
+
+/**
+ * Copy at most the configured number of members of `ht` into the HashTable
+ * `dst`. Returns the CAPTURE_* flags of the copy.
+ */
+static int capture_members(HashTable *dst, HashTable *ht, zend_long depth, stackdriver_debugger_snapshot_t *snapshot)
+{
+    stackdriver_debugger_capture_options_t *options = &snapshot->capture_options;
+    uint32_t limit = zend_hash_num_elements(ht), count = 0;
+    int result = 0;
+    zend_string *key;
+    zend_ulong idx;
+    zval *val;
+
+    if (options->max_members > 0 && limit > options->max_members) {
+        limit = (uint32_t)options->max_members;
+        result |= CAPTURE_TRUNCATED;
+    }
+
+    ZEND_HASH_FOREACH_KEY_VAL_IND(ht, idx, key, val) {
+        zval member;
+
+        if (count == limit) {
             break;
-        case IS_ARRAY:
-            /* Use the memory address of the zend_array */
-            hash = strpprintf(16, "%016zx", Z_ARR(variable->value));
+        }
+        if (capture_budget(snapshot, sizeof(Bucket)) < sizeof(Bucket)) {
+            result |= CAPTURE_TRUNCATED;
             break;
+        }
+
+        result |= capture_value(&member, val, depth + 1, snapshot);
+        if (key) {
+            zend_hash_update(dst, key, &member);
+        } else {
+            zend_hash_index_update(dst, idx, &member);
+        }
+        count++;
+    } ZEND_HASH_FOREACH_END();
+
+    if (count < zend_hash_num_elements(ht)) {
+        result |= CAPTURE_TRUNCATED;
+    }
+    return result;
+}
+
+/**
+ * Copy the array `src` into `dst` within the capture options. Returns the
+ * CAPTURE_* flags of the copy.
+ */
+static int capture_array(zval *dst, zval *src, zend_long depth, stackdriver_debugger_snapshot_t *snapshot)
+{
+    stackdriver_debugger_capture_options_t *options = &snapshot->capture_options;
+    HashTable *ht = Z_ARRVAL_P(src);
+    int protect = Z_REFCOUNTED_P(src) && CAPTURE_PROTECTED(ht);
+    int result;
+
+    if (zend_hash_num_elements(ht) == 0) {
+        ZVAL_COPY(dst, src);
+        return 0;
+    }
+
+    if ((options->max_member_depth > 0 && depth >= options->max_member_depth) ||
+        (protect && CAPTURE_IS_RECURSIVE(ht))) {
+        return capture_truncated(dst);
+    }
+
+    array_init_size(dst, zend_hash_num_elements(ht));
+    if (protect) {
+        CAPTURE_PROTECT_RECURSION(ht);
+    }
+    result = capture_members(Z_ARRVAL_P(dst), ht, depth, snapshot);
+    if (protect) {
+        CAPTURE_UNPROTECT_RECURSION(ht);
+    }
+
+    /* Nothing was left out or detached, share the original array instead */
+    if (result == 0) {
+        zval_ptr_dtor(dst);
+        ZVAL_COPY(dst, src);
+    }
+
+    return result | (result ? CAPTURE_DETACHED : 0);
+}
+
+/**
+ * Freeze the object `src` into `dst`. The frozen object is a detached
+ * __PHP_Incomplete_Class instance carrying the original class name and a copy
+ * of the property table. No user code (constructors, __debugInfo, __get or
+ * destructors) is run for the copy. Returns the CAPTURE_* flags of the copy.
+ */
+static int capture_object(zval *dst, zval *src, zend_long depth, stackdriver_debugger_snapshot_t *snapshot)
+{
+    zend_class_entry *ce = Z_OBJCE_P(src);
+    HashTable *properties;
+    int result;
+
+    if (CAPTURE_OBJ_IS_RECURSIVE(src)) {
+        return capture_truncated(dst);
+    }
+
+    object_init_ex(dst, PHP_IC_ENTRY);
+    php_store_class_name(dst, ZSTR_VAL(ce->name), ZSTR_LEN(ce->name));
+
+    properties = Z_OBJ_HT_P(src)->get_properties ? Z_OBJPROP_P(src) : NULL;
+    if (properties == NULL) {
+        return CAPTURE_DETACHED;
+    }
+
+    CAPTURE_OBJ_PROTECT_RECURSION(src);
+    result = capture_members(Z_OBJPROP_P(dst), properties, depth, snapshot);
+    CAPTURE_OBJ_UNPROTECT_RECURSION(src);
+
+    return result | CAPTURE_DETACHED;
+}
+
+/**
+ * Copy `src` into `dst` within the snapshot's capture options. Returns the
+ * CAPTURE_* flags of the copy.
+ */
+static int capture_value(zval *dst, zval *src, zend_long depth, stackdriver_debugger_snapshot_t *snapshot)
+{
+    stackdriver_debugger_capture_options_t *options = &snapshot->capture_options;
+    size_t len;
+
+    ZVAL_DEREF(src);
+
+    switch (Z_TYPE_P(src)) {
         case IS_STRING:
-            /* Use the internal HashTable value */
-            hash = strpprintf(32, "%016zx", ZSTR_HASH(Z_STR(variable->value)));
-            break;
+            len = ZSTR_LEN(Z_STR_P(src));
+            if (options->max_string_length > 0 && len > (size_t)options->max_string_length) {
+                len = (size_t)options->max_string_length;
+            }
+            len = capture_budget(snapshot, len);
+            if (len < ZSTR_LEN(Z_STR_P(src))) {
+                ZVAL_STRINGL(dst, Z_STRVAL_P(src), len);
+                return CAPTURE_TRUNCATED | CAPTURE_DETACHED;
+            }
+            ZVAL_COPY(dst, src);
+            return 0;
+        case IS_ARRAY:
+            return capture_array(dst, src, depth, snapshot);
+        case IS_OBJECT:
+            if (options->max_member_depth > 0 && depth >= options->max_member_depth) {
+                return capture_truncated(dst);
+            }
+            if (capture_budget(snapshot, sizeof(zval)) < sizeof(zval)) {
+                ZVAL_NULL(dst);
+                return CAPTURE_TRUNCATED | CAPTURE_DETACHED;
+            }
+            /* a referenced object would escape the limits, so it is frozen */
+            return capture_object(dst, src, depth, snapshot);
+        default:
+            if (capture_budget(snapshot, sizeof(zval)) < sizeof(zval)) {
+                ZVAL_NULL(dst);
+                return CAPTURE_TRUNCATED | CAPTURE_DETACHED;
+            }
+            ZVAL_COPY(dst, src);
+            return 0;
     }
-    if (hash != NULL) {
-        add_assoc_str(return_value, "id", hash);
+}
+
+/**
+ * Returns the address identifying a string, array or object value for the
+ * variable table, or NULL if the value is not shared by identity.
+ */
+static zend_always_inline void *variable_identity(zval *zv)
+{
+    switch (Z_TYPE_P(zv)) {
+        case IS_STRING:
+        case IS_ARRAY:
+        case IS_OBJECT:
+            return Z_PTR_P(zv);
     }
+    return NULL;
 }
 
-/* Capture a variable with provided name and zval into a collected variable */
-static stackdriver_debugger_variable_t *create_variable(zend_string *name, zval *zv)
+/**
+ * Capture a variable with provided name and zval into the provided slot. The
+ * name is shared rather than duplicated as captured names are never modified.
+ *
+ * A value already captured for another variable of the snapshot (e.g. the same
+ * object passed down several frames) is not captured again; the variable
+ * shares the existing variable table entry instead.
+ */
+static void capture_variable(stackdriver_debugger_variable_t *variable, zend_string *name, zval *zv, stackdriver_debugger_snapshot_t *snapshot)
 {
-    stackdriver_debugger_variable_t *variable = (stackdriver_debugger_variable_t *)emalloc(sizeof(stackdriver_debugger_variable_t));
-    init_variable(variable);
-    variable->name = zend_string_dup(name, 0);
+    stackdriver_debugger_variable_t *owner;
+    void *identity;
+    zval *deref;
+
+    variable->name = zend_string_copy(name);
+    variable->id = NULL;
+    variable->indirect = 0;
+    variable->truncated = 0;
+    variable->var_table_index = STACKDRIVER_DEBUGGER_NO_VAR_TABLE_INDEX;
+    variable->var_table_owner = 0;
 
     /* If the zval is an indirect, dereference it */
     while (Z_TYPE_P(zv) == IS_INDIRECT) {
@@ -169,9 +428,39 @@ static stackdriver_debugger_variable_t *create_variable(zend_string *name, zval
         zv = Z_INDIRECT_P(zv);
     }
 
-    ZVAL_COPY(&variable->value, zv);
+    /* Unset compiled variables are reported as null */
+    if (Z_TYPE_P(zv) == IS_UNDEF) {
+        ZVAL_NULL(&variable->value);
+        return;
+    }
+
+    deref = zv;
+    ZVAL_DEREF(deref);
+    identity = variable_identity(deref);
+    if (identity != NULL) {
+        owner = zend_hash_index_find_ptr(snapshot->var_table_lookup, (zend_ulong)(uintptr_t)identity);
+        if (owner != NULL) {
+            ZVAL_COPY(&variable->value, &owner->value);
+            variable->truncated = owner->truncated;
+            variable->id = owner->id ? zend_string_copy(owner->id) : NULL;
+            variable->var_table_index = owner->var_table_index;
+            return;
+        }
+
+        variable->var_table_index = snapshot->var_table_size++;
+        variable->var_table_owner = 1;
+        zend_hash_index_add_new_ptr(snapshot->var_table_lookup, (zend_ulong)(uintptr_t)identity, variable);
+    }
 
-    return variable;
+    if (CAPTURE_COPIES(&snapshot->capture_options)) {
+        /* Frozen objects keep the identity of the live object */
+        if (Z_TYPE_P(deref) == IS_OBJECT) {
+            variable->id = php_spl_object_hash(deref);
+        }
+        variable->truncated = (capture_value(&variable->value, zv, 0, snapshot) & CAPTURE_TRUNCATED) != 0;
+    } else {
+        ZVAL_COPY(&variable->value, zv);
+    }
 }
 
 /**
@@ -180,23 +469,22 @@ static stackdriver_debugger_variable_t *create_variable(zend_string *name, zval
  */
 static void stackframe_to_zval(zval *return_value, stackdriver_debugger_stackframe_t *stackframe)
 {
-    int i;
+    uint32_t i;
     array_init(return_value);
 
     if (stackframe->function) {
-        add_assoc_str(return_value, "function", zend_string_dup(stackframe->function, 0));
+        add_assoc_str(return_value, "function", zend_string_copy(stackframe->function));
     }
     add_assoc_str(return_value, "filename", zend_string_copy(stackframe->filename));
     add_assoc_long(return_value, "line", stackframe->lineno);
 
     zval locals;
-    array_init(&locals);
-    stackdriver_debugger_variable_t *local_variable;
-    ZEND_HASH_FOREACH_PTR(stackframe->locals, local_variable) {
+    array_init_size(&locals, stackframe->num_locals);
+    for (i = 0; i < stackframe->num_locals; i++) {
         zval local;
-        variable_to_zval(&local, local_variable);
+        variable_to_zval(&local, &stackframe->locals[i]);
         add_next_index_zval(&locals, &local);
-    } ZEND_HASH_FOREACH_END();
+    }
 
     add_assoc_zval(return_value, "locals", &locals);
 }
@@ -207,15 +495,38 @@ static void stackframe_to_zval(zval *return_value, stackdriver_debugger_stackfra
  */
 static void stackframes_to_zval(zval *return_value, stackdriver_debugger_snapshot_t *snapshot)
 {
-    int i;
-    array_init(return_value);
-    stackdriver_debugger_stackframe_t *stackframe;
+    uint32_t i;
+    array_init_size(return_value, snapshot->num_stackframes);
 
-    ZEND_HASH_FOREACH_PTR(snapshot->stackframes, stackframe) {
+    for (i = 0; i < snapshot->num_stackframes; i++) {
         zval zstackframe;
-        stackframe_to_zval(&zstackframe, stackframe);
+        stackframe_to_zval(&zstackframe, &snapshot->stackframes[i]);
         add_next_index_zval(return_value, &zstackframe);
-    } ZEND_HASH_FOREACH_END();
+    }
+}
+
+/**
+ * Convert the shared values of the collected stackframes into an array zval
+ * indexed by each variable's varTableIndex.
+ */
+static void variable_table_to_zval(zval *return_value, stackdriver_debugger_snapshot_t *snapshot)
+{
+    uint32_t i, j;
+    array_init_size(return_value, snapshot->var_table_size);
+
+    /* owners are captured in index order */
+    for (i = 0; i < snapshot->num_stackframes; i++) {
+        stackdriver_debugger_stackframe_t *stackframe = &snapshot->stackframes[i];
+
+        for (j = 0; j < stackframe->num_locals; j++) {
+            stackdriver_debugger_variable_t *variable = &stackframe->locals[j];
+
+            if (variable->var_table_owner) {
+                Z_TRY_ADDREF(variable->value);
+                add_next_index_zval(return_value, &variable->value);
+            }
+        }
+    }
 }
 
 /**
@@ -224,122 +535,257 @@ static void stackframes_to_zval(zval *return_value, stackdriver_debugger_snapsho
 static void expressions_to_zval(zval *return_value, stackdriver_debugger_snapshot_t *snapshot)
 {
     array_init(return_value);
-    zend_hash_copy(Z_ARR_P(return_value), snapshot->evaluated_expressions, NULL);
+    zend_hash_copy(Z_ARR_P(return_value), snapshot->evaluated_expressions, zval_add_ref);
 }
 
 static void snapshot_to_zval(zval *return_value, stackdriver_debugger_snapshot_t *snapshot)
 {
-    zval zstackframes, zexpressions;
+    zval zstackframes, zexpressions, zvariables;
     array_init(return_value);
     stackframes_to_zval(&zstackframes, snapshot);
     expressions_to_zval(&zexpressions, snapshot);
+    variable_table_to_zval(&zvariables, snapshot);
 
-    add_assoc_str(return_value, "id", snapshot->id);
+    add_assoc_str(return_value, "id", zend_string_copy(snapshot->id));
     add_assoc_zval(return_value, "stackframes", &zstackframes);
     add_assoc_zval(return_value, "evaluatedExpressions", &zexpressions);
+    add_assoc_zval(return_value, "variableTable", &zvariables);
 }
 
 /**
- * Given a provided zend_execute_data, find or rebuild the HashTable of
- * local variables at that moment.
+ * Convert a collected snapshot into the value reported to callbacks and
+ * listings: a Breakpoint JSON string if requested, otherwise an array.
  */
-static int execute_data_to_symbol_table(zend_execute_data *execute_data, zend_array **symbol_table_p)
+static void snapshot_to_result(zval *return_value, stackdriver_debugger_snapshot_t *snapshot)
+{
+    if (snapshot->capture_options.json) {
+        smart_str buf = {0};
+        stackdriver_debugger_snapshot_to_json(&buf, snapshot);
+        smart_str_0(&buf);
+        ZVAL_NEW_STR(return_value, buf.s);
+    } else {
+        snapshot_to_zval(return_value, snapshot);
+    }
+}
+
+/* Returns the symbol table attached to the provided frame, if any */
+static zend_always_inline zend_array *frame_symbol_table(zend_execute_data *execute_data)
 {
-    zend_op_array *op_array = &execute_data->func->op_array;
 #if PHP_VERSION_ID < 70100
-    if (execute_data->symbol_table) {
+    return execute_data->symbol_table;
 #else
     if (ZEND_CALL_INFO(execute_data) & ZEND_CALL_HAS_SYMBOL_TABLE) {
-#endif
-        *symbol_table_p = execute_data->symbol_table;
-        return 0;
-    } else {
-        int i;
-        zend_array *symbol_table;
-        ALLOC_HASHTABLE(symbol_table);
-        zend_hash_init(symbol_table, op_array->last_var, NULL, ZVAL_PTR_DTOR, 0);
-        zend_string *name;
-
-        for (i = 0; i < op_array->last_var; i++) {
-            zval copy, *var;
-            name = op_array->vars[i];
-            var = ZEND_CALL_VAR_NUM(execute_data, i);
-            if (Z_TYPE_P(var) == IS_UNDEF) {
-                ZVAL_NULL(&copy);
-            } else {
-                ZVAL_COPY(&copy, ZEND_CALL_VAR_NUM(execute_data, i));
-            }
-            zend_hash_add(symbol_table, name, &copy);
-        }
-
-        *symbol_table_p = symbol_table;
-        return 1;
+        return execute_data->symbol_table;
     }
+    return NULL;
+#endif
 }
 
 /**
  * Capture all local variables at the given execution scope from `execute_data`
- * into the provided stackframe struct.
+ * into the provided stackframe struct. The variables are stored contiguously
+ * in the snapshot arena.
+ *
+ * Frames with an attached symbol table (which already references the CVs as
+ * indirect slots) are read from the table. Otherwise the compiled variables
+ * are read straight from the frame, reusing the interned CV names. If the
+ * snapshot has a watch list, only the watched variables are captured.
  */
-static void capture_locals(zend_execute_data *execute_data, stackdriver_debugger_stackframe_t *stackframe)
+static void capture_locals(zend_execute_data *execute_data, stackdriver_debugger_stackframe_t *stackframe, stackdriver_debugger_snapshot_t *snapshot)
 {
-    zend_array *symbol_table;
+    zend_op_array *op_array = &execute_data->func->op_array;
+    zend_array *symbol_table = frame_symbol_table(execute_data);
+    HashTable *watched = snapshot->capture_variables;
     zend_string *name;
     zval *value;
-    int i = 0;
-    int allocated = execute_data_to_symbol_table(execute_data, &symbol_table);
+    uint32_t i = 0, count;
 
-    ZEND_HASH_FOREACH_STR_KEY_VAL(symbol_table, name, value) {
-        stackdriver_debugger_variable_t *local = create_variable(name, value);
-        zend_hash_next_index_insert_ptr(stackframe->locals, local);
-    } ZEND_HASH_FOREACH_END();
+    if (symbol_table) {
+        count = zend_hash_num_elements(symbol_table);
+    } else {
+        count = (uint32_t)op_array->last_var;
+    }
+    if (watched != NULL && zend_hash_num_elements(watched) < count) {
+        count = zend_hash_num_elements(watched);
+    }
+    if (count == 0) {
+        return;
+    }
+    stackframe->locals = zend_arena_alloc(&snapshot->arena, count * sizeof(stackdriver_debugger_variable_t));
 
-    /* Free symbol table if necessary (potential memory leak) */
-    if (allocated != 0) {
-        zend_hash_destroy(symbol_table);
-        FREE_HASHTABLE(symbol_table);
+    if (symbol_table) {
+        ZEND_HASH_FOREACH_STR_KEY_VAL(symbol_table, name, value) {
+            if (name == NULL || (watched != NULL && !zend_hash_exists(watched, name))) {
+                continue;
+            }
+            capture_variable(&stackframe->locals[i++], name, value, snapshot);
+        } ZEND_HASH_FOREACH_END();
+    } else {
+        uint32_t j;
+
+        for (j = 0; j < (uint32_t)op_array->last_var; j++) {
+            name = op_array->vars[j];
+            if (watched != NULL && !zend_hash_exists(watched, name)) {
+                continue;
+            }
+            capture_variable(&stackframe->locals[i++], name, ZEND_CALL_VAR_NUM(execute_data, j), snapshot);
+        }
     }
+    stackframe->num_locals = i;
 }
 
 /**
- * Capture the execution state from `execute_data`
+ * Capture the execution state from `execute_data` into the provided
+ * stackframe slot.
  */
-static stackdriver_debugger_stackframe_t *execute_data_to_stackframe(zend_execute_data *execute_data, int capture_variables)
+static void execute_data_to_stackframe(zend_execute_data *execute_data, stackdriver_debugger_stackframe_t *stackframe, stackdriver_debugger_snapshot_t *snapshot, int capture_variables)
 {
-    stackdriver_debugger_stackframe_t *stackframe;
-    zend_op_array *op_array;
-    zend_string *funcname;
-
-    if (!execute_data->func || !ZEND_USER_CODE(execute_data->func->common.type)) {
-        return NULL;
-    }
-    stackframe = (stackdriver_debugger_stackframe_t *)emalloc(sizeof(stackdriver_debugger_stackframe_t));
-    init_stackframe(stackframe);
-
-    op_array = &execute_data->func->op_array;
-    funcname = op_array->function_name;
+    zend_op_array *op_array = &execute_data->func->op_array;
 
     stackframe->function = NULL;
-    if (funcname != NULL) {
-        stackframe->function = zend_string_copy(funcname);
+    if (op_array->function_name != NULL) {
+        stackframe->function = zend_string_copy(op_array->function_name);
     }
     stackframe->filename = zend_string_copy(op_array->filename);
     stackframe->lineno = execute_data->opline->lineno;
+    stackframe->locals = NULL;
+    stackframe->num_locals = 0;
 
     if (capture_variables == 1) {
-        capture_locals(execute_data, stackframe);
+        capture_locals(execute_data, stackframe, snapshot);
     }
+}
 
-    return stackframe;
+/**
+ * Add the variables referenced by the snapshot condition and expressions to
+ * the snapshot watch list. Returns FAILURE if they cannot all be determined.
+ */
+static int add_referenced_variables(stackdriver_debugger_snapshot_t *snapshot)
+{
+    zval *expression;
+
+    if (snapshot->condition != NULL &&
+        stackdriver_debugger_statement_variables(snapshot->condition, snapshot->capture_variables) != SUCCESS) {
+        return FAILURE;
+    }
+
+    ZEND_HASH_FOREACH_VAL(snapshot->expressions, expression) {
+        if (stackdriver_debugger_statement_variables(Z_STR_P(expression), snapshot->capture_variables) != SUCCESS) {
+            return FAILURE;
+        }
+    } ZEND_HASH_FOREACH_END();
+
+    return SUCCESS;
+}
+
+/**
+ * Build the snapshot watch list from the captureVariables option: a list of
+ * variable names, "*" for all variables or "auto" for the variables
+ * referenced by the condition and expressions, or all variables if there are
+ * neither. A NULL watch list captures all variables. Returns FAILURE for an
+ * invalid option.
+ */
+static int build_capture_variables(stackdriver_debugger_snapshot_t *snapshot, zval *capture_variables)
+{
+    zval *name;
+    int invalid = 0;
+
+    if (capture_variables == NULL || Z_TYPE_P(capture_variables) == IS_NULL) {
+        return SUCCESS;
+    }
+
+    if (Z_TYPE_P(capture_variables) == IS_STRING) {
+        if (zend_string_equals_literal(Z_STR_P(capture_variables), "*")) {
+            return SUCCESS;
+        }
+
+        /* with nothing to reference, "auto" captures all variables */
+        if (zend_string_equals_literal(Z_STR_P(capture_variables), "auto") &&
+            snapshot->condition == NULL && zend_hash_num_elements(snapshot->expressions) == 0) {
+            return SUCCESS;
+        }
+        if (zend_string_equals_literal(Z_STR_P(capture_variables), "auto")) {
+            ALLOC_HASHTABLE(snapshot->capture_variables);
+            zend_hash_init(snapshot->capture_variables, 8, NULL, NULL, 0);
+
+            /* fall back to all variables if the references are not static */
+            if (add_referenced_variables(snapshot) != SUCCESS) {
+                zend_hash_destroy(snapshot->capture_variables);
+                FREE_HASHTABLE(snapshot->capture_variables);
+                snapshot->capture_variables = NULL;
+            }
+            return SUCCESS;
+        }
+    } else if (Z_TYPE_P(capture_variables) == IS_ARRAY) {
+        ALLOC_HASHTABLE(snapshot->capture_variables);
+        zend_hash_init(snapshot->capture_variables, zend_hash_num_elements(Z_ARRVAL_P(capture_variables)), NULL, NULL, 0);
+
+        ZEND_HASH_FOREACH_VAL(Z_ARRVAL_P(capture_variables), name) {
+            if (Z_TYPE_P(name) != IS_STRING) {
+                invalid = 1;
+                break;
+            }
+            if (zend_string_equals_literal(Z_STR_P(name), "*")) {
+                zend_hash_destroy(snapshot->capture_variables);
+                FREE_HASHTABLE(snapshot->capture_variables);
+                snapshot->capture_variables = NULL;
+                return SUCCESS;
+            }
+
+            /* accept both "$name" and "name" */
+            if (Z_STRLEN_P(name) > 1 && Z_STRVAL_P(name)[0] == '$') {
+                zend_hash_str_add_empty_element(snapshot->capture_variables, Z_STRVAL_P(name) + 1, Z_STRLEN_P(name) - 1);
+            } else {
+                zend_hash_add_empty_element(snapshot->capture_variables, Z_STR_P(name));
+            }
+        } ZEND_HASH_FOREACH_END();
+
+        if (!invalid) {
+            return SUCCESS;
+        }
+    }
+
+    php_error_docref(NULL, E_WARNING, "captureVariables must be a list of variable names, \"*\" or \"auto\".");
+    return FAILURE;
+}
+
+/**
+ * Resolve the snapshot's callback once so the hit can call it directly
+ * without looking the callable up again.
+ */
+static int resolve_snapshot_callback(stackdriver_debugger_snapshot_t *snapshot, zval *callback)
+{
+    return stackdriver_debugger_resolve_callback(callback, "snapshot", &snapshot->callback,
+        &snapshot->callback_fci, &snapshot->callback_fcc);
 }
 
 /**
  * Registers a snapshot for recording. We store the snapshot configuration in a
  * request global HashTable by file which is consulted during file compilation.
+ * The snapshot takes ownership of the provided path filter, even on failure.
  */
 int register_snapshot(zend_string *snapshot_id, zend_string *filename,
     zend_long lineno, zend_string *condition, HashTable *expressions,
-    zval *callback, zend_long max_stack_eval_depth)
+    zval *callback, zend_long max_stack_eval_depth,
+    stackdriver_debugger_capture_options_t *capture_options,
+    zval *capture_variables, stackdriver_debugger_path_filter_t *path_filter)
+{
+    return register_snapshot_ex(snapshot_id, filename, lineno, condition,
+        expressions, callback, max_stack_eval_depth, capture_options,
+        capture_variables, path_filter, 0);
+}
+
+/**
+ * Registers a snapshot for recording. If `validated` is set, the condition and
+ * expressions are known to be valid debugger statements and are not checked
+ * again.
+ */
+int register_snapshot_ex(zend_string *snapshot_id, zend_string *filename,
+    zend_long lineno, zend_string *condition, HashTable *expressions,
+    zval *callback, zend_long max_stack_eval_depth,
+    stackdriver_debugger_capture_options_t *capture_options,
+    zval *capture_variables, stackdriver_debugger_path_filter_t *path_filter,
+    zend_bool validated)
 {
     HashTable *snapshots;
     stackdriver_debugger_snapshot_t *snapshot;
@@ -350,13 +796,19 @@ int register_snapshot(zend_string *snapshot_id, zend_string *filename,
     if (snapshot_id == NULL) {
         snapshot->id = generate_breakpoint_id();
     } else {
+        /* generated ids differ per request, so only provided ids are claimed */
         snapshot->id = zend_string_copy(snapshot_id);
+        snapshot->claimable = 1;
     }
     snapshot->filename = zend_string_copy(filename);
     snapshot->lineno = lineno;
     snapshot->max_stack_eval_depth = max_stack_eval_depth;
+    snapshot->path_filter = path_filter;
+    if (capture_options != NULL) {
+        snapshot->capture_options = *capture_options;
+    }
     if (condition != NULL && ZSTR_LEN(condition) > 0) {
-        if (valid_debugger_statement(condition) != SUCCESS) {
+        if (!validated && valid_debugger_statement(condition) != SUCCESS) {
             destroy_snapshot(snapshot);
             return FAILURE;
         }
@@ -367,15 +819,21 @@ int register_snapshot(zend_string *snapshot_id, zend_string *filename,
         zval *expression;
 
         ZEND_HASH_FOREACH_VAL(expressions, expression) {
-            if (valid_debugger_statement(Z_STR_P(expression)) != SUCCESS) {
+            if (!validated && valid_debugger_statement(Z_STR_P(expression)) != SUCCESS) {
                 destroy_snapshot(snapshot);
                 return FAILURE;
             }
+            Z_TRY_ADDREF_P(expression);
             zend_hash_next_index_insert(snapshot->expressions, expression);
         } ZEND_HASH_FOREACH_END();
     }
-    if (callback != NULL) {
-        ZVAL_COPY(&snapshot->callback, callback);
+    if (build_capture_variables(snapshot, capture_variables) != SUCCESS) {
+        destroy_snapshot(snapshot);
+        return FAILURE;
+    }
+    if (callback != NULL && resolve_snapshot_callback(snapshot, callback) != SUCCESS) {
+        destroy_snapshot(snapshot);
+        return FAILURE;
     }
 
     snapshots = zend_hash_find_ptr(STACKDRIVER_DEBUGGER_G(snapshots_by_file), filename);
@@ -386,32 +844,66 @@ int register_snapshot(zend_string *snapshot_id, zend_string *filename,
     }
 
     zend_hash_next_index_insert_ptr(snapshots, snapshot);
+    stackdriver_debugger_probe_bind(STACKDRIVER_DEBUGGER_PROBE_SNAPSHOT, snapshot->id, snapshot);
     zend_hash_update_ptr(STACKDRIVER_DEBUGGER_G(snapshots_by_id), snapshot->id, snapshot);
 
     return SUCCESS;
 }
 
+/* Returns whether the provided frame is user code that should be captured */
+static zend_always_inline int is_user_frame(zend_execute_data *execute_data)
+{
+    return execute_data->func && ZEND_USER_CODE(execute_data->func->common.type);
+}
+
 /**
- * Capture the full execution state into the provided snapshot
+ * Capture the full execution state into the provided snapshot. All frames and
+ * variables are allocated from a single per-snapshot arena.
  */
 static void capture_execution_state(zend_execute_data *execute_data, stackdriver_debugger_snapshot_t *snapshot)
 {
-    zend_execute_data *ptr = execute_data;
-    stackdriver_debugger_stackframe_t *stackframe;
-    int i = 0;
+    zend_execute_data *ptr;
+    uint32_t count = 0, i = 0;
+    size_t arena_size;
 
-    while (ptr) {
-        if (snapshot->max_stack_eval_depth == 0 || i < snapshot->max_stack_eval_depth) {
-            stackframe = execute_data_to_stackframe(ptr, 1);
-        } else {
-            stackframe = execute_data_to_stackframe(ptr, 0);
+    for (ptr = execute_data; ptr; ptr = ptr->prev_execute_data) {
+        if (is_user_frame(ptr)) {
+            count++;
         }
-        if (stackframe != NULL) {
-            zend_hash_next_index_insert_ptr(snapshot->stackframes, stackframe);
-            i++;
+    }
+    if (count == 0) {
+        return;
+    }
+
+    arena_size = ZEND_MM_ALIGNED_SIZE(sizeof(zend_arena)) + count * STACKDRIVER_DEBUGGER_ARENA_FRAME_SIZE;
+    if (arena_size < STACKDRIVER_DEBUGGER_ARENA_MIN_SIZE) {
+        arena_size = STACKDRIVER_DEBUGGER_ARENA_MIN_SIZE;
+    }
+    snapshot->arena = zend_arena_create(arena_size);
+    snapshot->stackframes = zend_arena_alloc(&snapshot->arena, count * sizeof(stackdriver_debugger_stackframe_t));
+
+    ALLOC_HASHTABLE(snapshot->var_table_lookup);
+    zend_hash_init(snapshot->var_table_lookup, 32, NULL, NULL, 0);
+
+    for (ptr = execute_data; ptr && i < count; ptr = ptr->prev_execute_data) {
+        if (!is_user_frame(ptr)) {
+            continue;
         }
-        ptr = ptr->prev_execute_data;
+        /* filtered out frames still count toward max_stack_eval_depth */
+        execute_data_to_stackframe(
+            ptr,
+            &snapshot->stackframes[i],
+            snapshot,
+            (snapshot->max_stack_eval_depth == 0 || i < snapshot->max_stack_eval_depth) &&
+                (snapshot->path_filter == NULL ||
+                 stackdriver_debugger_path_filter_match(snapshot->path_filter, ptr->func->op_array.filename))
+        );
+        snapshot->num_stackframes = ++i;
     }
+
+    zend_hash_destroy(snapshot->var_table_lookup);
+    FREE_HASHTABLE(snapshot->var_table_lookup);
+    snapshot->var_table_lookup = NULL;
 }
 
 /**
@@ -425,7 +917,7 @@ static void capture_expressions(zend_execute_data *execute_data, stackdriver_deb
     ZEND_HASH_FOREACH_VAL(snapshot->expressions, expression) {
         zval retval;
 
-        if (zend_eval_string(Z_STRVAL_P(expression), &retval, "expression evaluation") == SUCCESS) {
+        if (evaluate_debugger_statement(Z_STR_P(expression), &retval, "expression evaluation") == SUCCESS) {
             zend_hash_add(snapshot->evaluated_expressions, Z_STR_P(expression), &retval);
         } else {
             ZVAL_STRING(&retval, "ERROR");
@@ -434,17 +926,329 @@ static void capture_expressions(zend_execute_data *execute_data, stackdriver_deb
     } ZEND_HASH_FOREACH_END();
 }
 
-static int handle_snapshot_callback(zval *callback, stackdriver_debugger_snapshot_t *snapshot)
+/* StackdriverDebugger\Snapshot */
+zend_class_entry *stackdriver_debugger_snapshot_ce;
+static zend_object_handlers snapshot_object_handlers;
+
+/**
+ * Object passed to snapshot callbacks. Each top level field of the snapshot
+ * array (id, stackframes, evaluatedExpressions, variableTable) is only
+ * converted from the collected snapshot when it is first accessed.
+ */
+typedef struct snapshot_object_t {
+    /* referenced collected snapshot, NULL if constructed from userland */
+    stackdriver_debugger_snapshot_t *snapshot;
+
+    /* array of the fields converted so far */
+    zval fields;
+
+    /* whether every field has been converted, in snapshot array order */
+    zend_bool complete;
+
+    zend_object std;
+} snapshot_object_t;
+
+#define Z_SNAPSHOT_OBJ_P(zv) \
+    ((snapshot_object_t *)((char *)Z_OBJ_P(zv) - XtOffsetOf(snapshot_object_t, std)))
+
+/* Release a reference to a snapshot, destroying it with the last reference */
+static void release_snapshot(stackdriver_debugger_snapshot_t *snapshot)
+{
+    if (--snapshot->refcount == 0) {
+        destroy_snapshot(snapshot);
+    }
+}
+
+/**
+ * Convert the snapshot field `key` into `field`. Returns FAILURE if `key` is
+ * not a snapshot field.
+ */
+static int snapshot_field_to_zval(zval *field, stackdriver_debugger_snapshot_t *snapshot, zend_string *key)
+{
+    if (zend_string_equals_literal(key, "id")) {
+        ZVAL_STR_COPY(field, snapshot->id);
+    } else if (zend_string_equals_literal(key, "stackframes")) {
+        stackframes_to_zval(field, snapshot);
+    } else if (zend_string_equals_literal(key, "evaluatedExpressions")) {
+        expressions_to_zval(field, snapshot);
+    } else if (zend_string_equals_literal(key, "variableTable")) {
+        variable_table_to_zval(field, snapshot);
+    } else {
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/* Find the field `key`, converting it on first access */
+static zval *snapshot_object_field(snapshot_object_t *intern, zend_string *key)
+{
+    zval *field, converted;
+
+    field = zend_hash_find(Z_ARRVAL(intern->fields), key);
+    if (field != NULL || intern->complete || intern->snapshot == NULL) {
+        return field;
+    }
+
+    if (snapshot_field_to_zval(&converted, intern->snapshot, key) != SUCCESS) {
+        return NULL;
+    }
+    return zend_hash_add_new(Z_ARRVAL(intern->fields), key, &converted);
+}
+
+/* Convert all remaining fields, ordered as in the snapshot array */
+static void snapshot_object_complete(snapshot_object_t *intern)
+{
+    static const char *names[] = {"id", "stackframes", "evaluatedExpressions", "variableTable"};
+    zval fields, *field;
+    zend_string *key;
+    int i;
+
+    if (intern->complete) {
+        return;
+    }
+    if (intern->snapshot != NULL) {
+        array_init_size(&fields, 4);
+        for (i = 0; i < 4; i++) {
+            key = zend_string_init(names[i], strlen(names[i]), 0);
+            field = snapshot_object_field(intern, key);
+            Z_TRY_ADDREF_P(field);
+            zend_hash_add_new(Z_ARRVAL(fields), key, field);
+            zend_string_release(key);
+        }
+        zval_ptr_dtor(&intern->fields);
+        ZVAL_COPY_VALUE(&intern->fields, &fields);
+    }
+    intern->complete = 1;
+}
+
+static zend_object *snapshot_object_create(zend_class_entry *ce)
+{
+    snapshot_object_t *intern = ecalloc(1, sizeof(snapshot_object_t) + zend_object_properties_size(ce));
+
+    zend_object_std_init(&intern->std, ce);
+    object_properties_init(&intern->std, ce);
+    intern->std.handlers = &snapshot_object_handlers;
+    intern->snapshot = NULL;
+    intern->complete = 0;
+    array_init(&intern->fields);
+
+    return &intern->std;
+}
+
+static void snapshot_object_free(zend_object *object)
+{
+    snapshot_object_t *intern = (snapshot_object_t *)((char *)object - XtOffsetOf(snapshot_object_t, std));
+
+    zval_ptr_dtor(&intern->fields);
+    if (intern->snapshot != NULL) {
+        release_snapshot(intern->snapshot);
+    }
+    zend_object_std_dtor(object);
+}
+
+/* Expose the converted fields to the cycle collector */
+static HashTable *snapshot_object_get_gc(zval *object, zval **table, int *n)
+{
+    snapshot_object_t *intern = Z_SNAPSHOT_OBJ_P(object);
+
+    *table = &intern->fields;
+    *n = 1;
+    return zend_std_get_properties(object);
+}
+
+static HashTable *snapshot_object_get_debug_info(zval *object, int *is_temp)
+{
+    snapshot_object_t *intern = Z_SNAPSHOT_OBJ_P(object);
+
+    snapshot_object_complete(intern);
+    *is_temp = 1;
+    return zend_array_dup(Z_ARRVAL(intern->fields));
+}
+
+/* Create a StackdriverDebugger\Snapshot referencing the collected snapshot */
+static void snapshot_to_object(zval *return_value, stackdriver_debugger_snapshot_t *snapshot)
+{
+    object_init_ex(return_value, stackdriver_debugger_snapshot_ce);
+    Z_SNAPSHOT_OBJ_P(return_value)->snapshot = snapshot;
+    snapshot->refcount++;
+}
+
+/* {{{ proto bool StackdriverDebugger\Snapshot::offsetExists(mixed $offset) */
+static PHP_METHOD(Snapshot, offsetExists)
+{
+    zend_string *key;
+    zval *field;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "S", &key) == FAILURE) {
+        return;
+    }
+
+    field = snapshot_object_field(Z_SNAPSHOT_OBJ_P(getThis()), key);
+    RETURN_BOOL(field != NULL && Z_TYPE_P(field) != IS_NULL);
+}
+/* }}} */
+
+/* {{{ proto mixed StackdriverDebugger\Snapshot::offsetGet(mixed $offset) */
+static PHP_METHOD(Snapshot, offsetGet)
+{
+    zend_string *key;
+    zval *field;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "S", &key) == FAILURE) {
+        return;
+    }
+
+    field = snapshot_object_field(Z_SNAPSHOT_OBJ_P(getThis()), key);
+    if (field == NULL) {
+        php_error_docref(NULL, E_NOTICE, "Undefined index: %s", ZSTR_VAL(key));
+        RETURN_NULL();
+    }
+    RETURN_ZVAL(field, 1, 0);
+}
+/* }}} */
+
+/* {{{ proto void StackdriverDebugger\Snapshot::offsetSet(mixed $offset, mixed $value) */
+static PHP_METHOD(Snapshot, offsetSet)
+{
+    snapshot_object_t *intern = Z_SNAPSHOT_OBJ_P(getThis());
+    zval *offset, *value;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "zz", &offset, &value) == FAILURE) {
+        return;
+    }
+
+    snapshot_object_complete(intern);
+    Z_TRY_ADDREF_P(value);
+    if (Z_TYPE_P(offset) == IS_NULL) {
+        zend_hash_next_index_insert(Z_ARRVAL(intern->fields), value);
+    } else {
+        zend_string *key = zval_get_string(offset);
+        zend_symtable_update(Z_ARRVAL(intern->fields), key, value);
+        zend_string_release(key);
+    }
+}
+/* }}} */
+
+/* {{{ proto void StackdriverDebugger\Snapshot::offsetUnset(mixed $offset) */
+static PHP_METHOD(Snapshot, offsetUnset)
+{
+    snapshot_object_t *intern = Z_SNAPSHOT_OBJ_P(getThis());
+    zend_string *key;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "S", &key) == FAILURE) {
+        return;
+    }
+
+    snapshot_object_complete(intern);
+    zend_symtable_del(Z_ARRVAL(intern->fields), key);
+}
+/* }}} */
+
+/* {{{ proto ArrayIterator StackdriverDebugger\Snapshot::getIterator() */
+static PHP_METHOD(Snapshot, getIterator)
+{
+    snapshot_object_t *intern = Z_SNAPSHOT_OBJ_P(getThis());
+
+    if (zend_parse_parameters_none() == FAILURE) {
+        return;
+    }
+
+    snapshot_object_complete(intern);
+    object_init_ex(return_value, spl_ce_ArrayIterator);
+    zend_call_method_with_1_params(return_value, spl_ce_ArrayIterator, &spl_ce_ArrayIterator->constructor, "__construct", NULL, &intern->fields);
+}
+/* }}} */
+
+/* {{{ proto array StackdriverDebugger\Snapshot::toArray() */
+static PHP_METHOD(Snapshot, toArray)
+{
+    snapshot_object_t *intern = Z_SNAPSHOT_OBJ_P(getThis());
+
+    if (zend_parse_parameters_none() == FAILURE) {
+        return;
+    }
+
+    snapshot_object_complete(intern);
+    RETURN_ZVAL(&intern->fields, 1, 0);
+}
+/* }}} */
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_snapshot_offset, 0, 0, 1)
+    ZEND_ARG_INFO(0, offset)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_snapshot_offset_set, 0, 0, 2)
+    ZEND_ARG_INFO(0, offset)
+    ZEND_ARG_INFO(0, value)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_snapshot_void, 0, 0, 0)
+ZEND_END_ARG_INFO()
+
+static const zend_function_entry snapshot_methods[] = {
+    PHP_ME(Snapshot, offsetExists, arginfo_snapshot_offset, ZEND_ACC_PUBLIC)
+    PHP_ME(Snapshot, offsetGet, arginfo_snapshot_offset, ZEND_ACC_PUBLIC)
+    PHP_ME(Snapshot, offsetSet, arginfo_snapshot_offset_set, ZEND_ACC_PUBLIC)
+    PHP_ME(Snapshot, offsetUnset, arginfo_snapshot_offset, ZEND_ACC_PUBLIC)
+    PHP_ME(Snapshot, getIterator, arginfo_snapshot_void, ZEND_ACC_PUBLIC)
+    PHP_ME(Snapshot, toArray, arginfo_snapshot_void, ZEND_ACC_PUBLIC)
+    PHP_FE_END
+};
+
+/* Returns whether the callback declares its first parameter as an array */
+static zend_bool callback_expects_array(zend_fcall_info_cache *fcc)
+{
+    zend_function *func = fcc->function_handler;
+
+    if (func == NULL || func->common.num_args == 0 || func->common.arg_info == NULL) {
+        return 0;
+    }
+#if PHP_VERSION_ID < 70200
+    return func->common.arg_info[0].type_hint == IS_ARRAY;
+#else
+    return ZEND_TYPE_CODE(func->common.arg_info[0].type) == IS_ARRAY;
+#endif
+}
+
+/**
+ * Call the snapshot's callback with the snapshot: a Snapshot object, unless
+ * the snapshot is reported as JSON or the callback only accepts an array.
+ */
+static int handle_snapshot_callback(stackdriver_debugger_snapshot_t *snapshot)
 {
     zval zsnapshot, callback_result;
-    snapshot_to_zval(&zsnapshot, snapshot);
-    int call_result = call_user_function_ex(EG(function_table), NULL, callback, &callback_result, 1, &zsnapshot, 0, NULL);
+    zend_fcall_info fci = snapshot->callback_fci;
+    int call_result;
 
-    ZVAL_DESTRUCTOR(&zsnapshot);
-    ZVAL_DESTRUCTOR(&callback_result);
+    if (snapshot->capture_options.json || callback_expects_array(&snapshot->callback_fcc)) {
+        snapshot_to_result(&zsnapshot, snapshot);
+    } else {
+        snapshot_to_object(&zsnapshot, snapshot);
+    }
+
+    ZVAL_UNDEF(&callback_result);
+    fci.retval = &callback_result;
+    fci.params = &zsnapshot;
+    fci.param_count = 1;
+
+    call_result = zend_call_function(&fci, &snapshot->callback_fcc);
+
+    zval_ptr_dtor(&zsnapshot);
+    zval_ptr_dtor(&callback_result);
     return call_result;
 }
 
+/**
+ * Warn that the snapshot's callback failed. Probes run in the frame of the user
+ * code being debugged, so the warning is attributed to
+ * stackdriver_debugger_snapshot() as it was when breakpoints were injected as
+ * calls to it.
+ */
+static void snapshot_callback_error()
+{
+    zend_error(E_WARNING, "stackdriver_debugger_snapshot(): Error running snapshot callback.");
+}
+
 /**
  * Evaluate the provided snapshot in the provided execution scope.
  */
@@ -463,12 +1267,14 @@ void evaluate_snapshot(zend_execute_data *execute_data, stackdriver_debugger_sna
 
     /* record as collected */
     if (Z_TYPE(snapshot->callback) != IS_NULL) {
-        if (handle_snapshot_callback(&snapshot->callback, snapshot) != SUCCESS) {
-            php_error_docref(NULL, E_WARNING, "Error running snapshot callback.");
+        if (handle_snapshot_callback(snapshot) != SUCCESS) {
+            snapshot_callback_error();
+        } else if (EG(exception) == NULL) {
+            snapshot->claimed = 0;
         }
         if (EG(exception) != NULL) {
             zend_clear_exception();
-            php_error_docref(NULL, E_WARNING, "Error running snapshot callback.");
+            snapshot_callback_error();
         }
     } else {
         zend_hash_update_ptr(STACKDRIVER_DEBUGGER_G(collected_snapshots_by_id), snapshot->id, snapshot);
@@ -483,8 +1289,11 @@ void list_snapshots(zval *return_value)
     stackdriver_debugger_snapshot_t *snapshot;
     ZEND_HASH_FOREACH_PTR(STACKDRIVER_DEBUGGER_G(collected_snapshots_by_id), snapshot) {
         zval zsnapshot;
-        snapshot_to_zval(&zsnapshot, snapshot);
+        snapshot_to_result(&zsnapshot, snapshot);
         add_next_index_zval(return_value, &zsnapshot);
+
+        /* handed off, so the claim is kept */
+        snapshot->claimed = 0;
     } ZEND_HASH_FOREACH_END();
 }
 
@@ -496,7 +1305,7 @@ void list_snapshots(zval *return_value)
 static void snapshot_dtor(zval *zv)
 {
     stackdriver_debugger_snapshot_t *snapshot = (stackdriver_debugger_snapshot_t *)Z_PTR_P(zv);
-    destroy_snapshot(snapshot);
+    release_snapshot(snapshot);
     ZVAL_PTR_DTOR(zv);
 }
 
@@ -539,3 +1348,30 @@ int stackdriver_debugger_snapshot_rshutdown(TSRMLS_D)
 
     return SUCCESS;
 }
+
+/**
+ * Module initialization lifecycle hook. Registers the StackdriverDebugger\Snapshot
+ * class passed to snapshot callbacks and interns the truncation marker.
+ */
+int stackdriver_debugger_snapshot_minit(INIT_FUNC_ARGS)
+{
+    zend_class_entry ce;
+
+    stackdriver_debugger_truncated_marker = zend_new_interned_string(zend_string_init(
+        STACKDRIVER_DEBUGGER_TRUNCATED_MARKER, sizeof(STACKDRIVER_DEBUGGER_TRUNCATED_MARKER) - 1, 1));
+
+    INIT_NS_CLASS_ENTRY(ce, "StackdriverDebugger", "Snapshot", snapshot_methods);
+    stackdriver_debugger_snapshot_ce = zend_register_internal_class(&ce);
+    stackdriver_debugger_snapshot_ce->ce_flags |= ZEND_ACC_FINAL;
+    stackdriver_debugger_snapshot_ce->create_object = snapshot_object_create;
+    zend_class_implements(stackdriver_debugger_snapshot_ce, 2, zend_ce_arrayaccess, zend_ce_aggregate);
+
+    memcpy(&snapshot_object_handlers, zend_get_std_object_handlers(), sizeof(zend_object_handlers));
+    snapshot_object_handlers.offset = XtOffsetOf(snapshot_object_t, std);
+    snapshot_object_handlers.free_obj = snapshot_object_free;
+    snapshot_object_handlers.clone_obj = NULL;
+    snapshot_object_handlers.get_debug_info = snapshot_object_get_debug_info;
+    snapshot_object_handlers.get_gc = snapshot_object_get_gc;
+
+    return SUCCESS;
+}
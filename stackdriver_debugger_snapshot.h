@@ -18,20 +18,83 @@
 #define PHP_STACKDRIVER_DEBUGGER_SNAPSHOT_H 1
 
 #include "php.h"
+#include "zend_arena.h"
+#include "stackdriver_debugger_path_filter.h"
 
 typedef struct stackdriver_debugger_variable_t {
     zend_string *name;
     zval value;
     int indirect;
+
+    /* identity of the live value when it differs from the captured copy */
+    zend_string *id;
+
+    /* whether the captured value was cut short by the capture options */
+    zend_bool truncated;
+
+    /*
+     * index of the value in the snapshot variable table, or
+     * STACKDRIVER_DEBUGGER_NO_VAR_TABLE_INDEX for values not shared by identity
+     */
+    uint32_t var_table_index;
+
+    /* whether this variable holds the variable table entry for its value */
+    zend_bool var_table_owner;
 } stackdriver_debugger_variable_t;
 
+#define STACKDRIVER_DEBUGGER_NO_VAR_TABLE_INDEX ((uint32_t)-1)
+
+/* Captured in place of an array or object cut off by the depth limit or recursion */
+#define STACKDRIVER_DEBUGGER_TRUNCATED_MARKER "[truncated]"
+
+/* Recursion guards for walking captured arrays and objects */
+#if PHP_VERSION_ID < 70300
+#define CAPTURE_PROTECTED(ht) ZEND_HASH_APPLY_PROTECTION(ht)
+#define CAPTURE_IS_RECURSIVE(ht) (ZEND_HASH_GET_APPLY_COUNT(ht) > 0)
+#define CAPTURE_PROTECT_RECURSION(ht) ZEND_HASH_INC_APPLY_COUNT(ht)
+#define CAPTURE_UNPROTECT_RECURSION(ht) ZEND_HASH_DEC_APPLY_COUNT(ht)
+#define CAPTURE_OBJ_IS_RECURSIVE(zv) (Z_OBJ_APPLY_COUNT_P(zv) > 0)
+#define CAPTURE_OBJ_PROTECT_RECURSION(zv) Z_OBJ_INC_APPLY_COUNT_P(zv)
+#define CAPTURE_OBJ_UNPROTECT_RECURSION(zv) Z_OBJ_DEC_APPLY_COUNT_P(zv)
+#else
+#define CAPTURE_PROTECTED(ht) (!(GC_FLAGS(ht) & GC_IMMUTABLE))
+#define CAPTURE_IS_RECURSIVE(ht) GC_IS_RECURSIVE(ht)
+#define CAPTURE_PROTECT_RECURSION(ht) GC_PROTECT_RECURSION(ht)
+#define CAPTURE_UNPROTECT_RECURSION(ht) GC_UNPROTECT_RECURSION(ht)
+#define CAPTURE_OBJ_IS_RECURSIVE(zv) GC_IS_RECURSIVE(Z_OBJ_P(zv))
+#define CAPTURE_OBJ_PROTECT_RECURSION(zv) GC_PROTECT_RECURSION(Z_OBJ_P(zv))
+#define CAPTURE_OBJ_UNPROTECT_RECURSION(zv) GC_UNPROTECT_RECURSION(Z_OBJ_P(zv))
+#endif
+
+/* Options applied when copying captured values, 0 means no limit */
+typedef struct stackdriver_debugger_capture_options_t {
+    /* copy object properties at hit time instead of referencing objects */
+    zend_bool freeze_objects;
+
+    /* report the snapshot as Breakpoint JSON instead of an array */
+    zend_bool json;
+
+    /* levels of array members captured below each variable */
+    zend_long max_member_depth;
+
+    /* members captured per array */
+    zend_long max_members;
+
+    /* bytes captured per string */
+    zend_long max_string_length;
+
+    /* approximate bytes captured for the whole snapshot */
+    zend_long max_total_bytes;
+} stackdriver_debugger_capture_options_t;
+
 typedef struct stackdriver_debugger_stackframe_t {
     zend_string *function;
     zend_string *filename;
     zend_long lineno;
 
-    /* list of stackdriver_debugger_variable_t */
-    HashTable *locals;
+    /* contiguous array of captured variables, allocated from the snapshot arena */
+    stackdriver_debugger_variable_t *locals;
+    uint32_t num_locals;
 } stackdriver_debugger_stackframe_t;
 
 /* Snapshot struct */
@@ -41,24 +104,68 @@ typedef struct stackdriver_debugger_snapshot_t {
     zend_long lineno;
     zend_string *condition;
     zend_bool fulfilled;
+
+    /* whether hits are coordinated with other workers by claiming the id */
+    zend_bool claimable;
+
+    /* whether this request holds the claim and has not delivered the snapshot */
+    zend_bool claimed;
     zend_long max_stack_eval_depth;
 
+    /* owners: the snapshots_by_id table and any callback Snapshot objects */
+    uint32_t refcount;
+    stackdriver_debugger_capture_options_t capture_options;
+
+    /* names of the variables to capture in each frame, NULL for all */
+    HashTable *capture_variables;
+
+    /* frames whose variables are captured, by filename, NULL for all */
+    stackdriver_debugger_path_filter_t *path_filter;
+
+    /* approximate bytes captured so far, checked against max_total_bytes */
+    size_t captured_bytes;
+
     zval callback;
 
+    /* callable resolved at registration, reused when the snapshot is hit */
+    zend_fcall_info callback_fci;
+    zend_fcall_info_cache callback_fcc;
+
     /* index => zval* (strings) */
     HashTable *expressions;
 
     /* zend_string* (expression) => zval* (result) */
     HashTable *evaluated_expressions;
 
-    /* list of stackdriver_debugger_stackframe_t */
-    HashTable *stackframes;
+    /*
+     * arena backing the captured stackframes and variables, created when the
+     * snapshot is hit and released as a whole when the snapshot is destroyed
+     */
+    zend_arena *arena;
+
+    /* number of distinct values in the variable table */
+    uint32_t var_table_size;
+
+    /*
+     * live value address => owning stackdriver_debugger_variable_t*, only
+     * allocated while the snapshot is being captured
+     */
+    HashTable *var_table_lookup;
+
+    /* contiguous array of captured stackframes, allocated from the arena */
+    stackdriver_debugger_stackframe_t *stackframes;
+    uint32_t num_stackframes;
 } stackdriver_debugger_snapshot_t;
 
 void evaluate_snapshot(zend_execute_data *execute_data, stackdriver_debugger_snapshot_t *snapshot);
 void list_snapshots(zval *return_value);
-int register_snapshot(zend_string *snapshot_id, zend_string *filename, zend_long lineno, zend_string *condition, HashTable *expressions, zval *callback, zend_long max_stack_eval_depth);
-/* request lifecycle callbacks */
+int register_snapshot(zend_string *snapshot_id, zend_string *filename, zend_long lineno, zend_string *condition, HashTable *expressions, zval *callback, zend_long max_stack_eval_depth, stackdriver_debugger_capture_options_t *capture_options, zval *capture_variables, stackdriver_debugger_path_filter_t *path_filter);
+int register_snapshot_ex(zend_string *snapshot_id, zend_string *filename, zend_long lineno, zend_string *condition, HashTable *expressions, zval *callback, zend_long max_stack_eval_depth, stackdriver_debugger_capture_options_t *capture_options, zval *capture_variables, stackdriver_debugger_path_filter_t *path_filter, zend_bool validated);
+extern zend_class_entry *stackdriver_debugger_snapshot_ce;
+extern zend_string *stackdriver_debugger_truncated_marker;
+
+/* lifecycle callbacks */
+int stackdriver_debugger_snapshot_minit(INIT_FUNC_ARGS);
 int stackdriver_debugger_snapshot_rinit(TSRMLS_D);
 int stackdriver_debugger_snapshot_rshutdown(TSRMLS_D);
 
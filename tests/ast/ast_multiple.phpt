@@ -0,0 +1,39 @@
+--TEST--
+Stackdriver Debugger: Can insert multiple breakpoints into the same file
+--FILE--
+<?php
+
+foreach ([5, 7, 9, 12, 63, 66] as $line) {
+    stackdriver_debugger_add_logpoint('code.php', $line, 'INFO', "Line $line hit!");
+}
+var_dump(stackdriver_debugger_add_snapshot('code.php', 9));
+
+require_once(__DIR__ . '/code.php');
+
+$sum = loop(10);
+$test = new TestClass();
+$test->executeClosure(2);
+
+echo "Sum is {$sum}\n";
+
+$counts = [];
+foreach (stackdriver_debugger_list_logpoints() as $logpoint) {
+    $message = $logpoint['message'];
+    $counts[$message] = isset($counts[$message]) ? $counts[$message] + 1 : 1;
+}
+foreach ($counts as $message => $count) {
+    echo "$message x $count" . PHP_EOL;
+}
+
+echo "Number of snapshots: " . count(stackdriver_debugger_list_snapshots()) . PHP_EOL;
+?>
+--EXPECT--
+bool(true)
+Sum is 45
+Line 5 hit! x 1
+Line 7 hit! x 10
+Line 9 hit! x 1
+Line 12 hit! x 1
+Line 66 hit! x 2
+Line 63 hit! x 2
+Number of snapshots: 1
@@ -0,0 +1,38 @@
+--TEST--
+Stackdriver Debugger: Batch callback receives collected breakpoints at request end
+--FILE--
+<?php
+
+function handle_batch($snapshots, $messages)
+{
+    echo "Number of snapshots: " . count($snapshots) . PHP_EOL;
+    echo "Number of messages: " . count($messages) . PHP_EOL;
+    foreach ($messages as $message) {
+        echo "logpoint: {$message['level']} - {$message['message']}" . PHP_EOL;
+    }
+}
+
+var_dump(stackdriver_debugger_set_batch_callback('missing_batch_callback'));
+var_dump(stackdriver_debugger_set_batch_callback('handle_batch'));
+
+// set a snapshot and a logpoint for line 7 in loop.php ($sum += $i)
+var_dump(stackdriver_debugger_add_snapshot('loop.php', 7));
+var_dump(stackdriver_debugger_add_logpoint('loop.php', 7, 'INFO', 'Logpoint hit!'));
+
+require_once(__DIR__ . '/loop.php');
+
+$sum = loop(2);
+
+echo "Sum is {$sum}\n";
+?>
+--EXPECTF--
+Warning: stackdriver_debugger_set_batch_callback(): Invalid batch callback: function 'missing_batch_callback' not found or invalid function name. in %s
+bool(false)
+bool(true)
+bool(true)
+bool(true)
+Sum is 1
+Number of snapshots: 1
+Number of messages: 2
+logpoint: INFO - Logpoint hit!
+logpoint: INFO - Logpoint hit!
@@ -0,0 +1,39 @@
+--TEST--
+Stackdriver Debugger: Exceptions thrown by the batch callback are reported as warnings
+--FILE--
+<?php
+
+class Reporter
+{
+    public function __destruct()
+    {
+        echo "Reporter destructed" . PHP_EOL;
+    }
+
+    public function report($snapshots, $messages)
+    {
+        echo "Number of messages: " . count($messages) . PHP_EOL;
+        throw new Exception('delivery failed');
+    }
+}
+
+$reporter = new Reporter();
+var_dump(stackdriver_debugger_set_batch_callback([$reporter, 'report']));
+
+// set a logpoint for line 7 in loop.php ($sum += $i)
+var_dump(stackdriver_debugger_add_logpoint('loop.php', 7, 'INFO', 'Logpoint hit!'));
+
+require_once(__DIR__ . '/loop.php');
+
+$sum = loop(2);
+
+echo "Sum is {$sum}\n";
+?>
+--EXPECTF--
+bool(true)
+bool(true)
+Sum is 1
+Number of messages: 2
+
+Warning: stackdriver_debugger_deliver_batch(): Error running batch callback. in %s on line %d
+Reporter destructed
@@ -0,0 +1,33 @@
+--TEST--
+Stackdriver Debugger: Compiled expressions see the current values of referenced variables
+--FILE--
+<?php
+
+// set a logpoint for line 7 in loop.php ($sum += $i)
+var_dump(stackdriver_debugger_add_logpoint('loop.php', 7, 'INFO', 'progress: $0', [
+    'condition' => '$i >= 8',
+    'expressions' => [
+        '$i . "/" . $times . " (" . ($sum + $i) . ")"'
+    ]
+]));
+
+require_once(__DIR__ . '/loop.php');
+
+$sum = loop(10);
+
+echo "Sum is {$sum}\n";
+
+$logpoints = stackdriver_debugger_list_logpoints();
+
+echo "Number of logpoints: " . count($logpoints) . PHP_EOL;
+
+foreach ($logpoints as $logpoint) {
+    echo $logpoint['message'] . PHP_EOL;
+}
+?>
+--EXPECT--
+bool(true)
+Sum is 45
+Number of logpoints: 2
+progress: 8/10 (36)
+progress: 9/10 (45)
@@ -0,0 +1,36 @@
+--TEST--
+Stackdriver Debugger: Logpoint callback is resolved when registering
+--FILE--
+<?php
+
+class LogHandler
+{
+    public function handle($level, $message, $context)
+    {
+        echo "logpoint: $level - $message " . basename($context['filename']) . ':' . $context['line'] . PHP_EOL;
+    }
+}
+
+// set a logpoint for line 7 in loop.php ($sum += $i)
+var_dump(stackdriver_debugger_add_logpoint('loop.php', 7, 'INFO', 'Never logged', [
+  'callback' => 'missing_logpoint_callback'
+]));
+
+var_dump(stackdriver_debugger_add_logpoint('loop.php', 7, 'INFO', 'Logpoint hit!', [
+  'callback' => [new LogHandler(), 'handle']
+]));
+
+require_once(__DIR__ . '/loop.php');
+
+$sum = loop(3);
+
+echo "Sum is {$sum}\n";
+?>
+--EXPECTF--
+Warning: stackdriver_debugger_add_logpoint(): Invalid logpoint callback: function 'missing_logpoint_callback' not found or invalid function name. in %s
+bool(false)
+bool(true)
+logpoint: INFO - Logpoint hit! loop.php:7
+logpoint: INFO - Logpoint hit! loop.php:7
+logpoint: INFO - Logpoint hit! loop.php:7
+Sum is 3
@@ -0,0 +1,29 @@
+--TEST--
+Stackdriver Debugger: Placeholders use the longest index naming an expression
+--FILE--
+<?php
+
+// set a logpoint for line 12 in loop.php (return $sum)
+var_dump(stackdriver_debugger_add_logpoint('loop.php', 12, 'INFO', 'a=$0 b=$10 c=$1 d=$11 e=$$1 f=$', [
+    'expressions' => [
+        '100', '101', '102', '103', '104', '105',
+        '106', '107', '108', '109', '110'
+    ]
+]));
+
+require_once(__DIR__ . '/loop.php');
+
+$sum = loop(10);
+
+$logpoints = stackdriver_debugger_list_logpoints();
+
+echo "Number of logpoints: " . count($logpoints) . PHP_EOL;
+
+foreach ($logpoints as $logpoint) {
+    echo $logpoint['message'] . PHP_EOL;
+}
+?>
+--EXPECT--
+bool(true)
+Number of logpoints: 1
+a=100 b=110 c=101 d=1011 e=$$1 f=$
@@ -0,0 +1,35 @@
+--TEST--
+Stackdriver Debugger: Simple conditions see the current values of the frame's variables
+--FILE--
+<?php
+
+// set a logpoint for line 7 in loop.php ($sum += $i)
+var_dump(stackdriver_debugger_add_logpoint('loop.php', 7, 'INFO', 'i: $0', [
+    'condition' => 'isset($j) && $i > 5 && !empty($sum)',
+    'expressions' => [
+        '$i'
+    ]
+]));
+
+require_once(__DIR__ . '/loop.php');
+
+$sum = loop(10);
+
+echo "Sum is {$sum}\n";
+
+$logpoints = stackdriver_debugger_list_logpoints();
+
+echo "Number of logpoints: " . count($logpoints) . PHP_EOL;
+
+foreach ($logpoints as $logpoint) {
+    echo $logpoint['message'] . PHP_EOL;
+}
+?>
+--EXPECT--
+bool(true)
+Sum is 45
+Number of logpoints: 4
+i: 6
+i: 7
+i: 8
+i: 9
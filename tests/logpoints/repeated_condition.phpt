@@ -0,0 +1,36 @@
+--TEST--
+Stackdriver Debugger: Conditions and expressions are re-evaluated on every hit
+--FILE--
+<?php
+
+// set a logpoint for line 7 in loop.php ($sum += $i)
+var_dump(stackdriver_debugger_add_logpoint('loop.php', 7, 'INFO', 'i: $0', [
+    'condition' => '$i % 2 == 0',
+    'expressions' => [
+        '$i'
+    ]
+]));
+
+require_once(__DIR__ . '/loop.php');
+
+$sum = loop(10);
+
+echo "Sum is {$sum}\n";
+
+$logpoints = stackdriver_debugger_list_logpoints();
+
+echo "Number of logpoints: " . count($logpoints) . PHP_EOL;
+
+foreach ($logpoints as $logpoint) {
+    echo $logpoint['message'] . PHP_EOL;
+}
+?>
+--EXPECT--
+bool(true)
+Sum is 45
+Number of logpoints: 5
+i: 0
+i: 2
+i: 4
+i: 6
+i: 8
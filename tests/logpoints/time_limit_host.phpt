@@ -0,0 +1,28 @@
+--TEST--
+Stackdriver Debugger: Logpoints should not spend more than the budget shared by all workers
+--INI--
+stackdriver_debugger.max_time=1000
+stackdriver_debugger.max_host_time_percentage=1
+--FILE--
+<?php
+
+function logpoint_callback($level, $message) {
+    echo "logpoint: $level - $message" . PHP_EOL;
+    usleep(6000);
+}
+// a 1% budget holds 10ms of debugger time and refills at 10ms per second
+var_dump(stackdriver_debugger_add_logpoint('loop.php', 7, 'INFO', 'Logpoint hit!', [
+  'callback' => 'logpoint_callback'
+]));
+
+require_once(__DIR__ . '/loop.php');
+
+$sum = loop(10);
+
+echo "Sum is {$sum}\n";
+?>
+--EXPECTF--
+bool(true)
+logpoint: INFO - Logpoint hit!
+logpoint: INFO - Logpoint hit!
+Sum is 45
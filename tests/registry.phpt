@@ -0,0 +1,54 @@
+--TEST--
+Stackdriver Debugger: Writing the shared breakpoint registry
+--SKIPIF--
+<?php if (strtoupper(substr(PHP_OS, 0, 3)) === 'WIN') die('skip registry is not supported on Windows'); ?>
+--INI--
+stackdriver_debugger.registry_path=/tmp/stackdriver_debugger_registry.test
+--FILE--
+<?php
+
+@unlink('/tmp/stackdriver_debugger_registry.test');
+
+var_dump(stackdriver_debugger_write_registry([]));
+var_dump(stackdriver_debugger_write_registry([
+    [
+        'id' => 'snapshot-1',
+        'filename' => __DIR__ . '/snapshots/loop.php',
+        'line' => 7,
+        'condition' => '$i == 3',
+        'expressions' => ['$sum']
+    ],
+    [
+        'type' => 'logpoint',
+        'id' => 'logpoint-1',
+        'filename' => __DIR__ . '/logpoints/loop.php',
+        'line' => 7,
+        'logLevel' => 'INFO',
+        'format' => 'Sum is $0',
+        'expressions' => ['$sum']
+    ]
+]));
+var_dump(stackdriver_debugger_write_registry([
+    ['id' => 'relative', 'filename' => 'loop.php', 'line' => 7]
+]));
+var_dump(stackdriver_debugger_write_registry([
+    ['id' => 'invalid', 'filename' => __DIR__ . '/snapshots/loop.php', 'line' => 7, 'condition' => '$times = 4;']
+]));
+var_dump(stackdriver_debugger_write_registry([
+    ['type' => 'logpoint', 'id' => 'no-format', 'filename' => __DIR__ . '/logpoints/loop.php', 'line' => 7]
+]));
+
+@unlink('/tmp/stackdriver_debugger_registry.test');
+?>
+--EXPECTF--
+int(1)
+int(2)
+
+Warning: stackdriver_debugger_write_registry(): Breakpoint filename 'loop.php' must be an absolute path. in %s on line %d
+bool(false)
+
+Warning: stackdriver_debugger_write_registry(): Condition contains invalid operations in %s on line %d
+bool(false)
+
+Warning: stackdriver_debugger_write_registry(): Logpoints require a logLevel and format. in %s on line %d
+bool(false)
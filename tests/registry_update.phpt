@@ -0,0 +1,41 @@
+--TEST--
+Stackdriver Debugger: Applying diffs to the shared breakpoint registry
+--SKIPIF--
+<?php if (strtoupper(substr(PHP_OS, 0, 3)) === 'WIN') die('skip registry is not supported on Windows'); ?>
+--INI--
+stackdriver_debugger.registry_path=/tmp/stackdriver_debugger_registry_update.test
+--FILE--
+<?php
+
+$registry = '/tmp/stackdriver_debugger_registry_update.test';
+@unlink($registry);
+
+function snapshot($id, $line)
+{
+    return ['id' => $id, 'filename' => __DIR__ . '/snapshots/loop.php', 'line' => $line];
+}
+
+var_dump(stackdriver_debugger_write_registry([snapshot('a', 7), snapshot('b', 7)]));
+$full = filesize($registry);
+
+// replacing a breakpoint by id keeps the number of records
+var_dump(stackdriver_debugger_update_registry([snapshot('b', 12)]));
+var_dump(filesize($registry) == $full);
+
+// removing both and adding one leaves a single record
+var_dump(stackdriver_debugger_update_registry([snapshot('c', 7)], ['a', 'b']));
+var_dump(filesize($registry) < $full);
+
+var_dump(stackdriver_debugger_update_registry([], ['c']));
+var_dump(filesize($registry));
+
+@unlink($registry);
+?>
+--EXPECT--
+int(1)
+int(2)
+bool(true)
+int(3)
+bool(true)
+int(4)
+int(24)
@@ -0,0 +1,44 @@
+--TEST--
+Stackdriver Debugger: Registering many breakpoints at once
+--FILE--
+<?php
+
+var_dump(stackdriver_debugger_add_breakpoints([
+    'first' => ['filename' => 'loop.php', 'line' => 7, 'snapshotId' => 'first'],
+    'second' => ['filename' => 'loop.php', 'line' => 9, 'snapshotId' => 'second'],
+    'log' => ['type' => 'logpoint', 'filename' => 'loop.php', 'line' => 7, 'logLevel' => 'INFO', 'format' => 'i is $0', 'expressions' => ['$i']],
+    'noline' => ['filename' => 'loop.php'],
+    'unknown' => ['type' => 'watchpoint', 'filename' => 'loop.php', 'line' => 7],
+], ['sourceRoot' => __DIR__]));
+
+require_once(__DIR__ . '/loop.php');
+
+$sum = loop(2);
+
+foreach (stackdriver_debugger_list_snapshots() as $snapshot) {
+    echo $snapshot['id'] . PHP_EOL;
+}
+
+foreach (stackdriver_debugger_list_logpoints() as $message) {
+    echo "{$message['level']}: {$message['message']}" . PHP_EOL;
+}
+?>
+--EXPECTF--
+Warning: stackdriver_debugger_add_breakpoints(): Breakpoints require a filename and line. in %s on line %d
+
+Warning: stackdriver_debugger_add_breakpoints(): Unknown breakpoint type 'watchpoint'. in %s on line %d
+array(5) {
+  ["first"]=>
+  bool(true)
+  ["second"]=>
+  bool(true)
+  ["log"]=>
+  bool(true)
+  ["noline"]=>
+  bool(false)
+  ["unknown"]=>
+  bool(false)
+}
+first
+INFO: i is 0
+INFO: i is 1
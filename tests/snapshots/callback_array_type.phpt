@@ -0,0 +1,29 @@
+--TEST--
+Stackdriver Debugger: Snapshot callbacks typed array receive the snapshot array
+--FILE--
+<?php
+
+function handle_snapshot(array $snapshot)
+{
+    var_dump(is_array($snapshot));
+    echo "id: " . $snapshot['id'] . PHP_EOL;
+    echo "Number of stackframes: " . count($snapshot['stackframes']) . PHP_EOL;
+}
+
+var_dump(stackdriver_debugger_add_snapshot('loop.php', 7, [
+    'snapshotId' => 'typed',
+    'callback' => 'handle_snapshot'
+]));
+
+require_once(__DIR__ . '/loop.php');
+
+$sum = loop(10);
+
+echo "Sum is {$sum}\n";
+?>
+--EXPECT--
+bool(true)
+bool(true)
+id: typed
+Number of stackframes: 2
+Sum is 45
@@ -0,0 +1,54 @@
+--TEST--
+Stackdriver Debugger: Snapshot callbacks receive a lazily converted Snapshot object
+--FILE--
+<?php
+
+function handle_snapshot($snapshot)
+{
+    echo get_class($snapshot) . PHP_EOL;
+    var_dump($snapshot instanceof ArrayAccess, $snapshot instanceof IteratorAggregate);
+
+    echo "id: " . $snapshot['id'] . PHP_EOL;
+    var_dump(isset($snapshot['stackframes']), isset($snapshot['unknown']));
+    echo "Number of stackframes: " . count($snapshot['stackframes']) . PHP_EOL;
+
+    foreach ($snapshot as $key => $value) {
+        echo $key . PHP_EOL;
+    }
+
+    $array = $snapshot->toArray();
+    var_dump(is_array($array), $array['id'] === $snapshot['id']);
+
+    // the object may outlive the callback
+    $GLOBALS['kept'] = $snapshot;
+}
+
+var_dump(stackdriver_debugger_add_snapshot('loop.php', 7, [
+    'snapshotId' => 'lazy',
+    'callback' => 'handle_snapshot'
+]));
+
+require_once(__DIR__ . '/loop.php');
+
+$sum = loop(10);
+
+echo "Sum is {$sum}\n";
+echo "kept: " . $kept['id'] . PHP_EOL;
+?>
+--EXPECT--
+bool(true)
+StackdriverDebugger\Snapshot
+bool(true)
+bool(true)
+id: lazy
+bool(true)
+bool(false)
+Number of stackframes: 2
+id
+stackframes
+evaluatedExpressions
+variableTable
+bool(true)
+bool(true)
+Sum is 45
+kept: lazy
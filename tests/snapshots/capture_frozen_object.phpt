@@ -0,0 +1,49 @@
+--TEST--
+Stackdriver Debugger: Frozen objects are copied at the time of the snapshot
+--FILE--
+<?php
+
+var_dump(stackdriver_debugger_add_snapshot('echo.php', 4, [
+    'freezeObjects' => true
+]));
+
+require_once(__DIR__ . '/echo.php');
+
+class Foo
+{
+    public $bar;
+    private $self;
+
+    public function __construct($bar)
+    {
+        $this->bar = $bar;
+        $this->self = $this;
+    }
+
+    public function __debugInfo()
+    {
+        echo "__debugInfo called" . PHP_EOL;
+        return [];
+    }
+}
+
+$input = new Foo('asdf');
+$output = echoValue($input);
+$input->bar = 'changed';
+
+$list = stackdriver_debugger_list_snapshots();
+$local = $list[0]['stackframes'][0]['locals'][0];
+
+echo "same id: " . ($local['id'] == spl_object_hash($input) ? 'yes' : 'no') . PHP_EOL;
+$properties = (array) $local['value'];
+echo "class: " . $properties['__PHP_Incomplete_Class_Name'] . PHP_EOL;
+echo "bar: " . $properties['bar'] . PHP_EOL;
+var_dump($properties["\0Foo\0self"]);
+
+?>
+--EXPECT--
+bool(true)
+same id: yes
+class: Foo
+bar: asdf
+string(11) "[truncated]"
@@ -0,0 +1,40 @@
+--TEST--
+Stackdriver Debugger: Captured values are truncated by the capture limits
+--FILE--
+<?php
+
+var_dump(stackdriver_debugger_add_snapshot('echo.php', 4, [
+    'maxMemberDepth' => 1,
+    'maxMembers' => 3,
+    'maxStringLength' => 5
+]));
+
+require_once(__DIR__ . '/echo.php');
+
+$input = ['Hello, World!', 'abc', [1, 2], 4, 5];
+$output = echoValue($input);
+
+$list = stackdriver_debugger_list_snapshots();
+$local = $list[0]['stackframes'][0]['locals'][0];
+
+echo "name: " . $local['name'] . PHP_EOL;
+var_dump($local['truncated']);
+var_dump($local['value']);
+
+// the original value is untouched
+echo "original count: " . count($input) . PHP_EOL;
+
+?>
+--EXPECT--
+bool(true)
+name: value
+bool(true)
+array(3) {
+  [0]=>
+  string(5) "Hello"
+  [1]=>
+  string(3) "abc"
+  [2]=>
+  string(11) "[truncated]"
+}
+original count: 5
@@ -0,0 +1,39 @@
+--TEST--
+Stackdriver Debugger: Capture limits apply to objects without freezeObjects
+--FILE--
+<?php
+
+var_dump(stackdriver_debugger_add_snapshot('echo.php', 4, [
+    'maxMemberDepth' => 1,
+    'maxStringLength' => 5
+]));
+
+require_once(__DIR__ . '/echo.php');
+
+class Foo
+{
+    public $name = 'Hello, World!';
+    public $list = [1, 2];
+}
+
+$input = new Foo();
+$output = echoValue($input);
+$input->name = 'changed';
+
+$list = stackdriver_debugger_list_snapshots();
+$local = $list[0]['stackframes'][0]['locals'][0];
+
+var_dump($local['truncated']);
+echo "same id: " . ($local['id'] == spl_object_hash($input) ? 'yes' : 'no') . PHP_EOL;
+$properties = (array) $local['value'];
+echo "class: " . $properties['__PHP_Incomplete_Class_Name'] . PHP_EOL;
+var_dump($properties['name'], $properties['list']);
+
+?>
+--EXPECT--
+bool(true)
+bool(true)
+same id: yes
+class: Foo
+string(5) "Hello"
+string(11) "[truncated]"
@@ -0,0 +1,50 @@
+--TEST--
+Stackdriver Debugger: Only the watched variables are captured
+--FILE--
+<?php
+
+// set snapshots for line 7 in loop.php ($sum += $i)
+var_dump(stackdriver_debugger_add_snapshot('loop.php', 7, [
+    'snapshotId' => 'list',
+    'captureVariables' => ['$sum', 'times']
+]));
+var_dump(stackdriver_debugger_add_snapshot('loop.php', 7, [
+    'snapshotId' => 'auto',
+    'condition' => '$i == 2',
+    'expressions' => ['$sum * 2'],
+    'captureVariables' => 'auto'
+]));
+var_dump(stackdriver_debugger_add_snapshot('loop.php', 7, [
+    'captureVariables' => 42
+]));
+
+require_once(__DIR__ . '/loop.php');
+
+$sum = loop(10);
+
+echo "Sum is {$sum}\n";
+
+foreach (stackdriver_debugger_list_snapshots() as $snapshot) {
+    echo $snapshot['id'] . PHP_EOL;
+    foreach ($snapshot['stackframes'] as $stackframe) {
+        $names = array_map(function ($local) {
+            return $local['name'];
+        }, $stackframe['locals']);
+        sort($names);
+        echo basename($stackframe['filename']) . ": " . implode(', ', $names) . PHP_EOL;
+    }
+}
+?>
+--EXPECTF--
+bool(true)
+bool(true)
+
+Warning: stackdriver_debugger_add_snapshot(): captureVariables must be a list of variable names, "*" or "auto". in %s on line %d
+bool(false)
+Sum is 45
+list
+loop.php: sum, times
+capture_variables.php: sum
+auto
+loop.php: i, sum
+capture_variables.php: sum
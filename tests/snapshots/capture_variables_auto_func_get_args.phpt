@@ -0,0 +1,33 @@
+--TEST--
+Stackdriver Debugger: Automatic watch lists capture all variables for expressions calling func_get_args()
+--FILE--
+<?php
+
+// set a snapshot for line 7 in loop.php ($sum += $i)
+var_dump(stackdriver_debugger_add_snapshot('loop.php', 7, [
+    'snapshotId' => 'func_get_args',
+    'expressions' => ['func_get_args()'],
+    'captureVariables' => 'auto'
+]));
+
+require_once(__DIR__ . '/loop.php');
+
+$sum = loop(10);
+
+echo "Sum is {$sum}\n";
+
+foreach (stackdriver_debugger_list_snapshots() as $snapshot) {
+    echo $snapshot['id'] . PHP_EOL;
+    $stackframe = $snapshot['stackframes'][0];
+    $names = array_map(function ($local) {
+        return $local['name'];
+    }, $stackframe['locals']);
+    sort($names);
+    echo basename($stackframe['filename']) . ": " . implode(', ', $names) . PHP_EOL;
+}
+?>
+--EXPECTF--
+bool(true)
+%ASum is 45
+func_get_args
+loop.php: i, j, sum, times
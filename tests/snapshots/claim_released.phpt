@@ -0,0 +1,38 @@
+--TEST--
+Stackdriver Debugger: Claims on snapshots which were not delivered are released
+--FILE--
+<?php
+
+function failing_callback($snapshot)
+{
+    echo "failed {$snapshot['id']}" . PHP_EOL;
+    throw new Exception('delivery failed');
+}
+
+function handle_snapshot($snapshot)
+{
+    echo "captured {$snapshot['id']}" . PHP_EOL;
+}
+
+require_once(__DIR__ . '/loop.php');
+
+var_dump(stackdriver_debugger_add_snapshot('loop.php', 7, [
+    'snapshotId' => 'retry',
+    'callback' => 'failing_callback'
+]));
+loop(1);
+
+// replacing the undelivered snapshot releases its claim
+var_dump(stackdriver_debugger_add_snapshot('loop.php', 7, [
+    'snapshotId' => 'retry',
+    'callback' => 'handle_snapshot'
+]));
+loop(1);
+?>
+--EXPECTF--
+bool(true)
+failed retry
+
+Warning: %s: Error running snapshot callback. in %s on line %d
+bool(true)
+captured retry
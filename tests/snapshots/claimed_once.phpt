@@ -0,0 +1,37 @@
+--TEST--
+Stackdriver Debugger: Snapshots with an id are only captured by the first hit
+--FILE--
+<?php
+
+function handle_snapshot($snapshot)
+{
+    echo "captured {$snapshot['id']}" . PHP_EOL;
+}
+
+require_once(__DIR__ . '/loop.php');
+
+foreach (['first', 'second'] as $attempt) {
+    echo $attempt . PHP_EOL;
+
+    // a new registration is not fulfilled yet, but its id is already claimed
+    var_dump(stackdriver_debugger_add_snapshot('loop.php', 7, [
+        'snapshotId' => 'once',
+        'callback' => 'handle_snapshot'
+    ]));
+    var_dump(stackdriver_debugger_add_snapshot('loop.php', 7, [
+        'callback' => 'handle_snapshot'
+    ]));
+
+    loop(2);
+}
+?>
+--EXPECTF--
+first
+bool(true)
+bool(true)
+captured once
+captured %s
+second
+bool(true)
+bool(true)
+captured %s
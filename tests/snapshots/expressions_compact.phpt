@@ -0,0 +1,33 @@
+--TEST--
+Stackdriver Debugger: Expressions calling compact() read the frame's variables
+--FILE--
+<?php
+
+// set a snapshot for line 7 in loop.php ($sum += $i)
+var_dump(stackdriver_debugger_add_snapshot('loop.php', 7, [
+    'expressions' => [
+        'compact("sum", "times")'
+    ]
+]));
+
+require_once(__DIR__ . '/loop.php');
+
+$sum = loop(10);
+
+echo "Sum is {$sum}\n";
+
+$list = stackdriver_debugger_list_snapshots();
+var_dump($list[0]['evaluatedExpressions']);
+?>
+--EXPECT--
+bool(true)
+Sum is 45
+array(1) {
+  ["compact("sum", "times")"]=>
+  array(2) {
+    ["sum"]=>
+    int(0)
+    ["times"]=>
+    int(10)
+  }
+}
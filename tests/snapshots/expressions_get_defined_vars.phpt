@@ -0,0 +1,28 @@
+--TEST--
+Stackdriver Debugger: Expressions calling get_defined_vars() read the frame's variables
+--FILE--
+<?php
+
+// set a snapshot for line 7 in loop.php ($sum += $i)
+var_dump(stackdriver_debugger_add_snapshot('loop.php', 7, [
+    'expressions' => [
+        'array_key_exists("times", get_defined_vars())'
+    ]
+]));
+
+require_once(__DIR__ . '/loop.php');
+
+$sum = loop(10);
+
+echo "Sum is {$sum}\n";
+
+$list = stackdriver_debugger_list_snapshots();
+var_dump($list[0]['evaluatedExpressions']);
+?>
+--EXPECT--
+bool(true)
+Sum is 45
+array(1) {
+  ["array_key_exists("times", get_defined_vars())"]=>
+  bool(true)
+}
@@ -0,0 +1,37 @@
+--TEST--
+Stackdriver Debugger: Breakpoints which cannot be injected are reported
+--FILE--
+<?php
+
+// line 2 in loop.php is before any statement
+var_dump(stackdriver_debugger_add_snapshot('loop.php', 2, [
+    'snapshotId' => 'before-function'
+]));
+
+// set a snapshot for line 7 in loop.php ($sum += $i)
+var_dump(stackdriver_debugger_add_snapshot('loop.php', 7, [
+    'snapshotId' => 'in-loop'
+]));
+
+require_once(__DIR__ . '/loop.php');
+
+$sum = loop(10);
+
+echo "Number of breakpoints: " . count(stackdriver_debugger_list_snapshots()) . PHP_EOL;
+
+$failed = stackdriver_debugger_list_failed_breakpoints();
+echo "Number of failed breakpoints: " . count($failed) . PHP_EOL;
+var_dump($failed[0]['id']);
+var_dump(basename($failed[0]['filename']));
+var_dump($failed[0]['mtime'] == filemtime(__DIR__ . '/loop.php'));
+var_dump(is_string($failed[0]['reason']));
+?>
+--EXPECT--
+bool(true)
+bool(true)
+Number of breakpoints: 1
+Number of failed breakpoints: 1
+string(15) "before-function"
+string(8) "loop.php"
+bool(true)
+bool(true)
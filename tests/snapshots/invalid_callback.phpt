@@ -0,0 +1,22 @@
+--TEST--
+Stackdriver Debugger: Snapshot callback is resolved when registering
+--FILE--
+<?php
+
+// set a snapshot for line 7 in loop.php ($sum += $i)
+var_dump(stackdriver_debugger_add_snapshot('loop.php', 7, [
+    'callback' => 'missing_snapshot_callback'
+]));
+
+require_once(__DIR__ . '/loop.php');
+
+$sum = loop(10);
+
+$list = stackdriver_debugger_list_snapshots();
+
+echo "Number of breakpoints: " . count($list) . PHP_EOL;
+?>
+--EXPECTF--
+Warning: stackdriver_debugger_add_snapshot(): Invalid snapshot callback: function 'missing_snapshot_callback' not found or invalid function name. in %s
+bool(false)
+Number of breakpoints: 0
@@ -0,0 +1,37 @@
+--TEST--
+Stackdriver Debugger: Breakpoint options with the wrong type are rejected
+--FILE--
+<?php
+
+var_dump(stackdriver_debugger_add_snapshot('loop.php', 7, ['snapshotId' => 123, 'sourceRoot' => __DIR__]));
+var_dump(stackdriver_debugger_add_logpoint('loop.php', 7, 'INFO', 'hit', ['condition' => ['$i'], 'sourceRoot' => __DIR__]));
+
+var_dump(stackdriver_debugger_add_breakpoints([
+    'condition' => ['filename' => 'loop.php', 'line' => 7, 'condition' => 1],
+    'expressions' => ['filename' => 'loop.php', 'line' => 7, 'expressions' => '$i'],
+    'expression' => ['filename' => 'loop.php', 'line' => 7, 'expressions' => [1]],
+    'valid' => ['filename' => 'loop.php', 'line' => 7, 'snapshotId' => 'valid'],
+], ['sourceRoot' => __DIR__]));
+?>
+--EXPECTF--
+Warning: stackdriver_debugger_add_snapshot(): Breakpoint snapshotId must be a string. in %s on line %d
+bool(false)
+
+Warning: stackdriver_debugger_add_logpoint(): Breakpoint condition must be a string. in %s on line %d
+bool(false)
+
+Warning: stackdriver_debugger_add_breakpoints(): Breakpoint condition must be a string. in %s on line %d
+
+Warning: stackdriver_debugger_add_breakpoints(): Breakpoint expressions must be an array. in %s on line %d
+
+Warning: stackdriver_debugger_add_breakpoints(): Breakpoint expressions must be strings. in %s on line %d
+array(4) {
+  ["condition"]=>
+  bool(false)
+  ["expressions"]=>
+  bool(false)
+  ["expression"]=>
+  bool(false)
+  ["valid"]=>
+  bool(true)
+}
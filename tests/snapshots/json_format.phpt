@@ -0,0 +1,60 @@
+--TEST--
+Stackdriver Debugger: Snapshots can be reported as Breakpoint JSON
+--FILE--
+<?php
+
+var_dump(stackdriver_debugger_add_snapshot('echo.php', 4, [
+    'snapshotId' => 'json-snapshot',
+    'format' => 'json',
+    'expressions' => ['$value[0]'],
+    'maxStringLength' => 3
+]));
+
+require_once(__DIR__ . '/echo.php');
+
+$input = ["a\"b\n", 12];
+$output = echoValue($input);
+
+$list = stackdriver_debugger_list_snapshots();
+var_dump(is_string($list[0]));
+
+$breakpoint = json_decode($list[0], true);
+echo "id: " . $breakpoint['id'] . PHP_EOL;
+echo "path: " . basename($breakpoint['location']['path']) . PHP_EOL;
+echo "line: " . $breakpoint['location']['line'] . PHP_EOL;
+echo "frames: " . count($breakpoint['stackFrames']) . PHP_EOL;
+
+$frame = $breakpoint['stackFrames'][0];
+echo "function: " . $frame['function'] . PHP_EOL;
+$local = $frame['locals'][0];
+echo "local: " . $local['name'] . PHP_EOL;
+
+$value = $breakpoint['variableTable'][$local['varTableIndex']];
+echo "type: " . $value['type'] . PHP_EOL;
+echo "truncated: " . $value['status']['description']['format'] . PHP_EOL;
+foreach ($value['members'] as $member) {
+    echo $member['name'] . " => " . $member['type'] . " " . json_encode($member['value']) . PHP_EOL;
+}
+
+$expression = $breakpoint['evaluatedExpressions'][0];
+echo "expression: " . $expression['name'] . " => " . json_encode($expression['value']) . PHP_EOL;
+
+var_dump(stackdriver_debugger_add_snapshot('echo.php', 4, ['format' => 'xml']));
+?>
+--EXPECTF--
+bool(true)
+bool(true)
+id: json-snapshot
+path: echo.php
+line: 4
+frames: 2
+function: echoValue
+local: value
+type: array
+truncated: Value truncated by capture limits
+0 => string "a\"b"
+1 => int "12"
+expression: $value[0] => "a\"b"
+
+Warning: stackdriver_debugger_add_snapshot(): Unknown snapshot format 'xml'. in %s on line %d
+bool(false)
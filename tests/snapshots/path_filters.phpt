@@ -0,0 +1,39 @@
+--TEST--
+Stackdriver Debugger: Snapshot variables are only captured for stackframes matching the path filters
+--FILE--
+<?php
+
+var_dump(stackdriver_debugger_add_snapshot('deep.php', 8, [
+    'snapshotId' => 'exclude',
+    'excludePaths' => ['deep.php']
+]));
+var_dump(stackdriver_debugger_add_snapshot('deep.php', 8, [
+    'snapshotId' => 'include',
+    'includePaths' => ['deep.php'],
+    'maxDepth' => 2
+]));
+var_dump(stackdriver_debugger_add_snapshot('deep.php', 8, [
+    'snapshotId' => 'longest',
+    'includePaths' => [__DIR__ . '/'],
+    'excludePaths' => [__DIR__ . '/deep']
+]));
+
+require_once(__DIR__ . '/deep.php');
+
+$depth = depth6();
+
+foreach (stackdriver_debugger_list_snapshots() as $snapshot) {
+    echo $snapshot['id'] . ":";
+    foreach ($snapshot['stackframes'] as $stackframe) {
+        echo count($stackframe['locals']) > 0 ? " y" : " n";
+    }
+    echo PHP_EOL;
+}
+?>
+--EXPECT--
+bool(true)
+bool(true)
+bool(true)
+exclude: n n n n n n y
+include: y y n n n n n
+longest: n n n n n n y
@@ -0,0 +1,23 @@
+--TEST--
+Stackdriver Debugger: Snapshots whose ids share a probe code are both captured
+--FILE--
+<?php
+
+// 'Ab' and 'BA' have the same string hash
+var_dump(stackdriver_debugger_add_snapshot('loop.php', 7, ['snapshotId' => 'Ab']));
+var_dump(stackdriver_debugger_add_snapshot('loop.php', 9, ['snapshotId' => 'BA']));
+
+require_once(__DIR__ . '/loop.php');
+
+$sum = loop(4);
+
+foreach (stackdriver_debugger_list_snapshots() as $snapshot) {
+    echo $snapshot['id'] . ': ' . basename($snapshot['stackframes'][0]['filename']) . ':' .
+        $snapshot['stackframes'][0]['line'] . PHP_EOL;
+}
+?>
+--EXPECT--
+bool(true)
+bool(true)
+Ab: loop.php:7
+BA: loop.php:9
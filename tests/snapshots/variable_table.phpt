@@ -0,0 +1,39 @@
+--TEST--
+Stackdriver Debugger: Values shared across stackframes are captured once in the variable table
+--FILE--
+<?php
+
+var_dump(stackdriver_debugger_add_snapshot('echo.php', 4));
+
+require_once(__DIR__ . '/echo.php');
+
+$input = [1, 2, "foo", "bar", [1, 2]];
+$other = "not shared";
+$output = echoValue($input);
+
+$list = stackdriver_debugger_list_snapshots();
+$breakpoint = $list[0];
+
+$echoVariables = $breakpoint['stackframes'][0]['locals'];
+$rootVariables = [];
+foreach ($breakpoint['stackframes'][1]['locals'] as $local) {
+    $rootVariables[$local['name']] = $local;
+}
+
+$value = $echoVariables[0];
+echo "shared index: " . ($value['varTableIndex'] === $rootVariables['input']['varTableIndex'] ? 'yes' : 'no') . PHP_EOL;
+echo "distinct index: " . ($value['varTableIndex'] !== $rootVariables['other']['varTableIndex'] ? 'yes' : 'no') . PHP_EOL;
+echo "scalar has index: " . (array_key_exists('varTableIndex', $rootVariables['output']) ? 'yes' : 'no') . PHP_EOL;
+echo "shared keeps value: " . ($value['value'] === $input ? 'yes' : 'no') . PHP_EOL;
+echo "table value matches: " . ($breakpoint['variableTable'][$value['varTableIndex']] === $input ? 'yes' : 'no') . PHP_EOL;
+echo "table size: " . count($breakpoint['variableTable']) . PHP_EOL;
+
+?>
+--EXPECTF--
+bool(true)
+shared index: yes
+distinct index: yes
+scalar has index: no
+shared keeps value: yes
+table value matches: yes
+table size: %d
@@ -0,0 +1,43 @@
+--TEST--
+Stackdriver Debugger: Cached statement verdicts follow the function whitelist
+--FILE--
+<?php
+
+$statements = [
+    'foo($bar)',
+    '$foo = 1',
+    '$foo +',
+];
+
+foreach ([1, 2] as $pass) {
+    foreach ($statements as $statement) {
+        $valid = stackdriver_debugger_valid_statement($statement) ? 'true' : 'false';
+        echo "statement: '$statement' valid: $valid" . PHP_EOL;
+    }
+}
+
+ini_set('stackdriver_debugger.function_whitelist', 'foo');
+
+$valid = stackdriver_debugger_valid_statement('foo($bar)') ? 'true' : 'false';
+echo "statement: 'foo(\$bar)' valid: $valid" . PHP_EOL;
+
+?>
+--EXPECTF--
+Warning: stackdriver_debugger_valid_statement(): Condition contains invalid operations in %s on line %d
+statement: 'foo($bar)' valid: false
+
+Warning: stackdriver_debugger_valid_statement(): Condition contains invalid operations in %s on line %d
+statement: '$foo = 1' valid: false
+
+Warning: stackdriver_debugger_valid_statement(): Unable to compile condition. in %s on line %d
+statement: '$foo +' valid: false
+
+Warning: stackdriver_debugger_valid_statement(): Condition contains invalid operations in %s on line %d
+statement: 'foo($bar)' valid: false
+
+Warning: stackdriver_debugger_valid_statement(): Condition contains invalid operations in %s on line %d
+statement: '$foo = 1' valid: false
+
+Warning: stackdriver_debugger_valid_statement(): Unable to compile condition. in %s on line %d
+statement: '$foo +' valid: false
+statement: 'foo($bar)' valid: true